@@ -0,0 +1,83 @@
+#pragma once
+#include "DeviceMemory.hpp"
+#include "Descriptors.hpp"
+#include "MemoryPools.hpp"
+#include "Pipeline.hpp"
+#include "Shaders.hpp"
+#include "PCH.hpp"
+
+namespace vdu {
+
+class LogicalDevice;
+class CommandBuffer;
+
+/*
+    Compresses an RGBA8 texture into a BC1, BC3 or BC7 texture of the same
+    size on the GPU. One compute invocation encodes each 4x4 block into a
+    buffer, which is then copied into the destination for every mip the two
+    textures share. BC1 is always opaque, BC7 blocks use mode 6 (one subset,
+    RGBA endpoints).
+
+    The source needs VK_IMAGE_USAGE_SAMPLED_BIT and one layer. If both
+    textures are sRGB the blocks are fitted in sRGB space
+*/
+class BlockCompressor {
+public:
+  enum class Quality {
+    Fast,   // Bounding box endpoints
+    Normal, // Principal axis endpoints refined once by least squares
+    High    // Three refinements and a search over the nearest BC7 weights
+  };
+
+  void setQuality(Quality quality);
+
+  void create(LogicalDevice *logicalDevice, Texture *source,
+              Texture *destination);
+  void destroy();
+
+  /*
+      'source' must be in SHADER_READ_ONLY_OPTIMAL. The destination's mips
+      end up in its layout (TRANSFER_DST_OPTIMAL if it has none)
+  */
+  void cmdCompress(CommandBuffer *cmd);
+  void cmdCompress(const VkCommandBuffer &cmd);
+
+  /*
+      Source texels encoded per second by the last cmdCompress(), measured
+      with timestamps. Its submission must have completed
+  */
+  double getThroughput();
+
+  uint32_t getMipCount() { return m_regions.size(); }
+  VkDeviceSize getCompressedSize() { return m_blocks.getSize(); }
+
+private:
+  std::string getShaderSource(VkFormat format, bool srgb);
+
+  LogicalDevice *m_logicalDevice = nullptr;
+  Texture *m_source = nullptr;
+  Texture *m_destination = nullptr;
+  Quality m_quality = Quality::Normal;
+
+  struct MipDispatch {
+    uint32_t blockCountX;
+    uint32_t blockCountY;
+    uint32_t blockOffset;
+    int32_t mipLevel;
+  };
+
+  std::vector<MipDispatch> m_dispatches;
+  std::vector<VkBufferImageCopy> m_regions;
+  uint64_t m_texelCount = 0;
+
+  Buffer m_blocks;
+  QueryPool m_timestamps;
+
+  ShaderProgram m_shader;
+  DescriptorPool m_descriptorPool;
+  DescriptorSetLayout m_descriptorSetLayout;
+  DescriptorSet m_descriptorSet;
+  PipelineLayout m_pipelineLayout;
+  ComputePipeline m_pipeline;
+};
+} // namespace vdu
@@ -0,0 +1,74 @@
+#pragma once
+#include "CommandBuffer.hpp"
+#include "DeviceMemory.hpp"
+#include "MemoryPools.hpp"
+#include "Synchro.hpp"
+#include "PCH.hpp"
+
+namespace vdu {
+
+class LogicalDevice;
+class Queue;
+
+/*
+    Moves buffer ranges of any size between the host and the device through
+    a small ring of fixed size staging chunks, each with its own command
+    buffer and fence. The host fills (or drains) one chunk while the device
+    copies the others, so staging memory stays at chunkSize * chunkCount
+    however large the transfer is.
+
+    Transfers block until they complete and use no barriers for the buffers
+    beyond their own copies, order them against other work on the queue
+*/
+class ChunkedTransfer {
+public:
+  // Fills or drains 'size' bytes at 'offset' into the transfer
+  using Producer =
+      std::function<bool(void *dst, VkDeviceSize offset, VkDeviceSize size)>;
+  using Consumer = std::function<bool(const void *src, VkDeviceSize offset,
+                                      VkDeviceSize size)>;
+
+  void create(LogicalDevice *logicalDevice, Queue *queue,
+              VkDeviceSize chunkSize = 8 * 1024 * 1024,
+              uint32_t chunkCount = 3);
+  void destroy();
+
+  // 'dst' needs VK_BUFFER_USAGE_TRANSFER_DST_BIT
+  bool upload(Buffer *dst, const void *data, VkDeviceSize size,
+              VkDeviceSize dstOffset = 0);
+  bool upload(Buffer *dst, VkDeviceSize size, Producer producer,
+              VkDeviceSize dstOffset = 0);
+
+  // 'src' needs VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+  bool download(Buffer *src, void *data, VkDeviceSize size,
+                VkDeviceSize srcOffset = 0);
+  bool download(Buffer *src, VkDeviceSize size, Consumer consumer,
+                VkDeviceSize srcOffset = 0);
+
+  VkDeviceSize getChunkSize() { return m_chunkSize; }
+  VkDeviceSize getStagingSize() { return m_chunkSize * m_chunks.size(); }
+
+private:
+  struct Chunk {
+    CommandBuffer commandBuffer;
+    Fence fence;
+    bool inFlight = false;
+  };
+
+  // Upload and download staging are created on first use
+  Buffer *getStaging(bool download);
+  void submitCopy(Chunk &chunk, Buffer *src, Buffer *dst,
+                  const VkBufferCopy &region, bool download);
+  void waitChunk(Chunk &chunk);
+  void waitIdle();
+
+  LogicalDevice *m_logicalDevice = nullptr;
+  Queue *m_queue = nullptr;
+  VkDeviceSize m_chunkSize = 0;
+
+  CommandPool m_commandPool;
+  std::vector<Chunk> m_chunks;
+  Buffer m_uploadStaging;
+  Buffer m_downloadStaging;
+};
+} // namespace vdu
@@ -0,0 +1,80 @@
+#pragma once
+#include "DeviceMemory.hpp"
+#include "PCH.hpp"
+
+namespace vdu {
+
+class CommandBuffer;
+
+/*
+    Collects buffer-to-buffer and buffer-to-image copy regions and records one
+    copy command per (source, destination) pair. Buffer regions are sorted by
+    destination offset, a later region overwrites the part of an earlier one it
+    overlaps and ranges left contiguous in both buffers are merged. Image
+    regions that are exact repeats replace the earlier one, adjacent rows are
+    merged and partially overlapping regions go into a following command behind
+    a barrier. Regions of different pairs must not overlap, as with separate
+    copy commands. Copies within one buffer where a region reads what another
+    writes are recorded in the order added instead, split into commands
+    behind barriers wherever one depends on another
+*/
+class CopyBatch {
+public:
+  void addCopy(Buffer *src, Buffer *dst, VkDeviceSize size,
+               VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0);
+  void addCopy(const VkBuffer &src, const VkBuffer &dst,
+               const VkBufferCopy &region);
+
+  // 'dst' must be in TRANSFER_DST_OPTIMAL when the copies are executed
+  void addCopy(Buffer *src, Texture *dst, const VkBufferImageCopy &region);
+  void addCopy(const VkBuffer &src, Texture *dst,
+               const VkBufferImageCopy &region);
+
+  void cmdCopy(CommandBuffer *cmd);
+  void cmdCopy(const VkCommandBuffer &cmd);
+
+  // Drops the collected regions and resets the statistics
+  void clear();
+
+  bool isEmpty() { return m_regionCount == 0; }
+
+  // Counts of the regions added since clear() against the last cmdCopy()
+  uint32_t getRegionCount() { return m_regionCount; }
+  uint32_t getRecordedRegionCount() { return m_recordedRegionCount; }
+  uint32_t getCommandCount() { return m_commandCount; }
+  uint32_t getCommandsSaved() { return m_regionCount - m_commandCount; }
+  VkDeviceSize getBytesSaved() { return m_bytesAdded - m_bytesRecorded; }
+
+private:
+  struct BufferRange {
+    VkDeviceSize dstEnd;
+    VkDeviceSize srcOffset;
+  };
+
+  struct BufferPair {
+    VkBuffer src;
+    VkBuffer dst;
+    std::map<VkDeviceSize, BufferRange> ranges; // Keyed by destination offset
+    std::vector<VkBufferCopy> ordered; // As added, only when src == dst
+  };
+
+  struct ImagePair {
+    VkBuffer src;
+    Texture *dst;
+    std::vector<std::vector<VkBufferImageCopy>> commands;
+  };
+
+  void cmdCopyInOrder(const VkCommandBuffer &cmd, const BufferPair &pair);
+  VkDeviceSize getImageRegionSize(Texture *dst,
+                                  const VkBufferImageCopy &region);
+
+  std::vector<BufferPair> m_bufferPairs;
+  std::vector<ImagePair> m_imagePairs;
+
+  uint32_t m_regionCount = 0;
+  uint32_t m_recordedRegionCount = 0;
+  uint32_t m_commandCount = 0;
+  VkDeviceSize m_bytesAdded = 0;
+  VkDeviceSize m_bytesRecorded = 0;
+};
+} // namespace vdu
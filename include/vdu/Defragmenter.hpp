@@ -0,0 +1,76 @@
+#pragma once
+#include "DeviceMemory.hpp"
+#include "MemoryAllocator.hpp"
+#include "PCH.hpp"
+
+namespace vdu {
+
+class LogicalDevice;
+class CommandBuffer;
+class Fence;
+
+/*
+    Compacts sub-allocated buffers and textures out of sparsely used blocks of
+    the device's MemoryAllocator. Register the resources that may move, record
+    the copies into a command buffer, submit it with a fence and call finish()
+    once that fence has signalled. Moved resources get new handles (and image
+    views), descriptors referencing them must be updated afterwards.
+
+    Only resources created with both transfer source and destination usage
+    are moved, others pin the block they live in. Host visible buffers and
+    linear images stay in place so that pointers into their mapped memory
+    remain valid
+*/
+class Defragmenter {
+public:
+  void create(LogicalDevice *logicalDevice);
+
+  void addBuffer(Buffer *buffer);
+  void addTexture(Texture *texture); // Must currently be in getLayout()
+
+  void setMaxBytesToMove(VkDeviceSize maxBytes);
+
+  /*
+      Picks the blocks to empty and records the moves, returns the number of
+      resources moved. Nothing is recorded if it returns zero
+  */
+  uint32_t cmdDefragment(CommandBuffer *cmd);
+  uint32_t cmdDefragment(const VkCommandBuffer &cmd);
+
+  /*
+      Returns false until 'fence' has signalled, then swaps the new handles
+      and memory into the moved resources, frees their old ranges and releases
+      the emptied blocks
+  */
+  bool finish(const Fence *fence);
+
+  uint32_t getMoveCount() { return m_moveCount; }
+  VkDeviceSize getBytesMoved() { return m_bytesMoved; }
+  uint32_t getBlocksReleased() { return m_blocksReleased; }
+
+private:
+  struct Move {
+    Buffer *buffer;
+    Texture *texture;
+    DeviceMemory *newMemory;
+    VkBuffer newBuffer;
+    VkImage newImage;
+  };
+
+  bool planMove(Buffer *buffer, Texture *texture, const DeviceMemory *memory,
+                Move &move);
+  void recordMoves(const VkCommandBuffer &cmd);
+  void clearEvacuating();
+
+  LogicalDevice *m_logicalDevice = nullptr;
+
+  std::vector<Buffer *> m_buffers;
+  std::vector<Texture *> m_textures;
+  std::vector<Move> m_moves;
+
+  VkDeviceSize m_maxBytesToMove = ~VkDeviceSize(0);
+  VkDeviceSize m_bytesMoved = 0;
+  uint32_t m_moveCount = 0;
+  uint32_t m_blocksReleased = 0;
+};
+} // namespace vdu
@@ -1,41 +1,104 @@
 #pragma once
 #include "CommandBuffer.hpp"
+#include "Enums.hpp"
+#include "FormatTraits.hpp"
 #include "PCH.hpp"
 
 namespace vdu {
 
 class LogicalDevice;
 class QueueFamily;
+class MemoryAllocator;
+class UploadManager;
 
 class DeviceMemory {
 public:
   DeviceMemory()
       : m_logicalDevice(nullptr), m_deviceMemory(0), m_deviceSize(0),
-        m_memoryProperties(0) {}
+        m_offset(0), m_memoryProperties(0), m_memoryTypeIndex(~0u),
+        m_parentBlock(nullptr), m_mappedData(nullptr) {}
 
   void allocate(LogicalDevice *logicalDevice, VkDeviceSize size,
                 VkMemoryPropertyFlags memFlags, VkMemoryRequirements memReqs);
   void free();
 
+  /*
+      Memory is mapped on first use and stays mapped until it is freed, unmap()
+      is kept for compatibility and does nothing. A size of VK_WHOLE_SIZE maps
+      to the end of the memory, ranges reaching past it return null
+  */
   void *map() const;
   void *map(VkDeviceSize offset, VkDeviceSize size) const;
   void unmap() const;
 
+  /*
+      Required for memory without HOST_COHERENT, ranges are relative to this
+      allocation and are rounded out to nonCoherentAtomSize
+  */
+  void flush(VkDeviceSize offset = 0, VkDeviceSize size = VK_WHOLE_SIZE) const;
+  void invalidate(VkDeviceSize offset = 0,
+                  VkDeviceSize size = VK_WHOLE_SIZE) const;
+  VkMappedMemoryRange getMappedRange(VkDeviceSize offset,
+                                     VkDeviceSize size) const;
+
   const VkDeviceMemory &getHandle() { return m_deviceMemory; }
   VkDeviceSize getSize() { return m_deviceSize; }
+  VkDeviceSize getOffset() const { return m_offset; }
+  uint32_t getMemoryTypeIndex() const { return m_memoryTypeIndex; }
+  VkMemoryPropertyFlags getMemoryTypeFlags() const;
+  LogicalDevice *getLogicalDevice() const { return m_logicalDevice; }
+  bool isSubAllocation() const { return m_parentBlock != nullptr; }
+  bool isHostCoherent() const;
 
 private:
+  friend class MemoryAllocator;
+  friend class Defragmenter;
+
+  void *mapBlock() const;
+
   LogicalDevice *m_logicalDevice;
   VkDeviceMemory m_deviceMemory;
   VkDeviceSize m_deviceSize;
+  VkDeviceSize m_offset; // Offset into the parent block
   VkMemoryPropertyFlags m_memoryProperties;
+  uint32_t m_memoryTypeIndex;
+
+  DeviceMemory *m_parentBlock; // Set when sub-allocated by MemoryAllocator
+
+  // Blocks are mapped once and shared by all of their sub-allocations
+  mutable void *m_mappedData;
+};
+
+/*
+    Collects mapped ranges, possibly of many allocations, so that they are
+    flushed or invalidated with a single Vulkan call. Coherent memory is skipped
+*/
+class MappedRangeBatch {
+public:
+  void add(const DeviceMemory *memory, VkDeviceSize offset = 0,
+           VkDeviceSize size = VK_WHOLE_SIZE);
+  void clear() { m_ranges.clear(); }
+
+  void flush();
+  void invalidate();
+
+  uint32_t getRangeCount() { return m_ranges.size(); }
+
+private:
+  void mergeRanges();
+
+  LogicalDevice *m_logicalDevice = nullptr;
+  std::vector<VkMappedMemoryRange> m_ranges;
 };
 
 class Texture;
 
 class Buffer {
 public:
-  Buffer() {}
+  Buffer()
+      : m_logicalDevice(nullptr), m_deviceMemory(nullptr), m_buffer(0),
+        m_size(0), m_usageFlags(0), m_memoryProperties(0),
+        m_memoryUsage(MemoryUsage::Unknown) {}
   Buffer(Buffer &stagingDestination);
   Buffer(Buffer &stagingDestination, VkDeviceSize size);
   Buffer(LogicalDevice *logicalDevice, VkDeviceSize size);
@@ -46,9 +109,11 @@ public:
 
   void setUsage(VkBufferUsageFlags usage);
   void setMemoryProperty(VkMemoryPropertyFlags memProperty);
+  void setMemoryUsage(MemoryUsage usage); // Replaces the memory properties
 
   const DeviceMemory *getMemory() { return m_deviceMemory; }
   VkBuffer getHandle() { return m_buffer; }
+  VkDeviceSize getSize() { return m_size; }
 
   VkBufferUsageFlags getUsageFlags() { return m_usageFlags; }
 
@@ -56,9 +121,14 @@ public:
 
   void cmdCopyTo(CommandBuffer *cmd, Buffer *dst, VkDeviceSize range = 0,
                  VkDeviceSize srcOffset = 0, VkDeviceSize dstOffset = 0);
+  /*
+      'rowPitch' is the distance in bytes between rows of texels (rows of
+      blocks for compressed formats), zero for tightly packed rows
+  */
   void cmdCopyTo(CommandBuffer *cmd, Texture *dst, VkDeviceSize srcOffset = 0,
                  int mipLevel = 0, int baseLayer = 0, int layerCount = 1,
-                 VkOffset3D offset = {0, 0, 0}, VkExtent3D extent = {0, 0, 0});
+                 VkOffset3D offset = {0, 0, 0}, VkExtent3D extent = {0, 0, 0},
+                 VkDeviceSize rowPitch = 0);
 
   void cmdCopyTo(const VkCommandBuffer &cmd, Buffer *dst,
                  VkDeviceSize range = 0, VkDeviceSize srcOffset = 0,
@@ -66,7 +136,31 @@ public:
   void cmdCopyTo(const VkCommandBuffer &cmd, Texture *dst,
                  VkDeviceSize srcOffset = 0, int mipLevel = 0,
                  int baseLayer = 0, int layerCount = 1,
-                 VkOffset3D offset = {0, 0, 0}, VkExtent3D extent = {0, 0, 0});
+                 VkOffset3D offset = {0, 0, 0}, VkExtent3D extent = {0, 0, 0},
+                 VkDeviceSize rowPitch = 0);
+
+  /*
+      Keeps a zeroed CPU copy of the contents, allocated by create(). Writes
+      go to the copy and uploadDirty() sends only the 'granularity' sized
+      chunks (a power of two) that changed since the last upload, everything
+      is dirty after create()
+  */
+  void setShadowed(VkDeviceSize granularity = 64);
+
+  // Writes into the shadow copy, marks only the chunks whose bytes changed
+  void writeShadow(const void *data, VkDeviceSize size,
+                   VkDeviceSize offset = 0);
+
+  // For edits in place, mark what changed with markDirty()
+  void *getShadow() { return m_shadow.data(); }
+  void markDirty(VkDeviceSize offset, VkDeviceSize size);
+
+  /*
+      Queues copies of the dirty spans, spans close together are merged into
+      one. Returns the bytes queued, spans that did not fit stay dirty
+  */
+  VkDeviceSize uploadDirty(UploadManager *uploader);
+  VkDeviceSize getDirtyBytes();
 
   void createStaging(
       Buffer &staging); // Creates 'staging' as a buffer to map for 'this'
@@ -78,13 +172,23 @@ public:
       VkDeviceSize size); // 'this' is created as a mappable staging buffer
 
 private:
+  friend class Defragmenter;
+
+  VkBuffer createHandle();
+
   LogicalDevice *m_logicalDevice;
   DeviceMemory *m_deviceMemory;
   VkBuffer m_buffer;
+  VkDeviceSize m_size;
   VkBufferUsageFlags m_usageFlags;
   VkMemoryPropertyFlags m_memoryProperties;
+  MemoryUsage m_memoryUsage;
 
   std::vector<const QueueFamily *> m_usingQueueFamilies;
+
+  std::vector<uint8_t> m_shadow;
+  std::vector<uint64_t> m_dirtyChunks; // One bit per chunk
+  VkDeviceSize m_shadowGranularity = 0;
 };
 
 struct TextureCreateInfo {
@@ -94,7 +198,8 @@ struct TextureCreateInfo {
         aspectFlags(VK_IMAGE_ASPECT_COLOR_BIT),
         usageFlags(VK_IMAGE_USAGE_FLAG_BITS_MAX_ENUM),
         tiling(VK_IMAGE_TILING_OPTIMAL),
-        memoryProperties(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {}
+        memoryProperties(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+        memoryUsage(MemoryUsage::Unknown), hostTransfer(false) {}
 
   uint32_t width, height, depth, layers, numMipLevels;
   VkFormat format;
@@ -103,6 +208,43 @@ struct TextureCreateInfo {
   VkImageUsageFlags usageFlags;
   VkImageTiling tiling;
   VkMemoryPropertyFlags memoryProperties;
+  MemoryUsage memoryUsage; // Takes precedence over memoryProperties if set
+                           // Defaults to GpuLazy for transient attachments
+
+  // Adds VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT where the device and format
+  // support it, see Texture::copyFromMemory()
+  bool hostTransfer;
+};
+
+/*
+    Where the texels of a range of mips and layers sit in a staging buffer.
+    Each mip holds all of its layers 'imageHeight' rows apart, formats with
+    both depth and stencil keep the stencil texels of a mip in a separate
+    plane. A non-zero extent updates only that rectangle of the first mip,
+    halved (rounded outwards, to whole blocks for compressed formats) for
+    every further mip
+*/
+struct TextureUploadLayout {
+  struct Mip {
+    Mip() : offset(0), stencilOffset(0), rowLength(0), imageHeight(0) {}
+
+    VkDeviceSize offset;        // Colour or depth texels of the first layer
+    VkDeviceSize stencilOffset; // Combined depth/stencil formats only
+    uint32_t rowLength;   // Row pitch in texels, zero for tightly packed rows
+    uint32_t imageHeight; // Rows per layer/slice, zero for tightly packed
+  };
+
+  TextureUploadLayout()
+      : baseMipLevel(0), baseLayer(0), layerCount(1), offset({0, 0, 0}),
+        extent({0, 0, 0}), size(0) {}
+
+  uint32_t baseMipLevel;
+  uint32_t baseLayer;
+  uint32_t layerCount;
+  VkOffset3D offset;
+  VkExtent3D extent;
+  std::vector<Mip> mips; // From baseMipLevel onwards
+  VkDeviceSize size;     // Bytes spanned, filled in by getPackedLayout()
 };
 
 class Texture {
@@ -113,12 +255,18 @@ public:
         m_layout(VK_IMAGE_LAYOUT_UNDEFINED),
         m_aspectFlags(VK_IMAGE_ASPECT_FLAG_BITS_MAX_ENUM),
         m_usageFlags(VK_IMAGE_USAGE_FLAG_BITS_MAX_ENUM),
-        m_tiling(VK_IMAGE_TILING_MAX_ENUM) {}
+        m_tiling(VK_IMAGE_TILING_MAX_ENUM), m_hostTransfer(false),
+        m_hostCopyable(false), m_deviceMemory(nullptr) {}
 
   void setProperties(const TextureCreateInfo &ci);
   void create(LogicalDevice *logicalDevice);
   void destroy();
 
+  /*
+      Blits every mip from the previous one for all layers (or 3D slices) at
+      once, with one barrier per level. All mips must be in
+      TRANSFER_DST_OPTIMAL, they end up in the texture's layout
+  */
   void cmdGenerateMipMaps(const VkCommandBuffer &cmd);
   void cmdGenerateMipMaps(CommandBuffer *cmd);
   void bindMemory(DeviceMemory *memory);
@@ -137,16 +285,90 @@ public:
   uint32_t getMaxMipLevel() { return m_maxMipLevel; }
   uint32_t getNumMipLevels() { return m_numMipLevels; }
 
+  /*
+      Created with VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT, contents never
+      leave the render pass so the memory may be lazily allocated
+  */
+  bool isTransient();
+
+  const FormatInfo &getFormatInfo() { return vdu::getFormatInfo(m_format); }
+
+  // Zero for block compressed formats, use getFormatInfo() for block sizes
   uint32_t getBitsPerPixel();
   uint32_t getBytesPerPixel();
   uint32_t getNumComponents();
 
+  /*
+      Bytes per texel (or block) of one aspect as laid out in a buffer copy,
+      depth and stencil planes of combined formats are packed separately.
+      Zero when unknown
+  */
+  uint32_t getAspectTexelSize(VkImageAspectFlagBits aspect);
+
+  /*
+      Tightly packed layout of 'mipCount' mips (zero for the rest of the chain)
+      and 'layerCount' layers (zero for all), mips follow each other with
+      their stencil plane, if any, after the depth texels. Offsets are
+      aligned for vkCmdCopyBufferToImage. Compressed mips store their partial
+      edge blocks whole
+  */
+  TextureUploadLayout getPackedLayout(uint32_t baseMipLevel = 0,
+                                      uint32_t mipCount = 0,
+                                      uint32_t baseLayer = 0,
+                                      uint32_t layerCount = 0,
+                                      VkOffset3D offset = {0, 0, 0},
+                                      VkExtent3D extent = {0, 0, 0});
+
+  /*
+      Appends the copy regions of 'layout' to 'regions', one per mip and
+      aspect. 'bufferOffset' is added to every mip offset
+  */
+  void getUploadRegions(const TextureUploadLayout &layout,
+                        std::vector<VkBufferImageCopy> &regions,
+                        VkDeviceSize bufferOffset = 0);
+
+  // Every region in one copy, the texture must be in TRANSFER_DST_OPTIMAL
+  void cmdUpload(CommandBuffer *cmd, Buffer *src,
+                 const TextureUploadLayout &layout,
+                 VkDeviceSize srcOffset = 0);
+  void cmdUpload(const VkCommandBuffer &cmd, Buffer *src,
+                 const TextureUploadLayout &layout,
+                 VkDeviceSize srcOffset = 0);
+
   void cmdTransitionLayout(CommandBuffer &cmd, VkImageLayout oldLayout,
                            VkImageLayout newLayout,
                            VkPipelineStageFlags srcStageMask,
                            VkPipelineStageFlags dstStageMask);
 
+  // Created for host transfers, see TextureCreateInfo::hostTransfer
+  bool isHostCopyable() { return m_hostCopyable; }
+
+  /*
+      Copies the mips and layers of 'layout' from host memory laid out as
+      'layout' describes, through VK_EXT_host_image_copy: no staging and no
+      queue, so loader threads can fill textures themselves. The subresources
+      go from 'oldLayout' to 'newLayout' on the host first, the device must
+      not be accessing them. Returns false without copying anything if the
+      texture or the layouts do not allow a host copy, upload through staging
+      then
+  */
+  bool copyFromMemory(const void *data, const TextureUploadLayout &layout,
+                      VkImageLayout oldLayout, VkImageLayout newLayout);
+
+  // The reverse, the subresources must be in 'currentLayout' and idle
+  bool copyToMemory(void *data, const TextureUploadLayout &layout,
+                    VkImageLayout currentLayout);
+
 protected:
+  friend class Buffer;
+  friend class Defragmenter;
+
+  VkImage createImage();
+  VkImageView createView(VkImage image);
+
+  void getUploadRegion(const TextureUploadLayout &layout, uint32_t mip,
+                       VkOffset3D &offset, VkExtent3D &extent);
+
   LogicalDevice *m_logicalDevice;
 
   uint32_t m_width, m_height, m_depth;
@@ -158,8 +380,11 @@ protected:
   VkImageAspectFlags m_aspectFlags;
   VkImageUsageFlags m_usageFlags;
   VkImageTiling m_tiling;
+  bool m_hostTransfer; // Requested
+  bool m_hostCopyable; // Created with the host transfer usage
 
   VkMemoryPropertyFlags m_memoryProperties;
+  MemoryUsage m_memoryUsage;
 
   DeviceMemory *m_deviceMemory;
 
@@ -30,4 +30,12 @@ enum ShaderStage {
 };
 
 enum class ShaderLanguage { GLSL, SPV, UNKNOWN };
+
+enum class MemoryUsage {
+  Unknown,  // Use the explicit memory property flags
+  GpuOnly,  // Device local, never mapped
+  CpuToGpu, // Written by the host, read by the device (uploads, constants)
+  GpuToCpu, // Written by the device, read back by the host
+  GpuLazy   // Transient attachments, lazily allocated where supported
+};
 } // namespace vdu
@@ -0,0 +1,339 @@
+#pragma once
+#include "PCH.hpp"
+
+namespace vdu {
+
+/*
+    Static description of a VkFormat. Uncompressed formats are 1x1x1 blocks,
+    so sizes and pitches work the same for texel and block compressed data.
+    Combined depth/stencil formats report the size of one texel in memory,
+    copies move each aspect separately (see Texture::getPackedLayout)
+*/
+struct FormatInfo {
+  VkFormat format;
+  uint8_t blockWidth;
+  uint8_t blockHeight;
+  uint8_t blockDepth;
+  uint8_t bytesPerBlock;
+  uint8_t componentCount;
+  VkImageAspectFlags aspect;
+  bool srgb;
+  VkFormat srgbPair; // The sRGB format of a linear one and the other way round
+
+  constexpr bool isCompressed() const {
+    return blockWidth > 1 || blockHeight > 1 || blockDepth > 1;
+  }
+
+  constexpr uint32_t getBlockCount(uint32_t texels, uint8_t blockSize) const {
+    return (texels + blockSize - 1) / blockSize;
+  }
+
+  // Bytes between rows of blocks, 'width' in texels
+  constexpr VkDeviceSize getRowPitch(uint32_t width) const {
+    return VkDeviceSize(getBlockCount(width, blockWidth)) * bytesPerBlock;
+  }
+
+  // Bytes of a tightly packed region, partial blocks at the edges count whole
+  constexpr VkDeviceSize getSize(uint32_t width, uint32_t height,
+                                 uint32_t depth = 1) const {
+    return getRowPitch(width) * getBlockCount(height, blockHeight) *
+           getBlockCount(depth, blockDepth);
+  }
+};
+
+namespace formatTable {
+
+constexpr FormatInfo texel(VkFormat format, uint8_t bytes, uint8_t components) {
+  return {format, 1, 1, 1, bytes, components, VK_IMAGE_ASPECT_COLOR_BIT,
+          false, VK_FORMAT_UNDEFINED};
+}
+
+constexpr FormatInfo block(VkFormat format, uint8_t width, uint8_t height,
+                           uint8_t bytes, uint8_t components) {
+  return {format, width, height, 1, bytes, components,
+          VK_IMAGE_ASPECT_COLOR_BIT, false, VK_FORMAT_UNDEFINED};
+}
+
+constexpr FormatInfo depthStencil(VkFormat format, uint8_t bytes,
+                                  uint8_t components,
+                                  VkImageAspectFlags aspect) {
+  return {format, 1, 1, 1, bytes, components, aspect, false,
+          VK_FORMAT_UNDEFINED};
+}
+
+constexpr FormatInfo linear(FormatInfo info, VkFormat srgbFormat) {
+  return {info.format, info.blockWidth, info.blockHeight, info.blockDepth,
+          info.bytesPerBlock, info.componentCount, info.aspect, false,
+          srgbFormat};
+}
+
+constexpr FormatInfo srgb(FormatInfo info, VkFormat linearFormat) {
+  return {info.format, info.blockWidth, info.blockHeight, info.blockDepth,
+          info.bytesPerBlock, info.componentCount, info.aspect, true,
+          linearFormat};
+}
+
+// Core formats in enum order, VK_FORMAT_UNDEFINED through ASTC_12x12_SRGB
+constexpr FormatInfo entries[] = {
+    texel(VK_FORMAT_UNDEFINED, 0, 0),
+    texel(VK_FORMAT_R4G4_UNORM_PACK8, 1, 2),
+    texel(VK_FORMAT_R4G4B4A4_UNORM_PACK16, 2, 4),
+    texel(VK_FORMAT_B4G4R4A4_UNORM_PACK16, 2, 4),
+    texel(VK_FORMAT_R5G6B5_UNORM_PACK16, 2, 3),
+    texel(VK_FORMAT_B5G6R5_UNORM_PACK16, 2, 3),
+    texel(VK_FORMAT_R5G5B5A1_UNORM_PACK16, 2, 4),
+    texel(VK_FORMAT_B5G5R5A1_UNORM_PACK16, 2, 4),
+    texel(VK_FORMAT_A1R5G5B5_UNORM_PACK16, 2, 4),
+    linear(texel(VK_FORMAT_R8_UNORM, 1, 1), VK_FORMAT_R8_SRGB),
+    texel(VK_FORMAT_R8_SNORM, 1, 1),
+    texel(VK_FORMAT_R8_USCALED, 1, 1),
+    texel(VK_FORMAT_R8_SSCALED, 1, 1),
+    texel(VK_FORMAT_R8_UINT, 1, 1),
+    texel(VK_FORMAT_R8_SINT, 1, 1),
+    srgb(texel(VK_FORMAT_R8_SRGB, 1, 1), VK_FORMAT_R8_UNORM),
+    linear(texel(VK_FORMAT_R8G8_UNORM, 2, 2), VK_FORMAT_R8G8_SRGB),
+    texel(VK_FORMAT_R8G8_SNORM, 2, 2),
+    texel(VK_FORMAT_R8G8_USCALED, 2, 2),
+    texel(VK_FORMAT_R8G8_SSCALED, 2, 2),
+    texel(VK_FORMAT_R8G8_UINT, 2, 2),
+    texel(VK_FORMAT_R8G8_SINT, 2, 2),
+    srgb(texel(VK_FORMAT_R8G8_SRGB, 2, 2), VK_FORMAT_R8G8_UNORM),
+    linear(texel(VK_FORMAT_R8G8B8_UNORM, 3, 3), VK_FORMAT_R8G8B8_SRGB),
+    texel(VK_FORMAT_R8G8B8_SNORM, 3, 3),
+    texel(VK_FORMAT_R8G8B8_USCALED, 3, 3),
+    texel(VK_FORMAT_R8G8B8_SSCALED, 3, 3),
+    texel(VK_FORMAT_R8G8B8_UINT, 3, 3),
+    texel(VK_FORMAT_R8G8B8_SINT, 3, 3),
+    srgb(texel(VK_FORMAT_R8G8B8_SRGB, 3, 3), VK_FORMAT_R8G8B8_UNORM),
+    linear(texel(VK_FORMAT_B8G8R8_UNORM, 3, 3), VK_FORMAT_B8G8R8_SRGB),
+    texel(VK_FORMAT_B8G8R8_SNORM, 3, 3),
+    texel(VK_FORMAT_B8G8R8_USCALED, 3, 3),
+    texel(VK_FORMAT_B8G8R8_SSCALED, 3, 3),
+    texel(VK_FORMAT_B8G8R8_UINT, 3, 3),
+    texel(VK_FORMAT_B8G8R8_SINT, 3, 3),
+    srgb(texel(VK_FORMAT_B8G8R8_SRGB, 3, 3), VK_FORMAT_B8G8R8_UNORM),
+    linear(texel(VK_FORMAT_R8G8B8A8_UNORM, 4, 4), VK_FORMAT_R8G8B8A8_SRGB),
+    texel(VK_FORMAT_R8G8B8A8_SNORM, 4, 4),
+    texel(VK_FORMAT_R8G8B8A8_USCALED, 4, 4),
+    texel(VK_FORMAT_R8G8B8A8_SSCALED, 4, 4),
+    texel(VK_FORMAT_R8G8B8A8_UINT, 4, 4),
+    texel(VK_FORMAT_R8G8B8A8_SINT, 4, 4),
+    srgb(texel(VK_FORMAT_R8G8B8A8_SRGB, 4, 4), VK_FORMAT_R8G8B8A8_UNORM),
+    linear(texel(VK_FORMAT_B8G8R8A8_UNORM, 4, 4), VK_FORMAT_B8G8R8A8_SRGB),
+    texel(VK_FORMAT_B8G8R8A8_SNORM, 4, 4),
+    texel(VK_FORMAT_B8G8R8A8_USCALED, 4, 4),
+    texel(VK_FORMAT_B8G8R8A8_SSCALED, 4, 4),
+    texel(VK_FORMAT_B8G8R8A8_UINT, 4, 4),
+    texel(VK_FORMAT_B8G8R8A8_SINT, 4, 4),
+    srgb(texel(VK_FORMAT_B8G8R8A8_SRGB, 4, 4), VK_FORMAT_B8G8R8A8_UNORM),
+    linear(texel(VK_FORMAT_A8B8G8R8_UNORM_PACK32, 4, 4),
+           VK_FORMAT_A8B8G8R8_SRGB_PACK32),
+    texel(VK_FORMAT_A8B8G8R8_SNORM_PACK32, 4, 4),
+    texel(VK_FORMAT_A8B8G8R8_USCALED_PACK32, 4, 4),
+    texel(VK_FORMAT_A8B8G8R8_SSCALED_PACK32, 4, 4),
+    texel(VK_FORMAT_A8B8G8R8_UINT_PACK32, 4, 4),
+    texel(VK_FORMAT_A8B8G8R8_SINT_PACK32, 4, 4),
+    srgb(texel(VK_FORMAT_A8B8G8R8_SRGB_PACK32, 4, 4),
+         VK_FORMAT_A8B8G8R8_UNORM_PACK32),
+    texel(VK_FORMAT_A2R10G10B10_UNORM_PACK32, 4, 4),
+    texel(VK_FORMAT_A2R10G10B10_SNORM_PACK32, 4, 4),
+    texel(VK_FORMAT_A2R10G10B10_USCALED_PACK32, 4, 4),
+    texel(VK_FORMAT_A2R10G10B10_SSCALED_PACK32, 4, 4),
+    texel(VK_FORMAT_A2R10G10B10_UINT_PACK32, 4, 4),
+    texel(VK_FORMAT_A2R10G10B10_SINT_PACK32, 4, 4),
+    texel(VK_FORMAT_A2B10G10R10_UNORM_PACK32, 4, 4),
+    texel(VK_FORMAT_A2B10G10R10_SNORM_PACK32, 4, 4),
+    texel(VK_FORMAT_A2B10G10R10_USCALED_PACK32, 4, 4),
+    texel(VK_FORMAT_A2B10G10R10_SSCALED_PACK32, 4, 4),
+    texel(VK_FORMAT_A2B10G10R10_UINT_PACK32, 4, 4),
+    texel(VK_FORMAT_A2B10G10R10_SINT_PACK32, 4, 4),
+    texel(VK_FORMAT_R16_UNORM, 2, 1),
+    texel(VK_FORMAT_R16_SNORM, 2, 1),
+    texel(VK_FORMAT_R16_USCALED, 2, 1),
+    texel(VK_FORMAT_R16_SSCALED, 2, 1),
+    texel(VK_FORMAT_R16_UINT, 2, 1),
+    texel(VK_FORMAT_R16_SINT, 2, 1),
+    texel(VK_FORMAT_R16_SFLOAT, 2, 1),
+    texel(VK_FORMAT_R16G16_UNORM, 4, 2),
+    texel(VK_FORMAT_R16G16_SNORM, 4, 2),
+    texel(VK_FORMAT_R16G16_USCALED, 4, 2),
+    texel(VK_FORMAT_R16G16_SSCALED, 4, 2),
+    texel(VK_FORMAT_R16G16_UINT, 4, 2),
+    texel(VK_FORMAT_R16G16_SINT, 4, 2),
+    texel(VK_FORMAT_R16G16_SFLOAT, 4, 2),
+    texel(VK_FORMAT_R16G16B16_UNORM, 6, 3),
+    texel(VK_FORMAT_R16G16B16_SNORM, 6, 3),
+    texel(VK_FORMAT_R16G16B16_USCALED, 6, 3),
+    texel(VK_FORMAT_R16G16B16_SSCALED, 6, 3),
+    texel(VK_FORMAT_R16G16B16_UINT, 6, 3),
+    texel(VK_FORMAT_R16G16B16_SINT, 6, 3),
+    texel(VK_FORMAT_R16G16B16_SFLOAT, 6, 3),
+    texel(VK_FORMAT_R16G16B16A16_UNORM, 8, 4),
+    texel(VK_FORMAT_R16G16B16A16_SNORM, 8, 4),
+    texel(VK_FORMAT_R16G16B16A16_USCALED, 8, 4),
+    texel(VK_FORMAT_R16G16B16A16_SSCALED, 8, 4),
+    texel(VK_FORMAT_R16G16B16A16_UINT, 8, 4),
+    texel(VK_FORMAT_R16G16B16A16_SINT, 8, 4),
+    texel(VK_FORMAT_R16G16B16A16_SFLOAT, 8, 4),
+    texel(VK_FORMAT_R32_UINT, 4, 1),
+    texel(VK_FORMAT_R32_SINT, 4, 1),
+    texel(VK_FORMAT_R32_SFLOAT, 4, 1),
+    texel(VK_FORMAT_R32G32_UINT, 8, 2),
+    texel(VK_FORMAT_R32G32_SINT, 8, 2),
+    texel(VK_FORMAT_R32G32_SFLOAT, 8, 2),
+    texel(VK_FORMAT_R32G32B32_UINT, 12, 3),
+    texel(VK_FORMAT_R32G32B32_SINT, 12, 3),
+    texel(VK_FORMAT_R32G32B32_SFLOAT, 12, 3),
+    texel(VK_FORMAT_R32G32B32A32_UINT, 16, 4),
+    texel(VK_FORMAT_R32G32B32A32_SINT, 16, 4),
+    texel(VK_FORMAT_R32G32B32A32_SFLOAT, 16, 4),
+    texel(VK_FORMAT_R64_UINT, 8, 1),
+    texel(VK_FORMAT_R64_SINT, 8, 1),
+    texel(VK_FORMAT_R64_SFLOAT, 8, 1),
+    texel(VK_FORMAT_R64G64_UINT, 16, 2),
+    texel(VK_FORMAT_R64G64_SINT, 16, 2),
+    texel(VK_FORMAT_R64G64_SFLOAT, 16, 2),
+    texel(VK_FORMAT_R64G64B64_UINT, 24, 3),
+    texel(VK_FORMAT_R64G64B64_SINT, 24, 3),
+    texel(VK_FORMAT_R64G64B64_SFLOAT, 24, 3),
+    texel(VK_FORMAT_R64G64B64A64_UINT, 32, 4),
+    texel(VK_FORMAT_R64G64B64A64_SINT, 32, 4),
+    texel(VK_FORMAT_R64G64B64A64_SFLOAT, 32, 4),
+    texel(VK_FORMAT_B10G11R11_UFLOAT_PACK32, 4, 3),
+    texel(VK_FORMAT_E5B9G9R9_UFLOAT_PACK32, 4, 3),
+    depthStencil(VK_FORMAT_D16_UNORM, 2, 1, VK_IMAGE_ASPECT_DEPTH_BIT),
+    depthStencil(VK_FORMAT_X8_D24_UNORM_PACK32, 4, 1,
+                 VK_IMAGE_ASPECT_DEPTH_BIT),
+    depthStencil(VK_FORMAT_D32_SFLOAT, 4, 1, VK_IMAGE_ASPECT_DEPTH_BIT),
+    depthStencil(VK_FORMAT_S8_UINT, 1, 1, VK_IMAGE_ASPECT_STENCIL_BIT),
+    depthStencil(VK_FORMAT_D16_UNORM_S8_UINT, 3, 2,
+                 VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT),
+    depthStencil(VK_FORMAT_D24_UNORM_S8_UINT, 4, 2,
+                 VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT),
+    depthStencil(VK_FORMAT_D32_SFLOAT_S8_UINT, 5, 2,
+                 VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT),
+    linear(block(VK_FORMAT_BC1_RGB_UNORM_BLOCK, 4, 4, 8, 3),
+           VK_FORMAT_BC1_RGB_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_BC1_RGB_SRGB_BLOCK, 4, 4, 8, 3),
+         VK_FORMAT_BC1_RGB_UNORM_BLOCK),
+    linear(block(VK_FORMAT_BC1_RGBA_UNORM_BLOCK, 4, 4, 8, 4),
+           VK_FORMAT_BC1_RGBA_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_BC1_RGBA_SRGB_BLOCK, 4, 4, 8, 4),
+         VK_FORMAT_BC1_RGBA_UNORM_BLOCK),
+    linear(block(VK_FORMAT_BC2_UNORM_BLOCK, 4, 4, 16, 4),
+           VK_FORMAT_BC2_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_BC2_SRGB_BLOCK, 4, 4, 16, 4),
+         VK_FORMAT_BC2_UNORM_BLOCK),
+    linear(block(VK_FORMAT_BC3_UNORM_BLOCK, 4, 4, 16, 4),
+           VK_FORMAT_BC3_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_BC3_SRGB_BLOCK, 4, 4, 16, 4),
+         VK_FORMAT_BC3_UNORM_BLOCK),
+    block(VK_FORMAT_BC4_UNORM_BLOCK, 4, 4, 8, 1),
+    block(VK_FORMAT_BC4_SNORM_BLOCK, 4, 4, 8, 1),
+    block(VK_FORMAT_BC5_UNORM_BLOCK, 4, 4, 16, 2),
+    block(VK_FORMAT_BC5_SNORM_BLOCK, 4, 4, 16, 2),
+    block(VK_FORMAT_BC6H_UFLOAT_BLOCK, 4, 4, 16, 3),
+    block(VK_FORMAT_BC6H_SFLOAT_BLOCK, 4, 4, 16, 3),
+    linear(block(VK_FORMAT_BC7_UNORM_BLOCK, 4, 4, 16, 4),
+           VK_FORMAT_BC7_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_BC7_SRGB_BLOCK, 4, 4, 16, 4),
+         VK_FORMAT_BC7_UNORM_BLOCK),
+    linear(block(VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK, 4, 4, 8, 3),
+           VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK, 4, 4, 8, 3),
+         VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK),
+    linear(block(VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK, 4, 4, 8, 4),
+           VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_ETC2_R8G8B8A1_SRGB_BLOCK, 4, 4, 8, 4),
+         VK_FORMAT_ETC2_R8G8B8A1_UNORM_BLOCK),
+    linear(block(VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK, 4, 4, 16, 4),
+           VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK, 4, 4, 16, 4),
+         VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK),
+    block(VK_FORMAT_EAC_R11_UNORM_BLOCK, 4, 4, 8, 1),
+    block(VK_FORMAT_EAC_R11_SNORM_BLOCK, 4, 4, 8, 1),
+    block(VK_FORMAT_EAC_R11G11_UNORM_BLOCK, 4, 4, 16, 2),
+    block(VK_FORMAT_EAC_R11G11_SNORM_BLOCK, 4, 4, 16, 2),
+    linear(block(VK_FORMAT_ASTC_4x4_UNORM_BLOCK, 4, 4, 16, 4),
+           VK_FORMAT_ASTC_4x4_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_ASTC_4x4_SRGB_BLOCK, 4, 4, 16, 4),
+         VK_FORMAT_ASTC_4x4_UNORM_BLOCK),
+    linear(block(VK_FORMAT_ASTC_5x4_UNORM_BLOCK, 5, 4, 16, 4),
+           VK_FORMAT_ASTC_5x4_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_ASTC_5x4_SRGB_BLOCK, 5, 4, 16, 4),
+         VK_FORMAT_ASTC_5x4_UNORM_BLOCK),
+    linear(block(VK_FORMAT_ASTC_5x5_UNORM_BLOCK, 5, 5, 16, 4),
+           VK_FORMAT_ASTC_5x5_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_ASTC_5x5_SRGB_BLOCK, 5, 5, 16, 4),
+         VK_FORMAT_ASTC_5x5_UNORM_BLOCK),
+    linear(block(VK_FORMAT_ASTC_6x5_UNORM_BLOCK, 6, 5, 16, 4),
+           VK_FORMAT_ASTC_6x5_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_ASTC_6x5_SRGB_BLOCK, 6, 5, 16, 4),
+         VK_FORMAT_ASTC_6x5_UNORM_BLOCK),
+    linear(block(VK_FORMAT_ASTC_6x6_UNORM_BLOCK, 6, 6, 16, 4),
+           VK_FORMAT_ASTC_6x6_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_ASTC_6x6_SRGB_BLOCK, 6, 6, 16, 4),
+         VK_FORMAT_ASTC_6x6_UNORM_BLOCK),
+    linear(block(VK_FORMAT_ASTC_8x5_UNORM_BLOCK, 8, 5, 16, 4),
+           VK_FORMAT_ASTC_8x5_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_ASTC_8x5_SRGB_BLOCK, 8, 5, 16, 4),
+         VK_FORMAT_ASTC_8x5_UNORM_BLOCK),
+    linear(block(VK_FORMAT_ASTC_8x6_UNORM_BLOCK, 8, 6, 16, 4),
+           VK_FORMAT_ASTC_8x6_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_ASTC_8x6_SRGB_BLOCK, 8, 6, 16, 4),
+         VK_FORMAT_ASTC_8x6_UNORM_BLOCK),
+    linear(block(VK_FORMAT_ASTC_8x8_UNORM_BLOCK, 8, 8, 16, 4),
+           VK_FORMAT_ASTC_8x8_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_ASTC_8x8_SRGB_BLOCK, 8, 8, 16, 4),
+         VK_FORMAT_ASTC_8x8_UNORM_BLOCK),
+    linear(block(VK_FORMAT_ASTC_10x5_UNORM_BLOCK, 10, 5, 16, 4),
+           VK_FORMAT_ASTC_10x5_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_ASTC_10x5_SRGB_BLOCK, 10, 5, 16, 4),
+         VK_FORMAT_ASTC_10x5_UNORM_BLOCK),
+    linear(block(VK_FORMAT_ASTC_10x6_UNORM_BLOCK, 10, 6, 16, 4),
+           VK_FORMAT_ASTC_10x6_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_ASTC_10x6_SRGB_BLOCK, 10, 6, 16, 4),
+         VK_FORMAT_ASTC_10x6_UNORM_BLOCK),
+    linear(block(VK_FORMAT_ASTC_10x8_UNORM_BLOCK, 10, 8, 16, 4),
+           VK_FORMAT_ASTC_10x8_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_ASTC_10x8_SRGB_BLOCK, 10, 8, 16, 4),
+         VK_FORMAT_ASTC_10x8_UNORM_BLOCK),
+    linear(block(VK_FORMAT_ASTC_10x10_UNORM_BLOCK, 10, 10, 16, 4),
+           VK_FORMAT_ASTC_10x10_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_ASTC_10x10_SRGB_BLOCK, 10, 10, 16, 4),
+         VK_FORMAT_ASTC_10x10_UNORM_BLOCK),
+    linear(block(VK_FORMAT_ASTC_12x10_UNORM_BLOCK, 12, 10, 16, 4),
+           VK_FORMAT_ASTC_12x10_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_ASTC_12x10_SRGB_BLOCK, 12, 10, 16, 4),
+         VK_FORMAT_ASTC_12x10_UNORM_BLOCK),
+    linear(block(VK_FORMAT_ASTC_12x12_UNORM_BLOCK, 12, 12, 16, 4),
+           VK_FORMAT_ASTC_12x12_SRGB_BLOCK),
+    srgb(block(VK_FORMAT_ASTC_12x12_SRGB_BLOCK, 12, 12, 16, 4),
+         VK_FORMAT_ASTC_12x12_UNORM_BLOCK),
+
+};
+
+constexpr uint32_t entryCount = sizeof(entries) / sizeof(entries[0]);
+
+constexpr bool isInEnumOrder() {
+  for (uint32_t i = 0; i < entryCount; ++i)
+    if (entries[i].format != VkFormat(i))
+      return false;
+  return true;
+}
+
+static_assert(isInEnumOrder(), "format table must be indexed by VkFormat");
+static_assert(entryCount == VK_FORMAT_ASTC_12x12_SRGB_BLOCK + 1,
+              "format table must cover every core format");
+} // namespace formatTable
+
+/*
+    Formats outside the table (extension formats) return the entry of
+    VK_FORMAT_UNDEFINED, which has a block size of zero bytes
+*/
+constexpr const FormatInfo &getFormatInfo(VkFormat format) {
+  return uint32_t(format) < formatTable::entryCount
+             ? formatTable::entries[format]
+             : formatTable::entries[0];
+}
+} // namespace vdu
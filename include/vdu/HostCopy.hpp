@@ -0,0 +1,26 @@
+#pragma once
+#include "PCH.hpp"
+
+namespace vdu {
+
+/*
+    Copies into mapped device memory. Host visible memory without
+    VK_MEMORY_PROPERTY_HOST_CACHED_BIT is usually write-combined, stores to it
+    only reach full bus bandwidth when they fill whole lines. Non-temporal
+    stores do so without reading the destination into the cache or evicting
+    the source, which also keeps copies from several threads from contending
+    for the cache
+*/
+
+/*
+    memcpy through non-temporal stores, neither pointer needs any alignment.
+    Ends with a store fence, the data is visible to the device once the
+    function returns (as with memcpy, non-coherent memory needs a flush)
+*/
+void streamCopy(void *dst, const void *src, size_t size);
+
+// streamCopy() if 'memoryFlags' lack HOST_CACHED, memcpy otherwise
+void copyToMapped(void *dst, const void *src, size_t size,
+                  VkMemoryPropertyFlags memoryFlags);
+
+} // namespace vdu
@@ -0,0 +1,95 @@
+#pragma once
+#include "DeviceMemory.hpp"
+#include "PCH.hpp"
+
+namespace vdu {
+
+class LogicalDevice;
+class UploadManager;
+
+/*
+    Reads KTX2 textures straight from a memory mapped file. open() validates
+    the header and level index against the file size and the format's block
+    size, the levels are then copied (or decoded) from the mapping directly
+    into staging or host visible memory, there is no intermediate copy.
+
+    Cube faces become six array layers. Supercompressed levels need a decoder
+    for their scheme, it writes the uncompressed level to the destination.
+    BasisLZ and formats without a VkFormat are not supported
+*/
+class KtxFile {
+public:
+  enum class Supercompression : uint32_t {
+    None = 0,
+    BasisLZ = 1,
+    Zstandard = 2,
+    Zlib = 3
+  };
+
+  // Returns false if 'src' did not decode to exactly 'dstSize' bytes
+  using Decoder = std::function<bool(const void *src, size_t srcSize,
+                                     void *dst, size_t dstSize)>;
+
+  void setDecoder(Supercompression scheme, Decoder decoder);
+
+  bool open(LogicalDevice *logicalDevice, const std::string &path);
+  void close();
+
+  bool isOpen() { return m_data != nullptr; }
+
+  // Size, format, mips and layers of the file, sampled in SHADER_READ_ONLY
+  TextureCreateInfo getTextureCreateInfo();
+  void createTexture(Texture &texture);
+
+  /*
+      Queues every level of the file into 'dst', which must match
+      getTextureCreateInfo(). A level must fit in the uploader's staging arena
+  */
+  bool upload(UploadManager *uploader, Texture *dst,
+              VkImageLayout oldLayout = VK_IMAGE_LAYOUT_UNDEFINED);
+
+  /*
+      Copies or decodes one level, all layers and faces tightly packed, to
+      'dst' which must hold getLevelSize(level) bytes
+  */
+  bool copyLevel(uint32_t level, void *dst);
+
+  VkFormat getFormat() { return m_format; }
+  uint32_t getWidth() { return m_width; }
+  uint32_t getHeight() { return m_height; }
+  uint32_t getDepth() { return m_depth; }
+  uint32_t getLayers() { return m_layers; }
+  uint32_t getLevelCount() { return m_levels.size(); }
+  Supercompression getSupercompression() { return m_supercompression; }
+
+  VkDeviceSize getLevelSize(uint32_t level) {
+    return m_levels[level].uncompressedSize;
+  }
+
+private:
+  struct Level {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    VkDeviceSize uncompressedSize;
+  };
+
+  bool validate();
+  void reportError(const std::string &message);
+
+  LogicalDevice *m_logicalDevice = nullptr;
+  std::string m_path;
+
+  const uint8_t *m_data = nullptr;
+  size_t m_size = 0;
+
+  VkFormat m_format = VK_FORMAT_UNDEFINED;
+  uint32_t m_width = 0;
+  uint32_t m_height = 0;
+  uint32_t m_depth = 0;
+  uint32_t m_layers = 0;
+  Supercompression m_supercompression = Supercompression::None;
+  std::vector<Level> m_levels;
+
+  std::map<Supercompression, Decoder> m_decoders;
+};
+} // namespace vdu
@@ -1,4 +1,5 @@
 #pragma once
+#include "MemoryAllocator.hpp"
 #include "PCH.hpp"
 
 namespace vdu {
@@ -16,9 +17,38 @@ public:
 
   VkDevice getHandle() { return m_device; }
   const PhysicalDevice *getPhysicalDevice() const { return m_physicalDevice; }
+  MemoryAllocator *getMemoryAllocator() { return &m_memoryAllocator; }
+
+  /*
+      Per heap usage snapshot, driver reported when VK_EXT_memory_budget is
+      enabled (requires a Vulkan 1.1 instance)
+  */
+  std::vector<MemoryHeapBudget> getMemoryBudget() {
+    return m_memoryAllocator.getMemoryBudget();
+  }
+
+  /*
+      VK_EXT_host_image_copy entry points and the layouts host copies may
+      use, loaded when the extension was added before create() and the
+      device supports its hostImageCopy feature (create() enables it). Empty
+      when the instance or device is Vulkan 1.0 or when the Vulkan headers
+      predate the extension
+  */
+  struct HostImageCopy {
+#ifdef VK_EXT_host_image_copy
+    PFN_vkCopyMemoryToImageEXT copyMemoryToImage = nullptr;
+    PFN_vkCopyImageToMemoryEXT copyImageToMemory = nullptr;
+    PFN_vkTransitionImageLayoutEXT transitionImageLayout = nullptr;
+#endif
+    std::vector<VkImageLayout> srcLayouts;
+    std::vector<VkImageLayout> dstLayouts;
+  };
+  const HostImageCopy &getHostImageCopy() const { return m_hostImageCopy; }
+  bool isHostImageCopyEnabled() const;
 
   void addQueue(Queue *queue);
   void addExtension(const char *extensionName);
+  bool isExtensionEnabled(const char *extensionName) const;
   void addLayer(const char *layerName);
   void setEnabledDeviceFeatures(const VkPhysicalDeviceFeatures &pdf);
 
@@ -37,6 +67,8 @@ public:
   void _internalReportVduDebug(VduDebugLevel level, const std::string &message);
 
 private:
+  void loadHostImageCopy();
+
   VkDevice m_device = 0;
 
   std::set<Queue *> m_queues;
@@ -55,5 +87,9 @@ private:
   std::vector<const char *> m_enabledLayers;
 
   PhysicalDevice *m_physicalDevice = nullptr;
+
+  HostImageCopy m_hostImageCopy;
+
+  MemoryAllocator m_memoryAllocator;
 };
 } // namespace vdu
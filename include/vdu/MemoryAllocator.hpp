@@ -0,0 +1,174 @@
+#pragma once
+#include "Enums.hpp"
+#include "PCH.hpp"
+
+namespace vdu {
+
+class LogicalDevice;
+class DeviceMemory;
+
+/*
+    Snapshot of one memory heap. With VK_EXT_memory_budget enabled the budget
+    and usage are reported by the driver (usage includes other processes),
+    otherwise usage is what this device allocated and the budget is 80% of the
+    heap size
+*/
+struct MemoryHeapBudget {
+  VkDeviceSize heapSize = 0;
+  VkMemoryHeapFlags heapFlags = 0;
+  VkDeviceSize budget = 0;
+  VkDeviceSize usage = 0;
+  VkDeviceSize allocatedBytes = 0; // VkDeviceMemory allocated through vdu
+  uint32_t allocationCount = 0;    // Live vkAllocateMemory allocations
+};
+
+/*
+    Sub-allocates device memory for buffers and textures out of large blocks,
+    one set of blocks per memory type. Owned by LogicalDevice
+*/
+class MemoryAllocator {
+public:
+  enum ResourceType { Linear, Optimal };
+
+  /*
+      Filled in by get*MemoryRequirements(), lets allocate() give the resource
+      its own VkDeviceMemory through VkMemoryDedicatedAllocateInfo
+  */
+  struct DedicatedInfo {
+    bool prefersDedicated = false;
+    bool requiresDedicated = false;
+    VkBuffer buffer = 0;
+    VkImage image = 0;
+  };
+
+  void create(LogicalDevice *logicalDevice);
+  void destroy();
+
+  void setBlockSize(VkDeviceSize blockSize);
+  VkDeviceSize getBlockSize() { return m_blockSize; }
+
+  /*
+      Resources the driver prefers to have a dedicated allocation get one once
+      they are at least this large, required dedicated allocations always do
+  */
+  void setDedicatedThreshold(VkDeviceSize threshold);
+  VkDeviceSize getDedicatedThreshold() { return m_dedicatedThreshold; }
+
+  /*
+      Query memory requirements along with VkMemoryDedicatedRequirements, which
+      needs Vulkan 1.1. On older devices the dedicated info is left empty
+  */
+  void getBufferMemoryRequirements(VkBuffer buffer,
+                                   VkMemoryRequirements &memReqs,
+                                   DedicatedInfo &dedicated);
+  void getImageMemoryRequirements(VkImage image, VkMemoryRequirements &memReqs,
+                                  DedicatedInfo &dedicated);
+
+  /*
+      Returns a DeviceMemory describing the reserved range, bind resources at
+      DeviceMemory::getOffset(). Requests larger than half a block or wanting a
+      dedicated allocation get their own VkDeviceMemory. GpuOnly requests that
+      would exceed the heap budget fall back to a host visible heap when the
+      resource allows it. Explicit property flags are always honoured, those
+      requests never fall back and may allocate past the budget
+  */
+  DeviceMemory *allocate(const VkMemoryRequirements &memReqs,
+                         VkMemoryPropertyFlags memFlags, ResourceType type,
+                         const DedicatedInfo *dedicated = nullptr);
+  DeviceMemory *allocate(const VkMemoryRequirements &memReqs,
+                         MemoryUsage usage, ResourceType type,
+                         const DedicatedInfo *dedicated = nullptr);
+  void free(DeviceMemory *memory);
+
+  uint32_t getBlockCount();
+  uint32_t getAllocationCount() { return m_allocationCount; }
+
+  std::vector<MemoryHeapBudget> getMemoryBudget();
+  MemoryHeapBudget getHeapBudget(uint32_t heapIndex);
+  bool isMemoryBudgetSupported() { return m_memoryBudgetSupported; }
+
+  void _internalFreeRange(DeviceMemory *memory);
+  void _internalTrackAllocation(uint32_t memoryTypeIndex, VkDeviceSize size);
+  void _internalTrackFree(uint32_t memoryTypeIndex, VkDeviceSize size);
+
+private:
+  friend class Defragmenter;
+
+  struct Range {
+    VkDeviceSize size;
+    ResourceType type;
+  };
+
+  struct Block {
+    DeviceMemory *memory;
+    std::map<VkDeviceSize, VkDeviceSize> freeRanges; // offset -> size
+    std::map<VkDeviceSize, Range> usedRanges;        // offset -> range
+    bool evacuating = false; // Skipped by new allocations while defragmenting
+  };
+
+  /*
+      Non-coherent allocations get whole atoms so that flushing or
+      invalidating one never touches a neighbour
+  */
+  VkMemoryRequirements padRequirements(const VkMemoryRequirements &memReqs,
+                                       uint32_t memoryTypeIndex);
+
+  /*
+      With 'withinBudget' set, new VkDeviceMemory is never allocated past the
+      heap budget and failures return null without reporting an error
+  */
+  DeviceMemory *allocateFromType(const VkMemoryRequirements &memReqs,
+                                 uint32_t memoryTypeIndex,
+                                 VkMemoryPropertyFlags memFlags,
+                                 ResourceType type,
+                                 const DedicatedInfo *dedicated,
+                                 bool withinBudget = false);
+  VkResult allocateDeviceMemory(uint32_t memoryTypeIndex, VkDeviceSize size,
+                                bool withinBudget,
+                                VkDeviceMemory &deviceMemory,
+                                const DedicatedInfo *dedicated = nullptr);
+
+  /*
+      Reserves a range in an existing block of the type, creating a new block
+      only if 'canCreateBlock' is set
+  */
+  DeviceMemory *subAllocate(const VkMemoryRequirements &memReqs,
+                            uint32_t memoryTypeIndex,
+                            VkMemoryPropertyFlags memFlags, ResourceType type,
+                            bool canCreateBlock, bool withinBudget);
+
+  Block *createBlock(uint32_t memoryTypeIndex, VkDeviceSize minSize,
+                     VkMemoryPropertyFlags memFlags, bool withinBudget);
+  void destroyBlock(Block *block);
+
+  bool findFreeRange(Block *block, const VkMemoryRequirements &memReqs,
+                     ResourceType type, VkDeviceSize &offset,
+                     VkDeviceSize &bestFitSize);
+  void reserveRange(Block *block, VkDeviceSize offset, VkDeviceSize size,
+                    ResourceType type);
+
+  VkDeviceSize getPreferredBlockSize(uint32_t memoryTypeIndex);
+
+  // Returns false without querying when VK_EXT_memory_budget is not usable
+  bool
+  queryDriverBudget(VkPhysicalDeviceMemoryBudgetPropertiesEXT &budgetProps);
+  MemoryHeapBudget
+  makeHeapBudget(uint32_t heapIndex,
+                 const VkPhysicalDeviceMemoryBudgetPropertiesEXT *budgetProps);
+
+  LogicalDevice *m_logicalDevice = nullptr;
+
+  VkDeviceSize m_blockSize = 64 * 1024 * 1024;
+  VkDeviceSize m_bufferImageGranularity = 1;
+  VkDeviceSize m_nonCoherentAtomSize = 1;
+  VkDeviceSize m_dedicatedThreshold = 4 * 1024 * 1024;
+  bool m_memoryBudgetSupported = false;
+  bool m_dedicatedSupported = false;
+
+  VkDeviceSize m_heapAllocatedBytes[VK_MAX_MEMORY_HEAPS] = {};
+  uint32_t m_heapAllocationCount[VK_MAX_MEMORY_HEAPS] = {};
+
+  std::map<uint32_t, std::list<Block *>> m_blocks; // memory type -> blocks
+  uint32_t m_allocationCount = 0;
+};
+} // namespace vdu
@@ -0,0 +1,67 @@
+#pragma once
+#include "DeviceMemory.hpp"
+#include "Descriptors.hpp"
+#include "MemoryPools.hpp"
+#include "Pipeline.hpp"
+#include "Shaders.hpp"
+#include "PCH.hpp"
+
+namespace vdu {
+
+class LogicalDevice;
+class CommandBuffer;
+
+/*
+    Generates the mip chain of a texture in a single compute dispatch, as an
+    alternative to Texture::cmdGenerateMipMaps(). Every workgroup reduces a
+    64x64 tile of the base mip into six mips through shared memory, the last
+    workgroup of each layer to finish (counted with a global atomic) reduces
+    the rest of the chain. Up to 12 mips are generated.
+
+    The texture needs VK_IMAGE_USAGE_STORAGE_BIT and a format with a GLSL image
+    format qualifier that the device supports for storage images. sRGB textures
+    are written through UNORM views and filtered in linear space
+*/
+class MipDownsampler {
+public:
+  enum class Reduction {
+    Average,
+    Min, // Min and Max build depth pyramids (Hi-Z) from R32_SFLOAT copies
+    Max
+  };
+
+  void setReduction(Reduction reduction);
+
+  void create(LogicalDevice *logicalDevice, Texture *texture);
+  void destroy();
+
+  /*
+      'currentLayout' is the layout of the whole texture, all mips end up in
+      the texture's layout (GENERAL if it has none)
+  */
+  void cmdDownsample(CommandBuffer *cmd, VkImageLayout currentLayout);
+  void cmdDownsample(const VkCommandBuffer &cmd, VkImageLayout currentLayout);
+
+  uint32_t getMipCount() { return m_mipCount; }
+
+private:
+  std::string getShaderSource(const char *imageFormat, bool srgb);
+
+  LogicalDevice *m_logicalDevice = nullptr;
+  Texture *m_texture = nullptr;
+  Reduction m_reduction = Reduction::Average;
+  uint32_t m_mipCount = 0;
+  uint32_t m_groupCountX = 0;
+  uint32_t m_groupCountY = 0;
+
+  std::vector<VkImageView> m_mipViews;
+  Buffer m_counters;
+
+  ShaderProgram m_shader;
+  DescriptorPool m_descriptorPool;
+  DescriptorSetLayout m_descriptorSetLayout;
+  DescriptorSet m_descriptorSet;
+  PipelineLayout m_pipelineLayout;
+  ComputePipeline m_pipeline;
+};
+} // namespace vdu
@@ -54,10 +54,13 @@
   }
 
 /// Utilities includes
+#include <algorithm>
 #include <limits>
 #include <functional>
 #include <utility>
+#include <tuple>
 #include <initializer_list>
+#include <cstring>
 #include <assert.h>
 
 /// Containers includes
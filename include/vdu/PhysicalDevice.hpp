@@ -1,4 +1,5 @@
 #pragma once
+#include "Enums.hpp"
 #include "PCH.hpp"
 #include "QueueFamily.hpp"
 
@@ -9,7 +10,13 @@ namespace vdu {
 */
 class PhysicalDevice {
 public:
-  PhysicalDevice(VkPhysicalDevice device) : m_physicalDevice(device) {
+  /*
+      'instanceApiVersion' is the version the owning instance was created
+      with, it caps the version reported by getApiVersion()
+  */
+  PhysicalDevice(VkPhysicalDevice device,
+                 uint32_t instanceApiVersion = VK_API_VERSION_1_0)
+      : m_physicalDevice(device), m_instanceApiVersion(instanceApiVersion) {
     queryDetails();
   }
 
@@ -28,6 +35,14 @@ public:
   */
   uint32_t findMemoryTypeIndex(uint32_t typeFilter,
                                VkMemoryPropertyFlags properties) const;
+
+  /*
+      Scores every allowed memory type against the required, preferred and
+      avoided property flags of the usage, returns the best or ~0u
+  */
+  uint32_t
+  findMemoryTypeIndex(uint32_t typeFilter, MemoryUsage usage,
+                      VkMemoryPropertyFlags requiredProperties = 0) const;
   VkFormat findSupportedFormat(const std::vector<VkFormat> &candidates,
                                VkImageTiling tiling,
                                VkFormatFeatureFlags features) const;
@@ -39,6 +54,13 @@ public:
 
   VkPhysicalDeviceProperties getDeviceProperties() const;
 
+  /*
+      Version usable through this device, the lower of the device's and the
+      instance's. Core 1.1 entry points need this to be at least 1.1
+  */
+  uint32_t getApiVersion() const;
+  const VkPhysicalDeviceMemoryProperties &getMemoryProperties() const;
+
 private:
   /*
       Query and fill in properties and features
@@ -53,6 +75,7 @@ private:
   std::vector<QueueFamily> m_queueFamilies;
 
   VkPhysicalDevice m_physicalDevice;
+  uint32_t m_instanceApiVersion;
   VkPhysicalDeviceProperties m_deviceProperties;
   VkPhysicalDeviceFeatures m_deviceFeatures;
 
@@ -0,0 +1,71 @@
+#pragma once
+#include "PCH.hpp"
+
+namespace vdu {
+
+class PhysicalDevice;
+
+/*
+    Converts pixels between host formats on the CPU, typically straight into
+    mapped staging memory. Supported conversions:
+
+    - 8 bit RGB, BGR, RGBA and BGRA with the same numeric type into each
+      other (expand, strip and swizzle), expanded alpha is one
+    - 32 bit floats into 16 bit floats with the same component count
+    - R32G32B32A32_SFLOAT into R8G8B8A8_SRGB or B8G8R8A8_SRGB, colour is sRGB
+      encoded (within one step of the exact value), alpha stays linear
+
+    Uses AVX2 or SSE4.1 when the CPU supports them, scalar code otherwise
+*/
+class PixelConverter {
+public:
+  /*
+      Converts 'srcFormat' into the first format 'physicalDevice' supports
+      'features' with 'tiling' for: 'srcFormat' itself, then the formats it
+      converts into losslessly (RGB8 into RGBA8 or BGRA8, RGBA8 into BGRA8,
+      float32 into float16). Returns false if none is supported
+  */
+  bool create(const PhysicalDevice *physicalDevice, VkFormat srcFormat,
+              VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL,
+              VkFormatFeatureFlags features =
+                  VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+                  VK_FORMAT_FEATURE_TRANSFER_DST_BIT);
+
+  // Returns false if there is no conversion between the two
+  bool create(VkFormat srcFormat, VkFormat dstFormat);
+
+  // 'dst' holds getDestinationSize(pixelCount) bytes, neither needs alignment
+  void convert(const void *src, void *dst, size_t pixelCount);
+
+  VkDeviceSize getSourceSize(size_t pixelCount);
+  VkDeviceSize getDestinationSize(size_t pixelCount);
+
+  VkFormat getSourceFormat() { return m_srcFormat; }
+  VkFormat getDestinationFormat() { return m_dstFormat; }
+
+  // Whether convert() is a plain copy
+  bool isCopy() { return m_kind == Kind::Copy; }
+
+  // "AVX2", "SSE4.1" or "Scalar"
+  static const char *getInstructionSet();
+
+private:
+  enum class Kind { None, Copy, Bytes, Half, Srgb };
+
+  struct ByteShuffle {
+    uint32_t srcBytes = 0;
+    uint32_t dstBytes = 0;
+    uint8_t map[4] = {}; // Source byte of each destination byte, 0xFF fills
+    uint8_t fill = 0;
+  };
+
+  static std::vector<VkFormat> getCandidates(VkFormat srcFormat);
+
+  Kind m_kind = Kind::None;
+  VkFormat m_srcFormat = VK_FORMAT_UNDEFINED;
+  VkFormat m_dstFormat = VK_FORMAT_UNDEFINED;
+  ByteShuffle m_shuffle;
+  uint32_t m_componentCount = 0;
+  bool m_swapRedBlue = false;
+};
+} // namespace vdu
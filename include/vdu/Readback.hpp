@@ -0,0 +1,117 @@
+#pragma once
+#include "CommandBuffer.hpp"
+#include "DeviceMemory.hpp"
+#include "MemoryPools.hpp"
+#include "Synchro.hpp"
+#include "PCH.hpp"
+
+namespace vdu {
+
+class LogicalDevice;
+class Queue;
+
+/*
+    Copies buffer ranges and texture regions back to the host without
+    stalling the queue or the caller. Every request records its copy into a
+    pooled host cached buffer and is submitted with its own fence, a handle
+    is returned straight away and polled with isReady(). Any number of
+    requests can be in flight, buffers and command buffers are recycled once
+    released.
+
+    Sources are not transitioned or synchronised beyond the optional wait
+    semaphore, textures must already be in 'layout' when the copy executes
+*/
+class Readback {
+public:
+  using Handle = uint64_t; // Zero is never a valid handle
+
+  void create(LogicalDevice *logicalDevice, Queue *queue);
+
+  // Waits for every request in flight, all handles become invalid
+  void destroy();
+
+  // 'src' needs VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+  Handle requestBuffer(Buffer *src, VkDeviceSize size,
+                       VkDeviceSize srcOffset = 0,
+                       const Semaphore *wait = nullptr,
+                       VkPipelineStageFlags waitStage =
+                           VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+  /*
+      Reads one mip of 'layerCount' layers (zero for all), the whole mip
+      unless 'extent' is given. Texels arrive packed as by
+      Texture::getPackedLayout(), getRowPitch() gives the bytes per row
+  */
+  Handle requestTexture(Texture *src, VkImageLayout layout,
+                        uint32_t mipLevel = 0, uint32_t baseLayer = 0,
+                        uint32_t layerCount = 0, VkOffset3D offset = {0, 0, 0},
+                        VkExtent3D extent = {0, 0, 0},
+                        const Semaphore *wait = nullptr,
+                        VkPipelineStageFlags waitStage =
+                            VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+  // Polls the request's fence, never blocks
+  bool isReady(Handle handle);
+  void wait(Handle handle);
+
+  /*
+      Host visible copy of the source, null until the request is ready.
+      Non-coherent memory is invalidated on the first call
+  */
+  const void *getData(Handle handle);
+  VkDeviceSize getSize(Handle handle);
+
+  // Bytes between rows (of blocks) of a texture request, zero for buffers
+  VkDeviceSize getRowPitch(Handle handle);
+  uint32_t getRowCount(Handle handle);
+
+  /*
+      Copies a ready texture request row by row into 'dst', rows
+      'dstRowPitch' bytes apart (zero for tightly packed). Layers and slices
+      follow each other. Returns false if the request is not ready
+  */
+  bool copyRows(Handle handle, void *dst, VkDeviceSize dstRowPitch = 0);
+
+  // Returns the request's buffer to the pool, waiting for it if in flight
+  void release(Handle handle);
+
+  uint32_t getInFlightCount();
+  uint32_t getPooledBufferCount() { return m_buffers.size(); }
+  VkDeviceSize getPooledBytes() { return m_pooledBytes; }
+
+private:
+  struct Slot {
+    CommandBuffer commandBuffer;
+    Fence fence;
+  };
+
+  struct Request {
+    Slot *slot = nullptr;
+    Buffer *buffer = nullptr;
+    VkDeviceSize size = 0;
+    VkDeviceSize rowPitch = 0;
+    uint32_t rowCount = 0; // Rows of every layer and slice together
+    bool ready = false;
+    bool invalidated = false;
+  };
+
+  Request *find(Handle handle);
+  Slot *acquireSlot();
+  Buffer *acquireBuffer(VkDeviceSize size);
+  Handle submit(Request &request, const Semaphore *wait,
+                VkPipelineStageFlags waitStage);
+
+  LogicalDevice *m_logicalDevice = nullptr;
+  Queue *m_queue = nullptr;
+
+  CommandPool m_commandPool;
+  std::list<Slot> m_slots;
+  std::vector<Slot *> m_freeSlots;
+  std::list<Buffer> m_buffers;
+  std::multimap<VkDeviceSize, Buffer *> m_freeBuffers; // By size
+  VkDeviceSize m_pooledBytes = 0;
+
+  std::map<Handle, Request> m_requests;
+  Handle m_nextHandle = 1;
+};
+} // namespace vdu
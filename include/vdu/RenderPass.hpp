@@ -34,6 +34,10 @@ public:
 
   const VkRenderPass &getHandle() const { return m_renderPass; }
 
+  /*
+      Attachments for transient textures default to not loading or storing
+      their contents, transient depth attachments are still cleared
+  */
   AttachmentInfo *addColourAttachment(vdu::Texture *texture, std::string name);
   AttachmentInfo *addColourAttachment(VkFormat format, std::string name);
   AttachmentInfo *setDepthAttachment(vdu::Texture *texture);
@@ -10,6 +10,9 @@ public:
   ShaderModule();
   void create(ShaderStage stage, const std::string &path,
               LogicalDevice **logicalDevice);
+  // GLSL held in memory, 'name' is only used in messages
+  void createFromSource(ShaderStage stage, const std::string &glslSource,
+                        const std::string &name, LogicalDevice **logicalDevice);
 
   void setMacroDefinition(const std::string &define,
                           const std::string &value = "");
@@ -30,6 +33,7 @@ private:
   ShaderLanguage m_language;
 
   std::string m_path;
+  bool m_fromSource;
   std::string m_glslSource;
   std::vector<uint32_t> m_spirvSource;
 
@@ -55,6 +59,8 @@ public:
   void destroy();
 
   void addModule(ShaderStage stage, const std::string &path);
+  void addModuleFromSource(ShaderStage stage, const std::string &glslSource,
+                           const std::string &name);
 
   void reload();
   void compile();
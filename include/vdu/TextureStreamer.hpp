@@ -0,0 +1,106 @@
+#pragma once
+#include "DeviceMemory.hpp"
+#include "PCH.hpp"
+
+namespace vdu {
+
+class LogicalDevice;
+class UploadManager;
+class KtxFile;
+class Fence;
+
+/*
+    Streams the mips of textures created with their full mip chain. The mips
+    up to the initial size are queued when a texture is added, finer mips
+    follow one level at a time over later updates, the textures covering the
+    most screen space first. Mips finer than a texture needs are dropped when
+    the resident budget would be exceeded.
+
+    Shaders clamp their LOD with the per-texture min LOD in getMinLodBuffer()
+    (a float per texture index) or getMinLod() in a push constant or sampler,
+    a mip only becomes sampleable once its upload has completed. A negative
+    min LOD means no mip is resident yet, shaders must fall back to something
+    else (a default texture or colour) until it turns non-negative. The
+    texture's allocation always covers the whole chain, the budget bounds the
+    texel data streamed in and kept valid
+*/
+class TextureStreamer {
+public:
+  // Writes mip level 'mipLevel', all layers tightly packed, to 'dst'
+  using Loader =
+      std::function<bool(uint32_t mipLevel, void *dst, VkDeviceSize size)>;
+
+  void create(LogicalDevice *logicalDevice, UploadManager *uploader,
+              uint32_t maxTextures = 1024);
+  void destroy();
+
+  void setResidentBudget(VkDeviceSize bytes) { m_residentBudget = bytes; }
+  void setUploadBudget(VkDeviceSize bytesPerUpdate) {
+    m_uploadBudget = bytesPerUpdate;
+  }
+  void setInitialSize(uint32_t texels) { m_initialSize = texels; }
+
+  /*
+      Queues the mips no larger than the initial size and the transition of
+      the finer ones to the texture's layout, 'oldLayout' is the layout the
+      texture is in. Returns the texture's index, ~0u when full or if the
+      initial mips could not be queued. The texture must outlive the uploads
+      queued for it
+  */
+  uint32_t addTexture(Texture *texture, Loader loader,
+                      VkImageLayout oldLayout = VK_IMAGE_LAYOUT_UNDEFINED);
+  uint32_t addTexture(Texture *texture, KtxFile *file,
+                      VkImageLayout oldLayout = VK_IMAGE_LAYOUT_UNDEFINED);
+  void removeTexture(uint32_t index);
+
+  // Pixels covered on screen along the texture's larger side, zero if hidden
+  void setScreenSize(uint32_t index, float pixels);
+
+  /*
+      Publishes the mips whose uploads completed, then queues the next mips
+      in priority order within the upload and resident budgets and flushes
+      the upload manager. Call once per frame, after UploadManager::cmdAcquire
+      if it uploads on a transfer queue
+  */
+  void update();
+
+  // Negative until the texture's initial mips have landed
+  float getMinLod(uint32_t index);
+  // The mip count until the initial mips have landed
+  uint32_t getResidentMip(uint32_t index);
+  Buffer *getMinLodBuffer() { return &m_minLods; }
+  VkDeviceSize getResidentBytes() { return m_residentBytes; }
+
+private:
+  struct StreamedTexture {
+    Texture *texture = nullptr;
+    Loader loader;
+    float screenSize = 0.f;
+    uint32_t initialMip = 0;  // Coarsest mip that is never dropped
+    uint32_t residentMip = 0; // Finest mip the shader may sample
+    uint32_t pendingMip = 0;  // Finest mip queued, below residentMip if busy
+    const Fence *fence = nullptr;
+  };
+
+  uint32_t getWantedMip(const StreamedTexture &streamed);
+  VkDeviceSize getMipSize(Texture *texture, uint32_t mipLevel);
+  bool queueMip(StreamedTexture &streamed, uint32_t mipLevel,
+                VkImageLayout oldLayout);
+  bool evict(VkDeviceSize bytes);
+  void writeMinLod(uint32_t index);
+
+  LogicalDevice *m_logicalDevice = nullptr;
+  UploadManager *m_uploader = nullptr;
+
+  VkDeviceSize m_residentBudget = std::numeric_limits<VkDeviceSize>::max();
+  VkDeviceSize m_uploadBudget = 16 * 1024 * 1024;
+  VkDeviceSize m_residentBytes = 0;
+  uint32_t m_initialSize = 64;
+
+  std::vector<StreamedTexture> m_textures;
+  std::vector<uint32_t> m_queued; // Waiting for the fence of the next flush
+
+  Buffer m_minLods;
+  float *m_minLodData = nullptr;
+};
+} // namespace vdu
@@ -0,0 +1,87 @@
+#pragma once
+#include "DeviceMemory.hpp"
+#include "PCH.hpp"
+
+namespace vdu {
+
+class LogicalDevice;
+class Fence;
+
+/*
+    Persistently mapped ring buffer for short lived per-draw/per-dispatch data.
+    Slices are bump-allocated during a frame and the whole frame region is
+    retired once the fence passed to endFrame() has signalled
+*/
+class TransientRing {
+public:
+  struct Slice {
+    void *data = nullptr;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+
+    // Pass as the dynamic offset when binding a *_BUFFER_DYNAMIC descriptor
+    uint32_t getDynamicOffset() const { return uint32_t(offset); }
+  };
+
+  void setUsage(VkBufferUsageFlags usage);
+
+  void create(LogicalDevice *logicalDevice, VkDeviceSize size);
+  void destroy();
+
+  /*
+      Call after waiting on the frame's fence and before resetting it, retires
+      the regions of all frames whose fences have signalled
+  */
+  void beginFrame();
+  void endFrame(const Fence *fence);
+
+  /*
+      Returns a slice with null data if the ring is full, 'alignment' is on top
+      of the ring's own (need not be a power of two). tryAllocate() does not
+      report a full ring
+  */
+  Slice allocate(VkDeviceSize size, VkDeviceSize alignment = 1);
+  Slice tryAllocate(VkDeviceSize size, VkDeviceSize alignment = 1);
+  Slice push(const void *data, VkDeviceSize size);
+
+  /*
+      Fills 'slice' from 'data', with non-temporal stores unless the ring's
+      memory is host cached
+  */
+  void write(const Slice &slice, const void *data);
+
+  /*
+      Descriptor info for a *_BUFFER_DYNAMIC binding covering 'range' bytes,
+      the slice offset is supplied per draw through getDynamicOffset()
+  */
+  VkDescriptorBufferInfo getDescriptorInfo(VkDeviceSize range);
+
+  Buffer *getBuffer() { return &m_buffer; }
+  VkBuffer getHandle() { return m_buffer.getHandle(); }
+  VkDeviceSize getSize() { return m_size; }
+  VkDeviceSize getAlignment() { return m_alignment; }
+  VkDeviceSize getUsedSize() { return m_usedSize; }
+
+private:
+  void retireFrames();
+
+  struct FrameRegion {
+    const Fence *fence;
+    VkDeviceSize size;
+  };
+
+  LogicalDevice *m_logicalDevice = nullptr;
+
+  Buffer m_buffer;
+  VkBufferUsageFlags m_usageFlags = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+  char *m_mappedData = nullptr;
+
+  VkDeviceSize m_size = 0;
+  VkDeviceSize m_alignment = 1;
+  VkDeviceSize m_head = 0;
+  VkDeviceSize m_usedSize = 0;  // Including padding and wrap-around waste
+  VkDeviceSize m_frameSize = 0; // Bytes consumed since the last endFrame()
+
+  std::queue<FrameRegion> m_inFlightFrames;
+};
+} // namespace vdu
@@ -0,0 +1,91 @@
+#pragma once
+#include "DeviceMemory.hpp"
+#include "PCH.hpp"
+
+namespace vdu {
+
+class LogicalDevice;
+class UploadManager;
+
+/*
+    Shares device local buffers and textures between uploads of identical
+    content. Payloads are hashed together with their size and the resource's
+    creation parameters, an upload matching a resident resource returns it
+    with one more reference instead of creating, staging and copying another.
+
+    Resources are matched on a 64 bit hash, the payload itself is not kept to
+    compare against. Cached resources are owned by the cache, do not destroy
+    them directly
+*/
+class UploadCache {
+public:
+  void create(LogicalDevice *logicalDevice, UploadManager *uploader);
+
+  // Destroys every cached resource, the GPU must be done with them
+  void destroy();
+
+  /*
+      Device local buffer holding 'data', TRANSFER_DST is added to 'usage'.
+      Returns null if it could not be created or uploaded
+  */
+  Buffer *acquireBuffer(const void *data, VkDeviceSize size,
+                        VkBufferUsageFlags usage);
+
+  /*
+      Texture created from 'info' holding 'data', every mip and layer packed
+      as by Texture::getPackedLayout(). TRANSFER_DST is added to the usage
+  */
+  Texture *acquireTexture(const TextureCreateInfo &info, const void *data,
+                          VkDeviceSize size);
+
+  /*
+      Drops a reference, the last one destroys the resource. The GPU must be
+      done with it
+  */
+  void release(Buffer *buffer);
+  void release(Texture *texture);
+
+  // Vectorised 64 bit hash in the spirit of XXH3 (not compatible with it)
+  static uint64_t hash(const void *data, size_t size, uint64_t seed = 0);
+
+  uint64_t getHitCount() { return m_hitCount; }
+  uint64_t getMissCount() { return m_missCount; }
+  VkDeviceSize getBytesSaved() { return m_bytesSaved; }
+  VkDeviceSize getResidentBytes() { return m_residentBytes; }
+  uint32_t getResourceCount() { return m_entries.size(); }
+
+private:
+  struct Key {
+    uint64_t contentHash;
+    uint64_t parameterHash;
+    VkDeviceSize size;
+    bool texture;
+
+    bool operator<(const Key &other) const {
+      return std::tie(contentHash, parameterHash, size, texture) <
+             std::tie(other.contentHash, other.parameterHash, other.size,
+                      other.texture);
+    }
+  };
+
+  struct Entry {
+    Buffer buffer;
+    Texture texture;
+    uint32_t references = 0;
+  };
+
+  Entry *find(const Key &key);
+  void release(const void *resource);
+
+  LogicalDevice *m_logicalDevice = nullptr;
+  UploadManager *m_uploader = nullptr;
+
+  std::map<Key, Entry> m_entries;
+  std::map<const void *, Key> m_keys; // Cached resource to its entry's key
+
+  uint64_t m_hitCount = 0;
+  uint64_t m_missCount = 0;
+  VkDeviceSize m_bytesSaved = 0;
+  VkDeviceSize m_residentBytes = 0;
+};
+} // namespace vdu
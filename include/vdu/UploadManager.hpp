@@ -0,0 +1,215 @@
+#pragma once
+#include "CommandBuffer.hpp"
+#include "CopyBatch.hpp"
+#include "DeviceMemory.hpp"
+#include "Synchro.hpp"
+#include "TransientRing.hpp"
+#include "PCH.hpp"
+
+namespace vdu {
+
+class LogicalDevice;
+class PixelConverter;
+class Queue;
+class QueueSubmission;
+
+/*
+    Batches buffer and texture uploads through a pooled staging arena. Copies
+    are queued as they are requested and flush() records all of them into one
+    command buffer, the staging space is reclaimed once that submission's
+    fence signals.
+
+    For asynchronous uploads create it on a transfer-only queue and set the
+    queue that uses the resources. Flushes then signal a semaphore and release
+    ownership of the written ranges, cmdAcquire() acquires them on the other
+    queue so that resources can stay VK_SHARING_MODE_EXCLUSIVE.
+
+    Released resources stay with the destination queue until cmdRelease(),
+    recorded after that queue's last use of them in a frame, hands those with
+    queued uploads back. The next flush() waits for it and acquires them
+    before copying, until then flush() submits nothing
+*/
+class UploadManager {
+public:
+  void create(LogicalDevice *logicalDevice, Queue *queue,
+              VkDeviceSize stagingSize = 64 * 1024 * 1024);
+  void destroy();
+
+  void setDestinationQueue(Queue *queue);
+
+  /*
+      Records the acquire barriers of every flush since the last call into
+      'cmd' (on the destination queue) and adds the waits on their semaphores
+      to 'submission'. Uploads are visible to commands recorded after it
+  */
+  void cmdAcquire(CommandBuffer *cmd, QueueSubmission &submission);
+  void cmdAcquire(const VkCommandBuffer &cmd, QueueSubmission &submission);
+
+  /*
+      Records the release of destination owned resources that queued uploads
+      write into 'cmd' (on the destination queue, after its last use of them)
+      and adds the signal of the semaphore the next flush() waits on to
+      'submission'. They must not be used on that queue again until the
+      cmdAcquire() following that flush(). Does nothing while an earlier
+      release has not been flushed
+  */
+  void cmdRelease(CommandBuffer *cmd, QueueSubmission &submission);
+  void cmdRelease(const VkCommandBuffer &cmd, QueueSubmission &submission);
+
+  /*
+      Stops tracking a resource released to the destination queue, call
+      before destroying it so a new resource at its address starts unowned
+  */
+  void forget(Buffer *buffer);
+  void forget(Texture *texture);
+
+  /*
+      Copies 'data' into the staging arena and queues the copy. Returns false
+      if it does not fit even in an empty arena
+  */
+  bool uploadBuffer(Buffer *dst, const void *data, VkDeviceSize size,
+                    VkDeviceSize dstOffset = 0);
+
+  /*
+      Tightly packed texels of one mip level of 'layerCount' layers. The
+      touched subresources go from 'oldLayout' to the texture's layout, or stay
+      in TRANSFER_DST_OPTIMAL if it has none. Regions must respect the upload
+      queue family's minImageTransferGranularity.
+
+      Host copyable textures (see TextureCreateInfo::hostTransfer) are written
+      straight away with VK_EXT_host_image_copy instead of being staged, the
+      device must not be using them. Staging is used whenever that is not
+      possible, including while a copy to the texture is queued
+  */
+  bool uploadTexture(Texture *dst, const void *data, VkDeviceSize size,
+                     uint32_t mipLevel = 0, uint32_t baseLayer = 0,
+                     uint32_t layerCount = 1,
+                     VkImageLayout oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                     VkOffset3D offset = {0, 0, 0},
+                     VkExtent3D extent = {0, 0, 0});
+
+  /*
+      Pixels in the converter's source format, converted straight into the
+      staging arena. 'dst' has the converter's destination format
+  */
+  bool uploadTexture(Texture *dst, const void *pixels,
+                     PixelConverter *converter, uint32_t mipLevel = 0,
+                     uint32_t baseLayer = 0, uint32_t layerCount = 1,
+                     VkImageLayout oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                     VkOffset3D offset = {0, 0, 0},
+                     VkExtent3D extent = {0, 0, 0});
+
+  // Mips and layers laid out as in 'layout', 'data' spans layout.size bytes
+  bool uploadTexture(Texture *dst, const void *data,
+                     const TextureUploadLayout &layout,
+                     VkImageLayout oldLayout = VK_IMAGE_LAYOUT_UNDEFINED);
+
+  /*
+      Slice of the arena to fill directly, hand it to a queueCopy() before the
+      next flush(). Flushes and waits for earlier uploads if the arena is full,
+      unless a slice allocated earlier is not queued yet, then it fails (null
+      data) rather than recycle that slice's memory
+  */
+  TransientRing::Slice allocateStaging(VkDeviceSize size,
+                                       VkDeviceSize alignment = 4);
+
+  // Staging offset alignment of image copies into 'texture'
+  VkDeviceSize getStagingAlignment(Texture *texture);
+
+  bool queueCopy(const TransientRing::Slice &staging, Buffer *dst,
+                 VkDeviceSize dstOffset = 0);
+  bool queueCopy(const TransientRing::Slice &staging, Texture *dst,
+                 uint32_t mipLevel = 0, uint32_t baseLayer = 0,
+                 uint32_t layerCount = 1,
+                 VkImageLayout oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                 VkOffset3D offset = {0, 0, 0}, VkExtent3D extent = {0, 0, 0});
+  bool queueCopy(const TransientRing::Slice &staging, Texture *dst,
+                 const TextureUploadLayout &layout,
+                 VkImageLayout oldLayout = VK_IMAGE_LAYOUT_UNDEFINED);
+
+  /*
+      Moves 'mipCount' mips of 'layerCount' layers that are not written from
+      'oldLayout' to the texture's layout along with the queued copies, so
+      that views covering them stay valid before they are uploaded
+  */
+  void queueTransition(Texture *dst, uint32_t baseMipLevel, uint32_t mipCount,
+                       uint32_t baseLayer, uint32_t layerCount,
+                       VkImageLayout oldLayout = VK_IMAGE_LAYOUT_UNDEFINED);
+
+  /*
+      Records every queued copy into one command buffer and submits it, call
+      once per frame. Returns the submission's fence, null if nothing was
+      queued, a queued upload writes a resource not yet handed back by
+      cmdRelease(), or too many flushes are still waiting for cmdAcquire()
+  */
+  const Fence *flush();
+  void waitIdle();
+
+  // Signals once every copy flushed so far has completed, null before any
+  const Fence *getLastFence() { return m_lastFence; }
+
+  uint32_t getPendingCount() { return m_pendingCopies.size(); }
+  CopyBatch *getLastCopyBatch() { return &m_copyBatch; }
+  VkDeviceSize getStagingUsed() { return m_staging.getUsedSize(); }
+
+private:
+  struct PendingCopy {
+    Buffer *buffer;
+    Texture *texture;
+    VkBufferCopy bufferCopy;
+    VkBufferImageCopy imageCopy;
+    VkImageLayout oldLayout;
+    bool transitionOnly; // No copy, only the layout transitions
+  };
+
+  struct Submission {
+    CommandBuffer commandBuffer;
+    Fence fence;
+    bool inFlight = false;
+
+    // Signalled for the destination queue, the submission is not reused
+    // until its acquire has been recorded
+    Semaphore semaphore;
+    bool awaitingAcquire = false;
+    std::vector<VkBufferMemoryBarrier> acquireBufferBarriers;
+    std::vector<VkImageMemoryBarrier> acquireImageBarriers;
+  };
+
+  bool queueImageCopy(Texture *dst, const VkBufferImageCopy &region,
+                      VkImageLayout oldLayout);
+  bool isDestinationOwned(const PendingCopy &copy);
+  bool hostCopy(Texture *dst, const void *data,
+                const TextureUploadLayout &layout, VkImageLayout oldLayout);
+
+  Submission *acquireSubmission();
+  void recordCopies(const VkCommandBuffer &cmd, Submission *submission);
+  bool transfersOwnership();
+  void sliceQueued();
+
+  LogicalDevice *m_logicalDevice = nullptr;
+  Queue *m_queue = nullptr;
+  Queue *m_destinationQueue = nullptr;
+  VkExtent3D m_transferGranularity = {1, 1, 1};
+
+  TransientRing m_staging;
+  CommandPool m_commandPool;
+  CopyBatch m_copyBatch;
+
+  std::vector<PendingCopy> m_pendingCopies;
+  uint32_t m_unqueuedSlices = 0; // From allocateStaging(), not yet queued
+  std::vector<Submission *> m_submissions;
+  std::vector<Submission *> m_unacquired;
+
+  // Released to the destination family, textures by (mip, layer)
+  std::set<Buffer *> m_destinationBuffers;
+  std::map<Texture *, std::set<std::pair<uint32_t, uint32_t>>>
+      m_destinationTextures;
+
+  // Handed back by cmdRelease(), acquired by the next flush()
+  Semaphore m_returnSemaphore;
+  bool m_returnPending = false;
+  std::vector<VkBufferMemoryBarrier> m_returnBufferBarriers;
+  std::vector<VkImageMemoryBarrier> m_returnImageBarriers;
+  const Fence *m_lastFence = nullptr;
+};
+} // namespace vdu
@@ -1,19 +1,34 @@
 #pragma once
+#include "BlockCompressor.hpp"
+#include "ChunkedTransfer.hpp"
 #include "CommandBuffer.hpp"
+#include "CopyBatch.hpp"
+#include "Defragmenter.hpp"
 #include "Descriptors.hpp"
 #include "DeviceMemory.hpp"
 #include "Enums.hpp"
+#include "FormatTraits.hpp"
 #include "Framebuffer.hpp"
+#include "HostCopy.hpp"
 #include "Initializers.hpp"
 #include "Instance.hpp"
+#include "KtxFile.hpp"
 #include "LogicalDevice.hpp"
+#include "MemoryAllocator.hpp"
 #include "MemoryPools.hpp"
+#include "MipDownsampler.hpp"
 #include "PCH.hpp"
 #include "PhysicalDevice.hpp"
 #include "Pipeline.hpp"
+#include "PixelConverter.hpp"
 #include "Queue.hpp"
 #include "QueueFamily.hpp"
+#include "Readback.hpp"
 #include "RenderPass.hpp"
 #include "Shaders.hpp"
 #include "Swapchain.hpp"
 #include "Synchro.hpp"
+#include "TextureStreamer.hpp"
+#include "TransientRing.hpp"
+#include "UploadCache.hpp"
+#include "UploadManager.hpp"
@@ -0,0 +1,533 @@
+#include "BlockCompressor.hpp"
+#include "CommandBuffer.hpp"
+#include "LogicalDevice.hpp"
+#include "PhysicalDevice.hpp"
+
+static const char *compressSource = R"glsl(
+#extension GL_EXT_samplerless_texture_functions : require
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(binding = 0) uniform texture2D source;
+
+layout(std430, binding = 1) writeonly buffer Blocks {
+#ifdef BC1
+  uvec2 blocks[];
+#else
+  uvec4 blocks[];
+#endif
+};
+
+layout(push_constant) uniform Params {
+  uvec2 blockCount;
+  uint blockOffset;
+  int mipLevel;
+}
+params;
+
+#ifdef BC7
+const float steps = 15.0;
+#else
+const float steps = 3.0;
+#endif
+
+vec4 texels[16];
+
+void loadBlock(uvec2 block) {
+  ivec2 size = textureSize(source, params.mipLevel);
+  for (int i = 0; i < 16; ++i) {
+    ivec2 p = min(ivec2(block * 4u) + ivec2(i & 3, i >> 2), size - 1);
+    vec4 t = texelFetch(source, p, params.mipLevel);
+#ifdef SRGB
+    t.rgb = mix(t.rgb * 12.92, 1.055 * pow(t.rgb, vec3(1.0 / 2.4)) - 0.055,
+                greaterThan(t.rgb, vec3(0.0031308)));
+#endif
+    texels[i] = t;
+  }
+}
+
+// Least squares endpoints for the texels' current weights along e0..e1
+void refineEndpoints(vec4 mask, inout vec4 e0, inout vec4 e1) {
+  vec4 dir = e1 - e0;
+  float lengthSq = dot(dir, dir);
+  if (lengthSq < 1e-8)
+    return;
+
+  float aa = 0.0, ab = 0.0, bb = 0.0;
+  vec4 ax = vec4(0.0), bx = vec4(0.0);
+  for (int i = 0; i < 16; ++i) {
+    float t = clamp(dot(texels[i] * mask - e0, dir) / lengthSq, 0.0, 1.0);
+    t = round(t * steps) / steps;
+    aa += (1.0 - t) * (1.0 - t);
+    ab += (1.0 - t) * t;
+    bb += t * t;
+    ax += (1.0 - t) * texels[i] * mask;
+    bx += t * texels[i] * mask;
+  }
+  float det = aa * bb - ab * ab;
+  if (abs(det) < 1e-6)
+    return;
+  e0 = clamp((bb * ax - ab * bx) / det, 0.0, 1.0);
+  e1 = clamp((aa * bx - ab * ax) / det, 0.0, 1.0);
+}
+
+void fitEndpoints(vec4 mask, out vec4 e0, out vec4 e1) {
+  vec4 lo = vec4(1.0), hi = vec4(0.0), mean = vec4(0.0);
+  for (int i = 0; i < 16; ++i) {
+    lo = min(lo, texels[i] * mask);
+    hi = max(hi, texels[i] * mask);
+    mean += texels[i] * mask;
+  }
+  mean /= 16.0;
+
+#if QUALITY == 0
+  // Inset the box a little, the extremes are rarely hit exactly, and take
+  // the diagonal along which the channels vary together
+  vec4 inset = (hi - lo) / 32.0;
+  vec4 trend = vec4(0.0);
+  for (int i = 0; i < 16; ++i) {
+    vec4 d = texels[i] * mask - mean;
+    trend += d * (d.r + d.g + d.b + d.a);
+  }
+  bvec4 falling = lessThan(trend, vec4(0.0));
+  e0 = mix(lo + inset, hi - inset, falling);
+  e1 = mix(hi - inset, lo + inset, falling);
+#else
+  mat4 covariance = mat4(0.0);
+  for (int i = 0; i < 16; ++i) {
+    vec4 d = texels[i] * mask - mean;
+    covariance += outerProduct(d, d);
+  }
+  vec4 axis = hi - lo;
+  for (int k = 0; k < 8; ++k)
+    axis = covariance * axis / max(length(axis), 1e-8);
+  if (dot(axis, axis) < 1e-12) {
+    e0 = mean;
+    e1 = mean;
+    return;
+  }
+  axis = normalize(axis);
+
+  float tMin = 1e9, tMax = -1e9;
+  for (int i = 0; i < 16; ++i) {
+    float t = dot(texels[i] * mask - mean, axis);
+    tMin = min(tMin, t);
+    tMax = max(tMax, t);
+  }
+  e0 = clamp(mean + axis * tMin, 0.0, 1.0);
+  e1 = clamp(mean + axis * tMax, 0.0, 1.0);
+
+  for (int k = 0; k < (QUALITY == 1 ? 1 : 3); ++k)
+    refineEndpoints(mask, e0, e1);
+#endif
+}
+
+uint packRgb565(vec3 c) {
+  uvec3 q = uvec3(round(clamp(c, 0.0, 1.0) * vec3(31.0, 63.0, 31.0)));
+  return (q.r << 11) | (q.g << 5) | q.b;
+}
+
+vec3 unpackRgb565(uint v) {
+  uvec3 q = uvec3(v >> 11, (v >> 5) & 63u, v & 31u);
+  return vec3((q.r << 3) | (q.r >> 2), (q.g << 2) | (q.g >> 4),
+              (q.b << 3) | (q.b >> 2)) /
+         255.0;
+}
+
+// Four colour mode, colour0 > colour1
+uvec2 encodeColourBlock(vec3 e0, vec3 e1) {
+  uint c0 = packRgb565(e1);
+  uint c1 = packRgb565(e0);
+  if (c0 < c1) {
+    uint c = c0;
+    c0 = c1;
+    c1 = c;
+  }
+  if (c0 == c1)
+    return uvec2(c0 | (c1 << 16), 0u);
+
+  // Palette order c0, c1, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1
+  const uint remap[4] = uint[](0u, 2u, 3u, 1u);
+  vec3 d0 = unpackRgb565(c0);
+  vec3 dir = unpackRgb565(c1) - d0;
+  float scale = 3.0 / dot(dir, dir);
+  uint indices = 0u;
+  for (int i = 0; i < 16; ++i) {
+    float t = clamp(round(dot(texels[i].rgb - d0, dir) * scale), 0.0, 3.0);
+    indices |= remap[uint(t)] << (2 * i);
+  }
+  return uvec2(c0 | (c1 << 16), indices);
+}
+
+// BC4 style alpha, eight value mode with alpha0 > alpha1
+uvec2 encodeAlphaBlock() {
+  float lo = 1.0, hi = 0.0;
+  for (int i = 0; i < 16; ++i) {
+    lo = min(lo, texels[i].a);
+    hi = max(hi, texels[i].a);
+  }
+  uint a0 = uint(round(hi * 255.0));
+  uint a1 = uint(round(lo * 255.0));
+  uvec2 block = uvec2(a0 | (a1 << 8), 0u);
+  if (a0 == a1)
+    return block;
+
+  float scale = 7.0 / float(a0 - a1);
+  for (int i = 0; i < 16; ++i) {
+    float s = clamp(round((texels[i].a * 255.0 - float(a1)) * scale), 0.0, 7.0);
+    uint index = s == 7.0 ? 0u : (s == 0.0 ? 1u : 8u - uint(s));
+    uint bit = 16u + 3u * uint(i);
+    if (bit < 32u) {
+      block.x |= index << bit;
+      if (bit > 29u)
+        block.y |= index >> (32u - bit);
+    } else {
+      block.y |= index << (bit - 32u);
+    }
+  }
+  return block;
+}
+
+void putBits(inout uvec4 block, inout uint position, uint value, uint count) {
+  uint word = position >> 5;
+  uint bit = position & 31u;
+  block[word] |= value << bit;
+  if (bit + count > 32u)
+    block[word + 1u] |= value >> (32u - bit);
+  position += count;
+}
+
+// 7 bit endpoint with the p-bit that reproduces 'e' best
+uvec4 quantizeEndpoint(vec4 e, out uint pBit) {
+  vec4 q = round(clamp(e, 0.0, 1.0) * 255.0);
+  uvec4 best = uvec4(0u);
+  float bestError = 1e9;
+  for (uint p = 0u; p < 2u; ++p) {
+    uvec4 q7 = uvec4(clamp(round((q - float(p)) / 2.0), 0.0, 127.0));
+    vec4 d = q - vec4((q7 << 1) | p);
+    float error = dot(d, d);
+    if (error < bestError) {
+      bestError = error;
+      best = q7;
+      pBit = p;
+    }
+  }
+  return best;
+}
+
+uvec4 encodeBc7Block(vec4 e0, vec4 e1) {
+  const float weights[16] =
+      float[](0.0, 4.0, 9.0, 13.0, 17.0, 21.0, 26.0, 30.0, 34.0, 38.0, 43.0,
+              47.0, 51.0, 55.0, 60.0, 64.0);
+
+  uint p0, p1;
+  uvec4 q0 = quantizeEndpoint(e0, p0);
+  uvec4 q1 = quantizeEndpoint(e1, p1);
+  vec4 d0 = vec4((q0 << 1) | p0) / 255.0;
+  vec4 d1 = vec4((q1 << 1) | p1) / 255.0;
+  vec4 dir = d1 - d0;
+  float lengthSq = max(dot(dir, dir), 1e-8);
+
+  uint indices[16];
+  for (int i = 0; i < 16; ++i) {
+    float t = clamp(round(dot(texels[i] - d0, dir) / lengthSq * 15.0), 0.0,
+                    15.0);
+#if QUALITY == 2
+    // The weights are not evenly spaced, check the neighbours
+    float bestError = 1e9;
+    float nearest = t;
+    for (float c = max(nearest - 1.0, 0.0); c <= min(nearest + 1.0, 15.0);
+         c += 1.0) {
+      vec4 d = mix(d0, d1, weights[int(c)] / 64.0) - texels[i];
+      if (dot(d, d) < bestError) {
+        bestError = dot(d, d);
+        t = c;
+      }
+    }
+#endif
+    indices[i] = uint(t);
+  }
+
+  // The anchor index has an implicit zero top bit
+  if (indices[0] >= 8u) {
+    uvec4 q = q0;
+    q0 = q1;
+    q1 = q;
+    uint p = p0;
+    p0 = p1;
+    p1 = p;
+    for (int i = 0; i < 16; ++i)
+      indices[i] = 15u - indices[i];
+  }
+
+  uvec4 block = uvec4(0u);
+  uint position = 0u;
+  putBits(block, position, 1u << 6, 7u);
+  for (int c = 0; c < 4; ++c) {
+    putBits(block, position, q0[c], 7u);
+    putBits(block, position, q1[c], 7u);
+  }
+  putBits(block, position, p0, 1u);
+  putBits(block, position, p1, 1u);
+  putBits(block, position, indices[0], 3u);
+  for (int i = 1; i < 16; ++i)
+    putBits(block, position, indices[i], 4u);
+  return block;
+}
+
+void main() {
+  uvec2 block = gl_GlobalInvocationID.xy;
+  if (any(greaterThanEqual(block, params.blockCount)))
+    return;
+  loadBlock(block);
+
+  uint index = params.blockOffset + block.y * params.blockCount.x + block.x;
+  vec4 e0, e1;
+#ifdef BC7
+  fitEndpoints(vec4(1.0), e0, e1);
+  blocks[index] = encodeBc7Block(e0, e1);
+#else
+  fitEndpoints(vec4(1.0, 1.0, 1.0, 0.0), e0, e1);
+  uvec2 colour = encodeColourBlock(e0.rgb, e1.rgb);
+#ifdef BC1
+  blocks[index] = colour;
+#else
+  blocks[index] = uvec4(encodeAlphaBlock(), colour);
+#endif
+#endif
+}
+)glsl";
+
+static const char *getBlockFormatDefine(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+  case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+  case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+  case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+    return "BC1";
+  case VK_FORMAT_BC3_UNORM_BLOCK:
+  case VK_FORMAT_BC3_SRGB_BLOCK:
+    return "BC3";
+  case VK_FORMAT_BC7_UNORM_BLOCK:
+  case VK_FORMAT_BC7_SRGB_BLOCK:
+    return "BC7";
+  default:
+    return nullptr;
+  }
+}
+
+void vdu::BlockCompressor::setQuality(Quality quality) { m_quality = quality; }
+
+void vdu::BlockCompressor::create(LogicalDevice *logicalDevice,
+                                  Texture *source, Texture *destination) {
+  m_logicalDevice = logicalDevice;
+  m_source = source;
+  m_destination = destination;
+
+  auto &sourceInfo = m_source->getFormatInfo();
+  auto &destinationInfo = m_destination->getFormatInfo();
+  if (!getBlockFormatDefine(m_destination->getFormat()) ||
+      sourceInfo.isCompressed() || sourceInfo.componentCount != 4 ||
+      m_source->getLayers() != 1 || m_source->getDepth() > 1 ||
+      m_source->getWidth() != m_destination->getWidth() ||
+      m_source->getHeight() != m_destination->getHeight() ||
+      !(m_source->getUsageFlags() & VK_IMAGE_USAGE_SAMPLED_BIT)) {
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Error,
+        "Block compression needs a sampled 2D RGBA texture and a BC1, BC3 or "
+        "BC7 texture of the same size");
+    return;
+  }
+
+  auto mipCount = std::min(m_source->getNumMipLevels(),
+                           m_destination->getNumMipLevels());
+  uint32_t blockOffset = 0;
+  m_texelCount = 0;
+  for (uint32_t mip = 0; mip < mipCount; ++mip) {
+    auto width = std::max(1u, m_source->getWidth() >> mip);
+    auto height = std::max(1u, m_source->getHeight() >> mip);
+
+    MipDispatch dispatch;
+    dispatch.blockCountX = (width + 3) / 4;
+    dispatch.blockCountY = (height + 3) / 4;
+    dispatch.blockOffset = blockOffset;
+    dispatch.mipLevel = mip;
+    m_dispatches.push_back(dispatch);
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = VkDeviceSize(blockOffset) *
+                          destinationInfo.bytesPerBlock;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = mip;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {width, height, 1};
+    m_regions.push_back(region);
+
+    blockOffset += dispatch.blockCountX * dispatch.blockCountY;
+    m_texelCount += uint64_t(width) * height;
+  }
+
+  m_blocks.setUsage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+  m_blocks.setMemoryUsage(MemoryUsage::GpuOnly);
+  m_blocks.create(m_logicalDevice,
+                  VkDeviceSize(blockOffset) * destinationInfo.bytesPerBlock);
+
+  m_timestamps.setQueryType(VK_QUERY_TYPE_TIMESTAMP);
+  m_timestamps.setQueryCount(2);
+  m_timestamps.create(m_logicalDevice);
+
+  m_shader.addModuleFromSource(
+      ShaderStage::Compute,
+      getShaderSource(m_destination->getFormat(),
+                      sourceInfo.srgb && destinationInfo.srgb),
+      "vdu_compress.comp");
+  m_shader.create(m_logicalDevice);
+  m_shader.compile();
+
+  m_descriptorPool.addPoolCount(VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 1);
+  m_descriptorPool.addPoolCount(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1);
+  m_descriptorPool.addSetCount(1);
+  m_descriptorPool.create(m_logicalDevice);
+
+  m_descriptorSetLayout.addBinding("source", DescriptorType::SampledImage, 0, 1,
+                                   ShaderStage::Compute);
+  m_descriptorSetLayout.addBinding("blocks", DescriptorType::StorageBuffer, 1,
+                                   1, ShaderStage::Compute);
+  m_descriptorSetLayout.create(m_logicalDevice);
+
+  m_descriptorSet.allocate(m_logicalDevice, &m_descriptorSetLayout,
+                           &m_descriptorPool);
+  auto updater = m_descriptorSet.makeUpdater();
+  auto imageUpdate = updater->addImageUpdate("source");
+  imageUpdate->imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  imageUpdate->imageView = m_source->getView();
+  imageUpdate->sampler = 0;
+  auto bufferUpdate = updater->addBufferUpdate("blocks");
+  bufferUpdate->buffer = m_blocks.getHandle();
+  bufferUpdate->offset = 0;
+  bufferUpdate->range = VK_WHOLE_SIZE;
+  m_descriptorSet.submitUpdater(updater);
+  m_descriptorSet.destroyUpdater(updater);
+
+  m_pipelineLayout.addDescriptorSetLayout(&m_descriptorSetLayout);
+  m_pipelineLayout.addPushConstantRange(PushConstantRange{
+      ShaderStage::Compute, 0u, uint32_t(sizeof(MipDispatch))});
+  m_pipelineLayout.create(m_logicalDevice);
+
+  m_pipeline.setPipelineLayout(&m_pipelineLayout);
+  m_pipeline.setShaderProgram(&m_shader);
+  m_pipeline.create(m_logicalDevice);
+}
+
+void vdu::BlockCompressor::destroy() {
+  if (!m_logicalDevice)
+    return;
+  m_pipeline.destroy();
+  m_pipelineLayout.destroy();
+  m_descriptorSetLayout.destroy();
+  m_descriptorPool.destroy();
+  m_shader.destroy();
+  m_timestamps.destroy();
+  m_blocks.destroy();
+  m_dispatches.clear();
+  m_regions.clear();
+}
+
+void vdu::BlockCompressor::cmdCompress(CommandBuffer *cmd) {
+  cmdCompress(cmd->getHandle());
+}
+
+void vdu::BlockCompressor::cmdCompress(const VkCommandBuffer &cmd) {
+  if (m_regions.empty())
+    return;
+
+  m_timestamps.cmdReset(cmd);
+  m_timestamps.cmdTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0);
+
+  // The previous compression's copy must have read the blocks
+  VkMemoryBarrier blocksBarrier = {};
+  blocksBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                       &blocksBarrier, 0, nullptr, 0, nullptr);
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    m_pipeline.getHandle());
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          m_pipelineLayout.getHandle(), 0, 1,
+                          &m_descriptorSet.getHandle(), 0, nullptr);
+  for (auto &dispatch : m_dispatches) {
+    vkCmdPushConstants(cmd, m_pipelineLayout.getHandle(),
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(dispatch),
+                       &dispatch);
+    vkCmdDispatch(cmd, (dispatch.blockCountX + 7) / 8,
+                  (dispatch.blockCountY + 7) / 8, 1);
+  }
+
+  // Blocks become readable by the copy, the destination's old contents are
+  // discarded
+  blocksBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  blocksBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+  VkImageMemoryBarrier imageBarrier = {};
+  imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  imageBarrier.image = m_destination->getHandle();
+  imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  imageBarrier.subresourceRange.baseMipLevel = 0;
+  imageBarrier.subresourceRange.levelCount = m_regions.size();
+  imageBarrier.subresourceRange.baseArrayLayer = 0;
+  imageBarrier.subresourceRange.layerCount = 1;
+  imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  imageBarrier.srcAccessMask = 0;
+  imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &blocksBarrier, 0,
+                       nullptr, 1, &imageBarrier);
+
+  vkCmdCopyBufferToImage(cmd, m_blocks.getHandle(),
+                         m_destination->getHandle(),
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         m_regions.size(), m_regions.data());
+
+  auto finalLayout = m_destination->getLayout();
+  if (finalLayout != VK_IMAGE_LAYOUT_UNDEFINED &&
+      finalLayout != VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    imageBarrier.newLayout = finalLayout;
+    imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    imageBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &imageBarrier);
+  }
+
+  m_timestamps.cmdTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 1);
+}
+
+double vdu::BlockCompressor::getThroughput() {
+  if (m_regions.empty())
+    return 0.0;
+  auto timestamps = m_timestamps.query();
+  auto period = m_logicalDevice->getPhysicalDevice()
+                    ->getDeviceProperties()
+                    .limits.timestampPeriod;
+  double seconds = double(timestamps[1] - timestamps[0]) * period * 1e-9;
+  return seconds > 0.0 ? double(m_texelCount) / seconds : 0.0;
+}
+
+std::string vdu::BlockCompressor::getShaderSource(VkFormat format,
+                                                  bool srgb) {
+  std::stringstream source;
+  source << "#version 450\n";
+  source << "#define " << getBlockFormatDefine(format) << "\n";
+  source << "#define QUALITY " << int(m_quality) << "\n";
+  if (srgb)
+    source << "#define SRGB\n";
+  source << compressSource;
+  return source.str();
+}
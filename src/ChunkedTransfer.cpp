@@ -0,0 +1,196 @@
+#include "ChunkedTransfer.hpp"
+#include "HostCopy.hpp"
+#include "LogicalDevice.hpp"
+#include "Queue.hpp"
+#include "QueueFamily.hpp"
+
+void vdu::ChunkedTransfer::create(LogicalDevice *logicalDevice, Queue *queue,
+                                  VkDeviceSize chunkSize,
+                                  uint32_t chunkCount) {
+  m_logicalDevice = logicalDevice;
+  m_queue = queue;
+  m_chunkSize = chunkSize;
+
+  m_commandPool.setQueueFamily(m_queue->getFamily());
+  m_commandPool.setFlags(VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+  m_commandPool.create(m_logicalDevice);
+
+  m_chunks.resize(std::max(2u, chunkCount));
+  for (auto &chunk : m_chunks) {
+    chunk.commandBuffer.allocate(m_logicalDevice, &m_commandPool);
+    chunk.fence.create(m_logicalDevice);
+  }
+}
+
+void vdu::ChunkedTransfer::destroy() {
+  if (!m_logicalDevice)
+    return;
+  waitIdle();
+  for (auto &chunk : m_chunks) {
+    chunk.commandBuffer.free();
+    chunk.fence.destroy();
+  }
+  m_chunks.clear();
+  if (m_uploadStaging.getMemory())
+    m_uploadStaging.destroy();
+  if (m_downloadStaging.getMemory())
+    m_downloadStaging.destroy();
+  m_commandPool.destroy();
+}
+
+bool vdu::ChunkedTransfer::upload(Buffer *dst, const void *data,
+                                  VkDeviceSize size, VkDeviceSize dstOffset) {
+  auto staging = getStaging(false);
+  if (!staging)
+    return false;
+  auto flags = staging->getMemory()->getMemoryTypeFlags();
+  return upload(dst, size,
+                [&](void *chunk, VkDeviceSize offset, VkDeviceSize chunkSize) {
+                  copyToMapped(chunk, (const char *)data + offset, chunkSize,
+                               flags);
+                  return true;
+                },
+                dstOffset);
+}
+
+bool vdu::ChunkedTransfer::upload(Buffer *dst, VkDeviceSize size,
+                                  Producer producer, VkDeviceSize dstOffset) {
+  auto staging = getStaging(false);
+  if (!staging)
+    return false;
+  auto memory = staging->getMemory();
+  auto mapped = (char *)memory->map();
+
+  // Chunk i + 1 is written while the copies of the chunks before it run
+  bool succeeded = true;
+  for (VkDeviceSize offset = 0, i = 0; offset < size;
+       offset += m_chunkSize, ++i) {
+    auto slot = i % m_chunks.size();
+    auto &chunk = m_chunks[slot];
+    waitChunk(chunk);
+
+    VkBufferCopy region = {};
+    region.srcOffset = slot * m_chunkSize;
+    region.dstOffset = dstOffset + offset;
+    region.size = std::min(m_chunkSize, size - offset);
+    if (!producer(mapped + region.srcOffset, offset, region.size)) {
+      succeeded = false;
+      break;
+    }
+    memory->flush(region.srcOffset, region.size);
+    submitCopy(chunk, staging, dst, region, false);
+  }
+  waitIdle();
+  return succeeded;
+}
+
+bool vdu::ChunkedTransfer::download(Buffer *src, void *data,
+                                    VkDeviceSize size,
+                                    VkDeviceSize srcOffset) {
+  return download(src, size,
+                  [&](const void *chunk, VkDeviceSize offset,
+                      VkDeviceSize chunkSize) {
+                    memcpy((char *)data + offset, chunk, chunkSize);
+                    return true;
+                  },
+                  srcOffset);
+}
+
+bool vdu::ChunkedTransfer::download(Buffer *src, VkDeviceSize size,
+                                    Consumer consumer, VkDeviceSize srcOffset) {
+  auto staging = getStaging(true);
+  if (!staging)
+    return false;
+  auto memory = staging->getMemory();
+  auto mapped = (const char *)memory->map();
+
+  auto chunkCount = (size + m_chunkSize - 1) / m_chunkSize;
+  auto getRegion = [&](VkDeviceSize i) {
+    VkBufferCopy region = {};
+    region.srcOffset = srcOffset + i * m_chunkSize;
+    region.dstOffset = (i % m_chunks.size()) * m_chunkSize;
+    region.size = std::min(m_chunkSize, size - i * m_chunkSize);
+    return region;
+  };
+
+  // Every slot is copying ahead, a slot is refilled as soon as it is read
+  for (VkDeviceSize i = 0; i < std::min<VkDeviceSize>(chunkCount,
+                                                      m_chunks.size());
+       ++i)
+    submitCopy(m_chunks[i], src, staging, getRegion(i), true);
+
+  bool succeeded = true;
+  for (VkDeviceSize i = 0; i < chunkCount; ++i) {
+    auto &chunk = m_chunks[i % m_chunks.size()];
+    waitChunk(chunk);
+
+    auto region = getRegion(i);
+    memory->invalidate(region.dstOffset, region.size);
+    if (!consumer(mapped + region.dstOffset, i * m_chunkSize, region.size)) {
+      succeeded = false;
+      break;
+    }
+    if (i + m_chunks.size() < chunkCount)
+      submitCopy(chunk, src, staging, getRegion(i + m_chunks.size()), true);
+  }
+  waitIdle();
+  return succeeded;
+}
+
+vdu::Buffer *vdu::ChunkedTransfer::getStaging(bool download) {
+  auto &staging = download ? m_downloadStaging : m_uploadStaging;
+  if (!staging.getMemory()) {
+    staging.setUsage(download ? VK_BUFFER_USAGE_TRANSFER_DST_BIT
+                              : VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    staging.setMemoryUsage(download ? MemoryUsage::GpuToCpu
+                                    : MemoryUsage::CpuToGpu);
+    staging.create(m_logicalDevice, getStagingSize());
+    if (!staging.getMemory()) {
+      m_logicalDevice->_internalReportVduDebug(
+          vdu::LogicalDevice::VduDebugLevel::Error,
+          "Failed to create chunked transfer staging");
+      return nullptr;
+    }
+  }
+  return &staging;
+}
+
+void vdu::ChunkedTransfer::submitCopy(Chunk &chunk, Buffer *src, Buffer *dst,
+                                      const VkBufferCopy &region,
+                                      bool download) {
+  auto &cmd = chunk.commandBuffer;
+  cmd.reset();
+  cmd.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  vkCmdCopyBuffer(cmd.getHandle(), src->getHandle(), dst->getHandle(), 1,
+                  &region);
+  if (download) {
+    // Make the copy visible to the host once the fence has signalled
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(cmd.getHandle(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0,
+                         nullptr, 0, nullptr);
+  }
+  cmd.end();
+
+  QueueSubmission submission;
+  submission.addCommands(&cmd);
+  chunk.fence.reset();
+  VDU_VK_CHECK_RESULT(m_queue->submit(submission, chunk.fence),
+                      "submitting chunked transfer");
+  chunk.inFlight = true;
+}
+
+void vdu::ChunkedTransfer::waitChunk(Chunk &chunk) {
+  if (!chunk.inFlight)
+    return;
+  chunk.fence.wait();
+  chunk.inFlight = false;
+}
+
+void vdu::ChunkedTransfer::waitIdle() {
+  for (auto &chunk : m_chunks)
+    waitChunk(chunk);
+}
@@ -0,0 +1,312 @@
+#include "CopyBatch.hpp"
+#include "CommandBuffer.hpp"
+
+static bool overlaps(const VkBufferImageCopy &a, const VkBufferImageCopy &b) {
+  auto &sa = a.imageSubresource;
+  auto &sb = b.imageSubresource;
+  if (!(sa.aspectMask & sb.aspectMask) || sa.mipLevel != sb.mipLevel)
+    return false;
+  if (sa.baseArrayLayer >= sb.baseArrayLayer + sb.layerCount ||
+      sb.baseArrayLayer >= sa.baseArrayLayer + sa.layerCount)
+    return false;
+  return a.imageOffset.x < b.imageOffset.x + int32_t(b.imageExtent.width) &&
+         b.imageOffset.x < a.imageOffset.x + int32_t(a.imageExtent.width) &&
+         a.imageOffset.y < b.imageOffset.y + int32_t(b.imageExtent.height) &&
+         b.imageOffset.y < a.imageOffset.y + int32_t(a.imageExtent.height) &&
+         a.imageOffset.z < b.imageOffset.z + int32_t(b.imageExtent.depth) &&
+         b.imageOffset.z < a.imageOffset.z + int32_t(a.imageExtent.depth);
+}
+
+static bool meets(VkDeviceSize aOffset, VkDeviceSize aSize,
+                  VkDeviceSize bOffset, VkDeviceSize bSize) {
+  return aOffset < bOffset + bSize && bOffset < aOffset + aSize;
+}
+
+// Within one buffer, whether any region reads what any region writes
+static bool readsWritten(const std::vector<VkBufferCopy> &regions) {
+  for (auto &reader : regions)
+    for (auto &writer : regions)
+      if (meets(reader.srcOffset, reader.size, writer.dstOffset, writer.size))
+        return true;
+  return false;
+}
+
+static bool isRepeat(const VkBufferImageCopy &a, const VkBufferImageCopy &b) {
+  auto &sa = a.imageSubresource;
+  auto &sb = b.imageSubresource;
+  return sa.aspectMask == sb.aspectMask && sa.mipLevel == sb.mipLevel &&
+         sa.baseArrayLayer == sb.baseArrayLayer &&
+         sa.layerCount == sb.layerCount &&
+         a.imageOffset.x == b.imageOffset.x &&
+         a.imageOffset.y == b.imageOffset.y &&
+         a.imageOffset.z == b.imageOffset.z &&
+         a.imageExtent.width == b.imageExtent.width &&
+         a.imageExtent.height == b.imageExtent.height &&
+         a.imageExtent.depth == b.imageExtent.depth;
+}
+
+// Appends 'lower' to 'upper' if its rows directly follow in both the image and
+// the buffer, only for tightly packed single layer 2D regions of uncompressed
+// formats
+static bool mergeRows(VkBufferImageCopy &upper, const VkBufferImageCopy &lower,
+                      VkDeviceSize texelSize) {
+  auto tight = [](const VkBufferImageCopy &region) {
+    return (region.bufferRowLength == 0 ||
+            region.bufferRowLength == region.imageExtent.width) &&
+           (region.bufferImageHeight == 0 ||
+            region.bufferImageHeight == region.imageExtent.height) &&
+           region.imageSubresource.layerCount == 1 &&
+           region.imageExtent.depth == 1;
+  };
+  auto &su = upper.imageSubresource;
+  auto &sl = lower.imageSubresource;
+  if (texelSize == 0 || !tight(upper) || !tight(lower) ||
+      su.aspectMask != sl.aspectMask || su.mipLevel != sl.mipLevel ||
+      su.baseArrayLayer != sl.baseArrayLayer ||
+      upper.imageOffset.x != lower.imageOffset.x ||
+      upper.imageOffset.z != lower.imageOffset.z ||
+      upper.imageExtent.width != lower.imageExtent.width ||
+      upper.imageOffset.y + int32_t(upper.imageExtent.height) !=
+          lower.imageOffset.y ||
+      upper.bufferOffset + VkDeviceSize(upper.imageExtent.width) *
+                               upper.imageExtent.height * texelSize !=
+          lower.bufferOffset)
+    return false;
+
+  upper.bufferRowLength = 0;
+  upper.bufferImageHeight = 0;
+  upper.imageExtent.height += lower.imageExtent.height;
+  return true;
+}
+
+void vdu::CopyBatch::addCopy(Buffer *src, Buffer *dst, VkDeviceSize size,
+                             VkDeviceSize srcOffset, VkDeviceSize dstOffset) {
+  VkBufferCopy region = {};
+  region.srcOffset = srcOffset;
+  region.dstOffset = dstOffset;
+  region.size = size;
+  addCopy(src->getHandle(), dst->getHandle(), region);
+}
+
+void vdu::CopyBatch::addCopy(const VkBuffer &src, const VkBuffer &dst,
+                             const VkBufferCopy &region) {
+  ++m_regionCount;
+  m_bytesAdded += region.size;
+  if (region.size == 0)
+    return;
+
+  auto pair = std::find_if(
+      m_bufferPairs.begin(), m_bufferPairs.end(),
+      [&](const BufferPair &p) { return p.src == src && p.dst == dst; });
+  if (pair == m_bufferPairs.end()) {
+    m_bufferPairs.push_back(BufferPair());
+    pair = m_bufferPairs.end() - 1;
+    pair->src = src;
+    pair->dst = dst;
+  }
+
+  if (src == dst)
+    pair->ordered.push_back(region);
+
+  // Clip whatever the new region overwrites, keeping heads and tails
+  auto &ranges = pair->ranges;
+  auto begin = region.dstOffset;
+  auto end = region.dstOffset + region.size;
+  auto it = ranges.lower_bound(begin);
+  if (it != ranges.begin() && std::prev(it)->second.dstEnd > begin)
+    --it;
+  while (it != ranges.end() && it->first < end) {
+    auto rangeBegin = it->first;
+    auto range = it->second;
+    it = ranges.erase(it);
+    if (rangeBegin < begin)
+      ranges[rangeBegin] = {begin, range.srcOffset};
+    if (range.dstEnd > end)
+      ranges[end] = {range.dstEnd, range.srcOffset + (end - rangeBegin)};
+  }
+  ranges[begin] = {end, region.srcOffset};
+}
+
+void vdu::CopyBatch::addCopy(Buffer *src, Texture *dst,
+                             const VkBufferImageCopy &region) {
+  addCopy(src->getHandle(), dst, region);
+}
+
+void vdu::CopyBatch::addCopy(const VkBuffer &src, Texture *dst,
+                             const VkBufferImageCopy &region) {
+  ++m_regionCount;
+  m_bytesAdded += getImageRegionSize(dst, region);
+
+  auto pair = std::find_if(
+      m_imagePairs.begin(), m_imagePairs.end(),
+      [&](const ImagePair &p) { return p.src == src && p.dst == dst; });
+  if (pair == m_imagePairs.end()) {
+    m_imagePairs.push_back(ImagePair());
+    pair = m_imagePairs.end() - 1;
+    pair->src = src;
+    pair->dst = dst;
+    pair->commands.emplace_back();
+  }
+
+  auto &regions = pair->commands.back();
+  for (auto &existing : regions)
+    if (isRepeat(existing, region)) {
+      existing = region;
+      return;
+    }
+  for (auto &existing : regions)
+    if (overlaps(existing, region)) {
+      pair->commands.emplace_back(1, region);
+      return;
+    }
+
+  // Depth and stencil planes of combined formats have their own texel sizes
+  VkDeviceSize texelSize =
+      dst->getFormatInfo().isCompressed()
+          ? 0
+          : dst->getAspectTexelSize(
+                VkImageAspectFlagBits(region.imageSubresource.aspectMask));
+  for (auto &existing : regions) {
+    if (mergeRows(existing, region, texelSize))
+      return;
+    auto merged = region;
+    if (mergeRows(merged, existing, texelSize)) {
+      existing = merged;
+      return;
+    }
+  }
+  regions.push_back(region);
+}
+
+void vdu::CopyBatch::cmdCopy(CommandBuffer *cmd) { cmdCopy(cmd->getHandle()); }
+
+void vdu::CopyBatch::cmdCopy(const VkCommandBuffer &cmd) {
+  m_recordedRegionCount = 0;
+  m_commandCount = 0;
+  m_bytesRecorded = 0;
+
+  std::vector<VkBufferCopy> regions;
+  for (auto &pair : m_bufferPairs) {
+    if (readsWritten(pair.ordered)) {
+      cmdCopyInOrder(cmd, pair);
+      continue;
+    }
+    regions.clear();
+    for (auto &range : pair.ranges) {
+      auto size = range.second.dstEnd - range.first;
+      m_bytesRecorded += size;
+      if (!regions.empty()) {
+        auto &last = regions.back();
+        bool contiguous = last.dstOffset + last.size == range.first &&
+                          last.srcOffset + last.size == range.second.srcOffset;
+        // Within one buffer the merged source and destination must stay apart
+        bool disjoint = pair.src != pair.dst ||
+                        last.srcOffset + last.size + size <= last.dstOffset ||
+                        last.dstOffset + last.size + size <= last.srcOffset;
+        if (contiguous && disjoint) {
+          last.size += size;
+          continue;
+        }
+      }
+      VkBufferCopy region = {};
+      region.srcOffset = range.second.srcOffset;
+      region.dstOffset = range.first;
+      region.size = size;
+      regions.push_back(region);
+    }
+    if (regions.empty())
+      continue;
+    vkCmdCopyBuffer(cmd, pair.src, pair.dst, regions.size(), regions.data());
+    m_recordedRegionCount += regions.size();
+    ++m_commandCount;
+  }
+
+  // Partially overlapping image regions are ordered by a barrier between rounds
+  for (uint32_t round = 0;; ++round) {
+    bool recorded = false;
+    for (auto &pair : m_imagePairs) {
+      if (round >= pair.commands.size())
+        continue;
+      if (!recorded && round > 0) {
+        VkMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0,
+                             nullptr, 0, nullptr);
+      }
+      recorded = true;
+
+      auto &imageRegions = pair.commands[round];
+      for (auto &region : imageRegions)
+        m_bytesRecorded += getImageRegionSize(pair.dst, region);
+      vkCmdCopyBufferToImage(cmd, pair.src, pair.dst->getHandle(),
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             imageRegions.size(), imageRegions.data());
+      m_recordedRegionCount += imageRegions.size();
+      ++m_commandCount;
+    }
+    if (!recorded)
+      break;
+  }
+}
+
+void vdu::CopyBatch::cmdCopyInOrder(const VkCommandBuffer &cmd,
+                                    const BufferPair &pair) {
+  std::vector<VkBufferCopy> regions;
+  auto record = [&]() {
+    vkCmdCopyBuffer(cmd, pair.src, pair.dst, regions.size(), regions.data());
+    for (auto &region : regions)
+      m_bytesRecorded += region.size;
+    m_recordedRegionCount += regions.size();
+    ++m_commandCount;
+    regions.clear();
+  };
+
+  // A region joins the current command unless it touches what the command
+  // reads or writes in a way that depends on the order
+  for (auto &region : pair.ordered) {
+    bool dependent = false;
+    for (auto &other : regions)
+      dependent = dependent ||
+                  meets(region.srcOffset, region.size, other.dstOffset,
+                        other.size) ||
+                  meets(region.dstOffset, region.size, other.srcOffset,
+                        other.size) ||
+                  meets(region.dstOffset, region.size, other.dstOffset,
+                        other.size);
+    if (dependent) {
+      record();
+      VkMemoryBarrier barrier = {};
+      barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.dstAccessMask =
+          VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+      vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0,
+                           nullptr, 0, nullptr);
+    }
+    regions.push_back(region);
+  }
+  if (!regions.empty())
+    record();
+}
+
+void vdu::CopyBatch::clear() {
+  m_bufferPairs.clear();
+  m_imagePairs.clear();
+  m_regionCount = 0;
+  m_recordedRegionCount = 0;
+  m_commandCount = 0;
+  m_bytesAdded = 0;
+  m_bytesRecorded = 0;
+}
+
+VkDeviceSize vdu::CopyBatch::getImageRegionSize(Texture *dst,
+                                                const VkBufferImageCopy &region) {
+  return dst->getFormatInfo().getSize(region.imageExtent.width,
+                                     region.imageExtent.height,
+                                     region.imageExtent.depth) *
+         region.imageSubresource.layerCount;
+}
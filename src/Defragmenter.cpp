@@ -0,0 +1,304 @@
+#include "Defragmenter.hpp"
+#include "CommandBuffer.hpp"
+#include "LogicalDevice.hpp"
+#include "Synchro.hpp"
+
+void vdu::Defragmenter::create(LogicalDevice *logicalDevice) {
+  m_logicalDevice = logicalDevice;
+}
+
+void vdu::Defragmenter::addBuffer(Buffer *buffer) {
+  m_buffers.push_back(buffer);
+}
+
+void vdu::Defragmenter::addTexture(Texture *texture) {
+  m_textures.push_back(texture);
+}
+
+void vdu::Defragmenter::setMaxBytesToMove(VkDeviceSize maxBytes) {
+  m_maxBytesToMove = maxBytes;
+}
+
+uint32_t vdu::Defragmenter::cmdDefragment(CommandBuffer *cmd) {
+  return cmdDefragment(cmd->getHandle());
+}
+
+uint32_t vdu::Defragmenter::cmdDefragment(const VkCommandBuffer &cmd) {
+  if (!m_moves.empty()) {
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Warning,
+        "Attempting to defragment before the previous moves have finished");
+    return 0;
+  }
+  m_bytesMoved = 0;
+  m_moveCount = 0;
+  m_blocksReleased = 0;
+
+  auto allocator = m_logicalDevice->getMemoryAllocator();
+
+  // Registered resources by the block they are sub-allocated from. Those that
+  // can't be copied stay unregistered and pin their block
+  std::map<const DeviceMemory *, std::vector<std::pair<Buffer *, Texture *>>>
+      blockResources;
+  const VkBufferUsageFlags bufferCopyUsage =
+      VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  for (auto buffer : m_buffers) {
+    auto memory = buffer->m_deviceMemory;
+    // Host visible buffers may hold mapped pointers, which a move would break
+    if (memory && memory->isSubAllocation() &&
+        !(memory->getMemoryTypeFlags() & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+        (buffer->m_usageFlags & bufferCopyUsage) == bufferCopyUsage)
+      blockResources[memory->m_parentBlock].push_back({buffer, nullptr});
+  }
+  const VkImageUsageFlags imageCopyUsage =
+      VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  for (auto texture : m_textures) {
+    auto memory = texture->m_deviceMemory;
+    // Linear images may be host accessed in place, leave them be
+    if (memory && memory->isSubAllocation() &&
+        texture->m_tiling == VK_IMAGE_TILING_OPTIMAL &&
+        (texture->m_usageFlags & imageCopyUsage) == imageCopyUsage)
+      blockResources[memory->m_parentBlock].push_back({nullptr, texture});
+  }
+
+  for (auto &typeBlocks : allocator->m_blocks) {
+    auto &blocks = typeBlocks.second;
+    if (blocks.size() < 2)
+      continue;
+
+    std::vector<std::pair<VkDeviceSize, MemoryAllocator::Block *>> byUsage;
+    for (auto block : blocks) {
+      VkDeviceSize used = 0;
+      for (auto &range : block->usedRanges)
+        used += range.second.size;
+      byUsage.push_back({used, block});
+    }
+    std::sort(byUsage.begin(), byUsage.end(),
+              [](const std::pair<VkDeviceSize, MemoryAllocator::Block *> &a,
+                 const std::pair<VkDeviceSize, MemoryAllocator::Block *> &b) {
+                return a.first < b.first;
+              });
+
+    VkDeviceSize freeRemaining = 0;
+    for (auto &entry : byUsage)
+      freeRemaining += entry.second->memory->m_deviceSize - entry.first;
+
+    // Empty the sparsest blocks whose contents still fit in the free space of
+    // the blocks that stay
+    std::vector<MemoryAllocator::Block *> evacuated;
+    VkDeviceSize evacuatedBytes = 0;
+    for (auto &candidate : byUsage) {
+      auto used = candidate.first;
+      auto block = candidate.second;
+      if (used == 0 || m_bytesMoved + evacuatedBytes + used > m_maxBytesToMove)
+        continue;
+
+      // Blocks holding unregistered allocations can't be emptied
+      auto resources = blockResources.find(block->memory);
+      if (resources == blockResources.end() ||
+          resources->second.size() != block->usedRanges.size())
+        continue;
+
+      auto blockFree = block->memory->m_deviceSize - used;
+      if (evacuatedBytes + used > freeRemaining - blockFree)
+        break;
+
+      block->evacuating = true;
+      evacuated.push_back(block);
+      evacuatedBytes += used;
+      freeRemaining -= blockFree;
+    }
+
+    for (auto block : evacuated) {
+      for (auto &resource : blockResources[block->memory]) {
+        auto memory = resource.first ? resource.first->m_deviceMemory
+                                     : resource.second->m_deviceMemory;
+        Move move = {resource.first, resource.second, nullptr, 0, 0};
+        if (planMove(resource.first, resource.second, memory, move))
+          m_moves.push_back(move);
+      }
+    }
+  }
+
+  m_moveCount = m_moves.size();
+  if (m_moves.empty())
+    clearEvacuating();
+  else
+    recordMoves(cmd);
+  return m_moveCount;
+}
+
+bool vdu::Defragmenter::finish(const Fence *fence) {
+  if (fence && !fence->isSignalled())
+    return false;
+
+  auto allocator = m_logicalDevice->getMemoryAllocator();
+  auto blocksBefore = allocator->getBlockCount();
+
+  for (auto &move : m_moves) {
+    if (move.buffer) {
+      auto buffer = move.buffer;
+      vkDestroyBuffer(m_logicalDevice->getHandle(), buffer->m_buffer, nullptr);
+      allocator->free(buffer->m_deviceMemory);
+      buffer->m_buffer = move.newBuffer;
+      buffer->m_deviceMemory = move.newMemory;
+    } else {
+      auto texture = move.texture;
+      vkDestroyImageView(m_logicalDevice->getHandle(), texture->m_imageView,
+                         nullptr);
+      vkDestroyImage(m_logicalDevice->getHandle(), texture->m_image, nullptr);
+      allocator->free(texture->m_deviceMemory);
+      texture->m_image = move.newImage;
+      texture->m_imageView = texture->createView(move.newImage);
+      texture->m_deviceMemory = move.newMemory;
+    }
+  }
+  m_moves.clear();
+  clearEvacuating();
+
+  m_blocksReleased = blocksBefore - allocator->getBlockCount();
+  return true;
+}
+
+void vdu::Defragmenter::clearEvacuating() {
+  for (auto &typeBlocks : m_logicalDevice->getMemoryAllocator()->m_blocks)
+    for (auto block : typeBlocks.second)
+      block->evacuating = false;
+}
+
+bool vdu::Defragmenter::planMove(Buffer *buffer, Texture *texture,
+                                 const DeviceMemory *memory, Move &move) {
+  auto allocator = m_logicalDevice->getMemoryAllocator();
+
+  VkMemoryRequirements memReqs;
+  if (buffer) {
+    move.newBuffer = buffer->createHandle();
+    if (!move.newBuffer)
+      return false;
+    vkGetBufferMemoryRequirements(m_logicalDevice->getHandle(), move.newBuffer,
+                                  &memReqs);
+  } else {
+    move.newImage = texture->createImage();
+    if (!move.newImage)
+      return false;
+    vkGetImageMemoryRequirements(m_logicalDevice->getHandle(), move.newImage,
+                                 &memReqs);
+  }
+
+  move.newMemory = allocator->subAllocate(
+      allocator->padRequirements(memReqs, memory->m_memoryTypeIndex),
+      memory->m_memoryTypeIndex, memory->m_memoryProperties,
+      buffer ? MemoryAllocator::Linear : MemoryAllocator::Optimal, false,
+      false);
+  if (!move.newMemory) {
+    if (buffer)
+      vkDestroyBuffer(m_logicalDevice->getHandle(), move.newBuffer, nullptr);
+    else
+      vkDestroyImage(m_logicalDevice->getHandle(), move.newImage, nullptr);
+    return false;
+  }
+
+  if (buffer) {
+    VDU_VK_CHECK_RESULT(vkBindBufferMemory(m_logicalDevice->getHandle(),
+                                           move.newBuffer,
+                                           move.newMemory->getHandle(),
+                                           move.newMemory->getOffset()),
+                        "binding moved buffer memory");
+  } else {
+    VDU_VK_CHECK_RESULT(vkBindImageMemory(m_logicalDevice->getHandle(),
+                                          move.newImage,
+                                          move.newMemory->getHandle(),
+                                          move.newMemory->getOffset()),
+                        "binding moved texture memory");
+  }
+
+  m_bytesMoved += memory->m_deviceSize;
+  return true;
+}
+
+void vdu::Defragmenter::recordMoves(const VkCommandBuffer &cmd) {
+  std::vector<VkImageMemoryBarrier> preBarriers;
+  std::vector<VkImageMemoryBarrier> postBarriers;
+
+  for (auto &move : m_moves) {
+    auto texture = move.texture;
+    if (!texture || texture->m_layout == VK_IMAGE_LAYOUT_UNDEFINED)
+      continue;
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange.aspectMask = texture->m_aspectFlags;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = texture->m_numMipLevels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = texture->m_layers;
+
+    barrier.image = texture->m_image;
+    barrier.oldLayout = texture->m_layout;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    preBarriers.push_back(barrier);
+
+    barrier.image = move.newImage;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    preBarriers.push_back(barrier);
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = texture->m_layout;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask =
+        VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    postBarriers.push_back(barrier);
+  }
+
+  VkMemoryBarrier memoryBarrier = {};
+  memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  memoryBarrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+  memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memoryBarrier, 0,
+                       nullptr, preBarriers.size(), preBarriers.data());
+
+  for (auto &move : m_moves) {
+    if (move.buffer) {
+      VkBufferCopy region = {};
+      region.size = move.buffer->m_size;
+      vkCmdCopyBuffer(cmd, move.buffer->m_buffer, move.newBuffer, 1, &region);
+      continue;
+    }
+
+    auto texture = move.texture;
+    if (texture->m_layout == VK_IMAGE_LAYOUT_UNDEFINED)
+      continue;
+
+    std::vector<VkImageCopy> regions(texture->m_numMipLevels);
+    for (uint32_t mip = 0; mip < texture->m_numMipLevels; ++mip) {
+      auto &region = regions[mip];
+      region = {};
+      region.srcSubresource.aspectMask = texture->m_aspectFlags;
+      region.srcSubresource.mipLevel = mip;
+      region.srcSubresource.baseArrayLayer = 0;
+      region.srcSubresource.layerCount = texture->m_layers;
+      region.dstSubresource = region.srcSubresource;
+      region.extent.width = std::max(1u, texture->m_width >> mip);
+      region.extent.height = std::max(1u, texture->m_height >> mip);
+      region.extent.depth = std::max(1u, texture->m_depth >> mip);
+    }
+    vkCmdCopyImage(cmd, texture->m_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   move.newImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                   regions.size(), regions.data());
+  }
+
+  memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  memoryBarrier.dstAccessMask =
+      VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &memoryBarrier,
+                       0, nullptr, postBarriers.size(), postBarriers.data());
+}
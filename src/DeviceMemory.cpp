@@ -1,9 +1,44 @@
 #include "DeviceMemory.hpp"
 #include "Initializers.hpp"
 #include "LogicalDevice.hpp"
+#include "MemoryAllocator.hpp"
 #include "PhysicalDevice.hpp"
 #include "Queue.hpp"
 #include "QueueFamily.hpp"
+#include "UploadManager.hpp"
+
+#include <bitset>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VDU_SHADOW_SIMD
+#include <emmintrin.h>
+#endif
+
+// Dirty spans of a shadowed buffer this close are uploaded as one
+static const VkDeviceSize shadowMergeGap = 256;
+
+static bool bytesDiffer(const uint8_t *a, const uint8_t *b, size_t size) {
+  size_t i = 0;
+#ifdef VDU_SHADOW_SIMD
+  for (; i + 64 <= size; i += 64) {
+    auto equal = _mm_and_si128(
+        _mm_and_si128(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)),
+                           _mm_loadu_si128((const __m128i *)(b + i))),
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 16)),
+                           _mm_loadu_si128((const __m128i *)(b + i + 16)))),
+        _mm_and_si128(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 32)),
+                           _mm_loadu_si128((const __m128i *)(b + i + 32))),
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i + 48)),
+                           _mm_loadu_si128((const __m128i *)(b + i + 48)))));
+    if (_mm_movemask_epi8(equal) != 0xFFFF)
+      return true;
+  }
+#endif
+  return memcmp(a + i, b + i, size - i) != 0;
+}
 
 void vdu::DeviceMemory::allocate(LogicalDevice *logicalDevice,
                                  VkDeviceSize size,
@@ -12,53 +47,188 @@ void vdu::DeviceMemory::allocate(LogicalDevice *logicalDevice,
   m_logicalDevice = logicalDevice;
   m_memoryProperties = memFlags;
   m_deviceSize = size;
+  m_offset = 0;
+  m_parentBlock = nullptr;
+  m_memoryTypeIndex =
+      m_logicalDevice->getPhysicalDevice()->findMemoryTypeIndex(
+          memReqs.memoryTypeBits, memFlags);
 
   VkMemoryAllocateInfo allocInfo = {};
   allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
   allocInfo.allocationSize = memReqs.size;
-  allocInfo.memoryTypeIndex =
-      m_logicalDevice->getPhysicalDevice()->findMemoryTypeIndex(
-          memReqs.memoryTypeBits, memFlags);
+  allocInfo.memoryTypeIndex = m_memoryTypeIndex;
 
   VDU_VK_CHECK_RESULT(vkAllocateMemory(m_logicalDevice->getHandle(), &allocInfo,
                                        nullptr, &m_deviceMemory),
                       "allocating device memory");
+  if (m_deviceMemory)
+    m_logicalDevice->getMemoryAllocator()->_internalTrackAllocation(
+        m_memoryTypeIndex, m_deviceSize);
 }
 
 void vdu::DeviceMemory::free() {
-  vkFreeMemory(m_logicalDevice->getHandle(), m_deviceMemory, nullptr);
+  if (m_parentBlock) {
+    m_logicalDevice->getMemoryAllocator()->_internalFreeRange(this);
+    m_parentBlock = nullptr;
+  } else {
+    if (m_mappedData)
+      vkUnmapMemory(m_logicalDevice->getHandle(), m_deviceMemory);
+    if (m_deviceMemory)
+      m_logicalDevice->getMemoryAllocator()->_internalTrackFree(
+          m_memoryTypeIndex, m_deviceSize);
+    vkFreeMemory(m_logicalDevice->getHandle(), m_deviceMemory, nullptr);
+  }
+  m_deviceMemory = 0;
+  m_mappedData = nullptr;
 }
 
-void *vdu::DeviceMemory::map() const {
-  if (m_memoryProperties & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+void *vdu::DeviceMemory::map() const { return map(0, m_deviceSize); }
+
+void *vdu::DeviceMemory::map(VkDeviceSize offset, VkDeviceSize size) const {
+  if (!(getMemoryTypeFlags() & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
     m_logicalDevice->_internalReportVduDebug(
         vdu::LogicalDevice::VduDebugLevel::Error,
-        "Attempting to map an unmappable buffer");
+        "Attempting to map memory that is not host visible");
     return nullptr;
   }
-  void *data;
-  VDU_VK_CHECK_RESULT(vkMapMemory(m_logicalDevice->getHandle(), m_deviceMemory,
-                                  0, m_deviceSize, 0, &data),
-                      "mapping device memory");
-  return data;
-}
-
-void *vdu::DeviceMemory::map(VkDeviceSize offset, VkDeviceSize size) const {
-  if (m_memoryProperties & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) {
+  if (size == VK_WHOLE_SIZE && offset <= m_deviceSize)
+    size = m_deviceSize - offset;
+  if (offset > m_deviceSize || size > m_deviceSize - offset) {
     m_logicalDevice->_internalReportVduDebug(
         vdu::LogicalDevice::VduDebugLevel::Error,
-        "Attempting to map an unmappable buffer");
+        "Attempting to map a range past the end of the memory");
+    return nullptr;
+  }
+  auto data = static_cast<char *>(m_parentBlock ? m_parentBlock->mapBlock()
+                                                : mapBlock());
+  if (!data)
     return nullptr;
+  return data + m_offset + offset;
+}
+
+void vdu::DeviceMemory::unmap() const {}
+
+void *vdu::DeviceMemory::mapBlock() const {
+  if (!m_mappedData) {
+    VDU_VK_CHECK_RESULT(vkMapMemory(m_logicalDevice->getHandle(),
+                                    m_deviceMemory, 0, VK_WHOLE_SIZE, 0,
+                                    &m_mappedData),
+                        "mapping device memory");
   }
-  void *data;
-  VDU_VK_CHECK_RESULT(vkMapMemory(m_logicalDevice->getHandle(), m_deviceMemory,
-                                  offset, size, 0, &data),
-                      "mapping device memory");
-  return data;
+  return m_mappedData;
+}
+
+void vdu::DeviceMemory::flush(VkDeviceSize offset, VkDeviceSize size) const {
+  if (isHostCoherent())
+    return;
+  auto range = getMappedRange(offset, size);
+  VDU_VK_CHECK_RESULT(
+      vkFlushMappedMemoryRanges(m_logicalDevice->getHandle(), 1, &range),
+      "flushing mapped memory range");
+}
+
+void vdu::DeviceMemory::invalidate(VkDeviceSize offset,
+                                   VkDeviceSize size) const {
+  if (isHostCoherent())
+    return;
+  auto range = getMappedRange(offset, size);
+  VDU_VK_CHECK_RESULT(
+      vkInvalidateMappedMemoryRanges(m_logicalDevice->getHandle(), 1, &range),
+      "invalidating mapped memory range");
+}
+
+VkMappedMemoryRange
+vdu::DeviceMemory::getMappedRange(VkDeviceSize offset,
+                                  VkDeviceSize size) const {
+  auto atomSize = m_logicalDevice->getPhysicalDevice()
+                      ->getDeviceProperties()
+                      .limits.nonCoherentAtomSize;
+  if (atomSize == 0)
+    atomSize = 1;
+  auto memorySize = m_parentBlock ? m_parentBlock->m_deviceSize : m_deviceSize;
+  if (size == VK_WHOLE_SIZE)
+    size = m_deviceSize - offset;
+
+  auto begin = (m_offset + offset) / atomSize * atomSize;
+  auto end = (m_offset + offset + size + atomSize - 1) / atomSize * atomSize;
+
+  VkMappedMemoryRange range = {};
+  range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+  range.memory = m_deviceMemory;
+  range.offset = begin;
+  range.size = end >= memorySize ? VK_WHOLE_SIZE : end - begin;
+  return range;
+}
+
+VkMemoryPropertyFlags vdu::DeviceMemory::getMemoryTypeFlags() const {
+  if (m_memoryTypeIndex == ~0u)
+    return 0;
+  return m_logicalDevice->getPhysicalDevice()
+      ->getMemoryProperties()
+      .memoryTypes[m_memoryTypeIndex]
+      .propertyFlags;
 }
 
-void vdu::DeviceMemory::unmap() const {
-  vkUnmapMemory(m_logicalDevice->getHandle(), m_deviceMemory);
+bool vdu::DeviceMemory::isHostCoherent() const {
+  return (getMemoryTypeFlags() & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+}
+
+void vdu::MappedRangeBatch::add(const DeviceMemory *memory,
+                                VkDeviceSize offset, VkDeviceSize size) {
+  if (memory->isHostCoherent())
+    return;
+  m_logicalDevice = memory->getLogicalDevice();
+  m_ranges.push_back(memory->getMappedRange(offset, size));
+}
+
+void vdu::MappedRangeBatch::flush() {
+  if (m_ranges.empty())
+    return;
+  mergeRanges();
+  VDU_VK_CHECK_RESULT(vkFlushMappedMemoryRanges(m_logicalDevice->getHandle(),
+                                                m_ranges.size(),
+                                                m_ranges.data()),
+                      "flushing mapped memory ranges");
+}
+
+void vdu::MappedRangeBatch::invalidate() {
+  if (m_ranges.empty())
+    return;
+  mergeRanges();
+  VDU_VK_CHECK_RESULT(
+      vkInvalidateMappedMemoryRanges(m_logicalDevice->getHandle(),
+                                     m_ranges.size(), m_ranges.data()),
+      "invalidating mapped memory ranges");
+}
+
+void vdu::MappedRangeBatch::mergeRanges() {
+  std::sort(m_ranges.begin(), m_ranges.end(),
+            [](const VkMappedMemoryRange &a, const VkMappedMemoryRange &b) {
+              if (a.memory != b.memory)
+                return a.memory < b.memory;
+              return a.offset < b.offset;
+            });
+
+  // Sub-allocations of one block often produce touching or overlapping ranges
+  std::vector<VkMappedMemoryRange> merged;
+  for (auto &range : m_ranges) {
+    if (!merged.empty()) {
+      auto &last = merged.back();
+      if (last.memory == range.memory &&
+          (last.size == VK_WHOLE_SIZE ||
+           range.offset <= last.offset + last.size)) {
+        if (last.size != VK_WHOLE_SIZE) {
+          if (range.size == VK_WHOLE_SIZE)
+            last.size = VK_WHOLE_SIZE;
+          else if (range.offset + range.size > last.offset + last.size)
+            last.size = range.offset + range.size - last.offset;
+        }
+        continue;
+      }
+    }
+    merged.push_back(range);
+  }
+  m_ranges.swap(merged);
 }
 
 vdu::Buffer::Buffer(Buffer &stagingDestination) {
@@ -74,18 +244,49 @@ vdu::Buffer::Buffer(LogicalDevice *logicalDevice, VkDeviceSize size) {
 }
 
 void vdu::Buffer::create(LogicalDevice *logicalDevice, VkDeviceSize size) {
-  if (m_usageFlags == 0 || m_memoryProperties == 0) {
+  m_logicalDevice = logicalDevice;
+  if (m_usageFlags == 0 ||
+      (m_memoryProperties == 0 && m_memoryUsage == MemoryUsage::Unknown)) {
     m_logicalDevice->_internalReportVduDebug(
         vdu::LogicalDevice::VduDebugLevel::Error,
         "Attempting to create buffer with no usage flags or memory properties");
     return;
   }
 
-  m_logicalDevice = logicalDevice;
+  m_size = size;
+  if (m_shadowGranularity) {
+    m_usageFlags |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    m_shadow.assign(size, 0);
+    auto chunkCount = (size + m_shadowGranularity - 1) / m_shadowGranularity;
+    m_dirtyChunks.assign((chunkCount + 63) / 64, 0);
+    markDirty(0, size);
+  }
+  m_buffer = createHandle();
+  if (!m_buffer)
+    return;
 
+  auto allocator = m_logicalDevice->getMemoryAllocator();
+  VkMemoryRequirements memRequirements;
+  MemoryAllocator::DedicatedInfo dedicated;
+  allocator->getBufferMemoryRequirements(m_buffer, memRequirements, dedicated);
+
+  DeviceMemory *memory;
+  if (m_memoryUsage != MemoryUsage::Unknown)
+    memory = allocator->allocate(memRequirements, m_memoryUsage,
+                                 MemoryAllocator::Linear, &dedicated);
+  else
+    memory = allocator->allocate(memRequirements, m_memoryProperties,
+                                 MemoryAllocator::Linear, &dedicated);
+  if (!memory)
+    return;
+
+  bindMemory(memory);
+}
+
+VkBuffer vdu::Buffer::createHandle() {
   auto bci = vdu::initializer<VkBufferCreateInfo>();
   bci.usage = m_usageFlags;
-  bci.size = size;
+  bci.size = m_size;
 
   std::vector<uint32_t> sharingQueueFamilyIndices;
   if (m_usingQueueFamilies.size() < 2) {
@@ -99,26 +300,21 @@ void vdu::Buffer::create(LogicalDevice *logicalDevice, VkDeviceSize size) {
     bci.pQueueFamilyIndices = sharingQueueFamilyIndices.data();
   }
 
+  VkBuffer buffer = 0;
   VDU_VK_CHECK_RESULT(
-      vkCreateBuffer(m_logicalDevice->getHandle(), &bci, nullptr, &m_buffer),
+      vkCreateBuffer(m_logicalDevice->getHandle(), &bci, nullptr, &buffer),
       "creating buffer");
-
-  m_deviceMemory = new DeviceMemory();
-  VkMemoryRequirements memRequirements;
-  vkGetBufferMemoryRequirements(m_logicalDevice->getHandle(), m_buffer,
-                                &memRequirements);
-  m_deviceMemory->allocate(m_logicalDevice, size, m_memoryProperties,
-                           memRequirements);
-
-  bindMemory(m_deviceMemory);
+  return buffer;
 }
 
 void vdu::Buffer::destroy() {
   vkDestroyBuffer(m_logicalDevice->getHandle(), m_buffer, nullptr);
-  m_deviceMemory->free();
-  delete m_deviceMemory;
+  m_logicalDevice->getMemoryAllocator()->free(m_deviceMemory);
   m_deviceMemory = 0;
   m_buffer = 0;
+  m_shadow.clear();
+  m_shadow.shrink_to_fit();
+  m_dirtyChunks.clear();
 }
 
 void vdu::Buffer::addUsingQueueFamily(const QueueFamily *queueFamily) {
@@ -129,11 +325,118 @@ void vdu::Buffer::setUsage(VkBufferUsageFlags usage) { m_usageFlags = usage; }
 
 void vdu::Buffer::setMemoryProperty(VkMemoryPropertyFlags memProperty) {
   m_memoryProperties = memProperty;
+  m_memoryUsage = MemoryUsage::Unknown;
+}
+
+void vdu::Buffer::setMemoryUsage(MemoryUsage usage) {
+  m_memoryUsage = usage;
+  m_memoryProperties = 0;
+}
+
+void vdu::Buffer::setShadowed(VkDeviceSize granularity) {
+  assert(granularity && (granularity & (granularity - 1)) == 0);
+  m_shadowGranularity = granularity;
+}
+
+void vdu::Buffer::writeShadow(const void *data, VkDeviceSize size,
+                              VkDeviceSize offset) {
+  if (m_shadow.empty() || offset + size > m_size) {
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Error,
+        "Shadow write outside of the buffer or buffer is not shadowed");
+    return;
+  }
+
+  // Compare chunk by chunk, copying only the ones that changed
+  auto src = (const uint8_t *)data - offset;
+  auto end = offset + size;
+  auto chunk = offset / m_shadowGranularity;
+  for (auto begin = offset; begin < end; ++chunk) {
+    auto stop = std::min(end, (chunk + 1) * m_shadowGranularity);
+    if (bytesDiffer(&m_shadow[begin], src + begin, stop - begin)) {
+      memcpy(&m_shadow[begin], src + begin, stop - begin);
+      m_dirtyChunks[chunk / 64] |= 1ull << (chunk % 64);
+    }
+    begin = stop;
+  }
+}
+
+void vdu::Buffer::markDirty(VkDeviceSize offset, VkDeviceSize size) {
+  if (size == 0 || m_dirtyChunks.empty())
+    return;
+  auto last = std::min(offset + size, m_size) - 1;
+  for (auto chunk = offset / m_shadowGranularity;
+       chunk <= last / m_shadowGranularity; ++chunk)
+    m_dirtyChunks[chunk / 64] |= 1ull << (chunk % 64);
+}
+
+VkDeviceSize vdu::Buffer::uploadDirty(UploadManager *uploader) {
+  if (m_shadow.empty() || m_dirtyChunks.empty()) {
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Error,
+        "Uploading dirty chunks of a buffer that is not shadowed");
+    return 0;
+  }
+
+  auto isDirty = [&](VkDeviceSize chunk) {
+    return (m_dirtyChunks[chunk / 64] >> (chunk % 64)) & 1;
+  };
+  auto chunkCount = (m_size + m_shadowGranularity - 1) / m_shadowGranularity;
+  auto mergeChunks = std::max<VkDeviceSize>(
+      1, shadowMergeGap / m_shadowGranularity);
+
+  VkDeviceSize queued = 0;
+  VkDeviceSize chunk = 0;
+  while (chunk < chunkCount) {
+    // Whole clean words are skipped at once
+    if (m_dirtyChunks[chunk / 64] >> (chunk % 64) == 0) {
+      chunk = (chunk / 64 + 1) * 64;
+      continue;
+    }
+    if (!isDirty(chunk)) {
+      ++chunk;
+      continue;
+    }
+
+    auto first = chunk;
+    auto last = chunk;
+    for (auto next = chunk + 1;
+         next < chunkCount && next - last <= mergeChunks; ++next)
+      if (isDirty(next))
+        last = next;
+
+    auto offset = first * m_shadowGranularity;
+    auto size = std::min(m_size, (last + 1) * m_shadowGranularity) - offset;
+    if (!uploader->uploadBuffer(this, &m_shadow[offset], size, offset))
+      break;
+    for (auto c = first; c <= last; ++c)
+      m_dirtyChunks[c / 64] &= ~(1ull << (c % 64));
+    queued += size;
+    chunk = last + 1;
+  }
+  return queued;
+}
+
+VkDeviceSize vdu::Buffer::getDirtyBytes() {
+  if (m_dirtyChunks.empty())
+    return 0;
+  VkDeviceSize chunks = 0;
+  for (auto word : m_dirtyChunks)
+    chunks += std::bitset<64>(word).count();
+  auto bytes = chunks * m_shadowGranularity;
+
+  // The last chunk may be partial
+  auto lastChunk = (m_size - 1) / m_shadowGranularity;
+  if ((m_dirtyChunks[lastChunk / 64] >> (lastChunk % 64)) & 1)
+    bytes -= (lastChunk + 1) * m_shadowGranularity - m_size;
+  return bytes;
 }
 
 void vdu::Buffer::bindMemory(DeviceMemory *memory) {
+  m_deviceMemory = memory;
   VDU_VK_CHECK_RESULT(vkBindBufferMemory(m_logicalDevice->getHandle(), m_buffer,
-                                         memory->getHandle(), 0),
+                                         memory->getHandle(),
+                                         memory->getOffset()),
                       "binding buffer memory");
 }
 
@@ -145,9 +448,9 @@ void vdu::Buffer::cmdCopyTo(CommandBuffer *cmd, Buffer *dst, VkDeviceSize range,
 void vdu::Buffer::cmdCopyTo(CommandBuffer *cmd, Texture *dst,
                             VkDeviceSize srcOffset, int mipLevel, int baseLayer,
                             int layerCount, VkOffset3D offset,
-                            VkExtent3D extent) {
+                            VkExtent3D extent, VkDeviceSize rowPitch) {
   cmdCopyTo(cmd->getHandle(), dst, srcOffset, mipLevel, baseLayer, layerCount,
-            offset, extent);
+            offset, extent, rowPitch);
 }
 
 void vdu::Buffer::cmdCopyTo(const VkCommandBuffer &commandBuffer, Buffer *dst,
@@ -157,7 +460,7 @@ void vdu::Buffer::cmdCopyTo(const VkCommandBuffer &commandBuffer, Buffer *dst,
   copyRegion.srcOffset = srcOffset;
   copyRegion.dstOffset = dstOffset;
   if (range == 0)
-    range = m_deviceMemory->getSize();
+    range = m_size;
   copyRegion.size = range;
   vkCmdCopyBuffer(commandBuffer, m_buffer, dst->getHandle(), 1, &copyRegion);
 }
@@ -165,19 +468,31 @@ void vdu::Buffer::cmdCopyTo(const VkCommandBuffer &commandBuffer, Buffer *dst,
 void vdu::Buffer::cmdCopyTo(const VkCommandBuffer &commandBuffer, Texture *dst,
                             VkDeviceSize srcOffset, int mipLevel, int baseLayer,
                             int layerCount, VkOffset3D offset,
-                            VkExtent3D extent) {
+                            VkExtent3D extent, VkDeviceSize rowPitch) {
   if (extent.depth == 0)
     extent.depth = 1;
   if (extent.width == 0)
-    extent.width = dst->getWidth();
+    extent.width = std::max(1u, dst->getWidth() >> mipLevel);
   if (extent.height == 0)
-    extent.height = dst->getHeight();
+    extent.height = std::max(1u, dst->getHeight() >> mipLevel);
+
+  // A single region copies one aspect, combined formats take the depth here
+  auto aspect = dst->getAspectFlags();
+  if (aspect & VK_IMAGE_ASPECT_DEPTH_BIT)
+    aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+
+  // Row lengths are given in texels, a whole number of blocks
+  auto &info = dst->getFormatInfo();
+  auto blockSize = dst->getAspectTexelSize(VkImageAspectFlagBits(aspect));
+  uint32_t rowLength = 0;
+  if (rowPitch && blockSize)
+    rowLength = uint32_t(rowPitch / blockSize) * info.blockWidth;
 
   VkBufferImageCopy region = {};
   region.bufferOffset = srcOffset;
-  region.bufferRowLength = 0;
+  region.bufferRowLength = rowLength;
   region.bufferImageHeight = 0;
-  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.aspectMask = aspect;
   region.imageSubresource.mipLevel = mipLevel;
   region.imageSubresource.baseArrayLayer = baseLayer;
   region.imageSubresource.layerCount = layerCount;
@@ -192,7 +507,7 @@ void vdu::Buffer::createStaging(Buffer &staging) {
   staging.setMemoryProperty(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
   staging.setUsage(VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
 
-  staging.create(m_logicalDevice, m_deviceMemory->getSize());
+  staging.create(m_logicalDevice, m_size);
 }
 
 void vdu::Buffer::createStaging(Buffer &staging, VkDeviceSize size) {
@@ -213,9 +528,36 @@ void vdu::Buffer::createStaging(LogicalDevice *logicalDevice,
 void vdu::Texture::create(LogicalDevice *logicalDevice) {
   m_logicalDevice = logicalDevice;
 
+  m_image = createImage();
+  if (!m_image)
+    return;
+
+  auto allocator = m_logicalDevice->getMemoryAllocator();
+  VkMemoryRequirements memRequirements;
+  MemoryAllocator::DedicatedInfo dedicated;
+  allocator->getImageMemoryRequirements(m_image, memRequirements, dedicated);
+
+  auto resourceType = m_tiling == VK_IMAGE_TILING_LINEAR
+                          ? MemoryAllocator::Linear
+                          : MemoryAllocator::Optimal;
+  DeviceMemory *memory;
+  if (m_memoryUsage != MemoryUsage::Unknown)
+    memory = allocator->allocate(memRequirements, m_memoryUsage, resourceType,
+                                 &dedicated);
+  else
+    memory = allocator->allocate(memRequirements, m_memoryProperties,
+                                 resourceType, &dedicated);
+  if (!memory)
+    return;
+  bindMemory(memory);
+
+  m_imageView = createView(m_image);
+}
+
+VkImage vdu::Texture::createImage() {
   VkImageCreateInfo imageInfo = {};
   imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.imageType = m_depth > 1 ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D;
   imageInfo.extent.width = m_width;
   imageInfo.extent.height = m_height;
   imageInfo.extent.depth = m_depth;
@@ -229,37 +571,57 @@ void vdu::Texture::create(LogicalDevice *logicalDevice) {
   imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
   if (m_layers == 6) /// TODO: is this always true ?
     imageInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+  // sRGB formats are not storable, compute writes go through a UNORM view
+  if ((m_usageFlags & VK_IMAGE_USAGE_STORAGE_BIT) && getFormatInfo().srgb)
+    imageInfo.flags |= VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT;
+
+  // Host transfers need the extension and a format supporting the usage
+  m_hostCopyable = false;
+#ifdef VK_EXT_host_image_copy
+  if (m_hostTransfer && m_logicalDevice->isHostImageCopyEnabled()) {
+    auto usage = imageInfo.usage | VK_IMAGE_USAGE_HOST_TRANSFER_BIT_EXT;
+    VkImageFormatProperties formatProperties;
+    if (vkGetPhysicalDeviceImageFormatProperties(
+            m_logicalDevice->getPhysicalDevice()->getHandle(), m_format,
+            imageInfo.imageType, m_tiling, usage, imageInfo.flags,
+            &formatProperties) == VK_SUCCESS) {
+      imageInfo.usage = usage;
+      m_hostCopyable = true;
+    }
+  }
+#endif
 
-  VDU_VK_CHECK_RESULT(vkCreateImage(m_logicalDevice->getHandle(), &imageInfo,
-                                    nullptr, &m_image),
-                      "creating image");
-
-  VkMemoryRequirements memRequirements;
-  vkGetImageMemoryRequirements(m_logicalDevice->getHandle(), m_image,
-                               &memRequirements);
-
-  m_deviceMemory = new DeviceMemory;
-  m_deviceMemory->allocate(m_logicalDevice, memRequirements.size,
-                           m_memoryProperties, memRequirements);
-  bindMemory(m_deviceMemory);
+  VkImage image = 0;
+  VDU_VK_CHECK_RESULT(
+      vkCreateImage(m_logicalDevice->getHandle(), &imageInfo, nullptr, &image),
+      "creating image");
+  return image;
+}
 
+VkImageView vdu::Texture::createView(VkImage image) {
   VkImageViewCreateInfo viewInfo = {};
   viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-  viewInfo.image = m_image;
+  viewInfo.image = image;
   viewInfo.format = m_format;
   viewInfo.subresourceRange.aspectMask = m_aspectFlags;
   viewInfo.subresourceRange.baseMipLevel = 0;
   viewInfo.subresourceRange.levelCount = m_numMipLevels;
   viewInfo.subresourceRange.baseArrayLayer = 0;
   viewInfo.subresourceRange.layerCount = m_layers;
-  if (m_layers == 6)
+  if (m_depth > 1)
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_3D;
+  else if (m_layers == 6)
     viewInfo.viewType = VK_IMAGE_VIEW_TYPE_CUBE;
+  else if (m_layers > 1)
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
   else
     viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
 
+  VkImageView imageView = 0;
   VDU_VK_CHECK_RESULT(vkCreateImageView(m_logicalDevice->getHandle(), &viewInfo,
-                                        nullptr, &m_imageView),
+                                        nullptr, &imageView),
                       "creating image view");
+  return imageView;
 }
 
 void vdu::Texture::setProperties(const TextureCreateInfo &ci) {
@@ -275,6 +637,10 @@ void vdu::Texture::setProperties(const TextureCreateInfo &ci) {
   m_usageFlags = ci.usageFlags;
   m_tiling = ci.tiling;
   m_memoryProperties = ci.memoryProperties;
+  m_memoryUsage = ci.memoryUsage;
+  m_hostTransfer = ci.hostTransfer;
+  if (m_memoryUsage == MemoryUsage::Unknown && isTransient())
+    m_memoryUsage = MemoryUsage::GpuLazy;
 }
 
 void vdu::Texture::destroy() {
@@ -282,10 +648,20 @@ void vdu::Texture::destroy() {
     return;
   vkDestroyImageView(m_logicalDevice->getHandle(), m_imageView, nullptr);
   vkDestroyImage(m_logicalDevice->getHandle(), m_image, nullptr);
-  m_deviceMemory->free();
+  m_logicalDevice->getMemoryAllocator()->free(m_deviceMemory);
+  m_deviceMemory = nullptr;
 }
 
 void vdu::Texture::cmdGenerateMipMaps(const VkCommandBuffer &cmd) {
+  // Formats without linear filtering support still get (nearest) mips
+  auto filter = VK_FILTER_LINEAR;
+  if (m_logicalDevice->getPhysicalDevice()->findSupportedFormat(
+          {m_format}, m_tiling,
+          VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ==
+      VK_FORMAT_UNDEFINED)
+    filter = VK_FILTER_NEAREST;
+
+  // Every barrier and blit covers all layers at once
   VkImageMemoryBarrier barrier = {};
   barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
   barrier.image = m_image;
@@ -295,63 +671,66 @@ void vdu::Texture::cmdGenerateMipMaps(const VkCommandBuffer &cmd) {
   barrier.subresourceRange.baseArrayLayer = 0;
   barrier.subresourceRange.layerCount = getLayers();
   barrier.subresourceRange.levelCount = 1;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+  VkImageBlit blit = {};
+  blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  blit.srcSubresource.baseArrayLayer = 0;
+  blit.srcSubresource.layerCount = getLayers();
+  blit.dstSubresource = blit.srcSubresource;
 
   int32_t mipWidth = m_width;
   int32_t mipHeight = m_height;
+  int32_t mipDepth = m_depth;
 
   for (uint32_t i = 1; i < m_numMipLevels; i++) {
     barrier.subresourceRange.baseMipLevel = i - 1;
-    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-
     vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
                          VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
                          nullptr, 1, &barrier);
 
-    VkImageBlit blit = {};
+    // Odd sizes round down, the blit filters over the whole source
     blit.srcOffsets[0] = {0, 0, 0};
-    blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
-    blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.srcOffsets[1] = {mipWidth, mipHeight, mipDepth};
     blit.srcSubresource.mipLevel = i - 1;
-    blit.srcSubresource.baseArrayLayer = 0;
-    blit.srcSubresource.layerCount = 1;
+    mipWidth = std::max(1, mipWidth / 2);
+    mipHeight = std::max(1, mipHeight / 2);
+    mipDepth = std::max(1, mipDepth / 2);
     blit.dstOffsets[0] = {0, 0, 0};
-    blit.dstOffsets[1] = {mipWidth / 2, mipHeight / 2, 1};
-    blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.dstOffsets[1] = {mipWidth, mipHeight, mipDepth};
     blit.dstSubresource.mipLevel = i;
-    blit.dstSubresource.baseArrayLayer = 0;
-    blit.dstSubresource.layerCount = 1;
 
     vkCmdBlitImage(cmd, m_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_image,
-                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
-                   VK_FILTER_LINEAR);
-
-    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr,
-                         0, nullptr, 1, &barrier);
-
-    if (mipWidth > 1)
-      mipWidth /= 2;
-    if (mipHeight > 1)
-      mipHeight /= 2;
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, filter);
   }
 
-  barrier.subresourceRange.baseMipLevel = m_maxMipLevel;
-  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-  barrier.newLayout = m_layout;
-  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
+  // The source mips and the last mip go to the texture's layout together
+  auto finalLayout = m_layout;
+  if (finalLayout == VK_IMAGE_LAYOUT_UNDEFINED)
+    finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  VkImageMemoryBarrier finalBarriers[2] = {barrier, barrier};
+  finalBarriers[0].subresourceRange.baseMipLevel = 0;
+  finalBarriers[0].subresourceRange.levelCount = m_maxMipLevel;
+  finalBarriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  finalBarriers[0].newLayout = finalLayout;
+  finalBarriers[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  finalBarriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  finalBarriers[1].subresourceRange.baseMipLevel = m_maxMipLevel;
+  finalBarriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  finalBarriers[1].newLayout = finalLayout;
+  finalBarriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  finalBarriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  uint32_t barrierCount = m_maxMipLevel ? 2 : 1;
   vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0,
-                       nullptr, 1, &barrier);
+                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0,
+                       nullptr, barrierCount,
+                       finalBarriers + (m_maxMipLevel ? 0 : 1));
 }
 
 void vdu::Texture::cmdGenerateMipMaps(CommandBuffer *cmd) {
@@ -359,300 +738,185 @@ void vdu::Texture::cmdGenerateMipMaps(CommandBuffer *cmd) {
 }
 
 void vdu::Texture::bindMemory(DeviceMemory *memory) {
+  m_deviceMemory = memory;
   VDU_VK_CHECK_RESULT(vkBindImageMemory(m_logicalDevice->getHandle(), m_image,
-                                        m_deviceMemory->getHandle(), 0),
+                                        memory->getHandle(),
+                                        memory->getOffset()),
                       "binding texture memory");
 }
 
 uint32_t vdu::Texture::getBitsPerPixel() {
-  switch (m_format) {
-  case (VK_FORMAT_R4G4_UNORM_PACK8):
-  case (VK_FORMAT_R8_UNORM):
-  case (VK_FORMAT_R8_SNORM):
-  case (VK_FORMAT_R8_USCALED):
-  case (VK_FORMAT_R8_SSCALED):
-  case (VK_FORMAT_R8_UINT):
-  case (VK_FORMAT_R8_SINT):
-  case (VK_FORMAT_R8_SRGB):
-    return 8;
-
-  case (VK_FORMAT_R4G4B4A4_UNORM_PACK16):
-  case (VK_FORMAT_B4G4R4A4_UNORM_PACK16):
-  case (VK_FORMAT_R5G5B5A1_UNORM_PACK16):
-  case (VK_FORMAT_B5G5R5A1_UNORM_PACK16):
-  case (VK_FORMAT_A1R5G5B5_UNORM_PACK16):
-  case (VK_FORMAT_R5G6B5_UNORM_PACK16):
-  case (VK_FORMAT_B5G6R5_UNORM_PACK16):
-  case (VK_FORMAT_R8G8_UNORM):
-  case (VK_FORMAT_R8G8_SNORM):
-  case (VK_FORMAT_R8G8_USCALED):
-  case (VK_FORMAT_R8G8_SSCALED):
-  case (VK_FORMAT_R8G8_UINT):
-  case (VK_FORMAT_R8G8_SINT):
-  case (VK_FORMAT_R8G8_SRGB):
-  case (VK_FORMAT_R16_UNORM):
-  case (VK_FORMAT_R16_SNORM):
-  case (VK_FORMAT_R16_USCALED):
-  case (VK_FORMAT_R16_SSCALED):
-  case (VK_FORMAT_R16_UINT):
-  case (VK_FORMAT_R16_SINT):
-  case (VK_FORMAT_R16_SFLOAT):
-    return 16;
-
-  case (VK_FORMAT_R8G8B8_UNORM):
-  case (VK_FORMAT_R8G8B8_SNORM):
-  case (VK_FORMAT_R8G8B8_USCALED):
-  case (VK_FORMAT_R8G8B8_SSCALED):
-  case (VK_FORMAT_R8G8B8_UINT):
-  case (VK_FORMAT_R8G8B8_SINT):
-  case (VK_FORMAT_R8G8B8_SRGB):
-  case (VK_FORMAT_B8G8R8_UNORM):
-  case (VK_FORMAT_B8G8R8_SNORM):
-  case (VK_FORMAT_B8G8R8_USCALED):
-  case (VK_FORMAT_B8G8R8_SSCALED):
-  case (VK_FORMAT_B8G8R8_UINT):
-  case (VK_FORMAT_B8G8R8_SINT):
-  case (VK_FORMAT_B8G8R8_SRGB):
-    return 24;
-
-  case (VK_FORMAT_R8G8B8A8_UNORM):
-  case (VK_FORMAT_R8G8B8A8_SNORM):
-  case (VK_FORMAT_R8G8B8A8_USCALED):
-  case (VK_FORMAT_R8G8B8A8_SSCALED):
-  case (VK_FORMAT_R8G8B8A8_UINT):
-  case (VK_FORMAT_R8G8B8A8_SINT):
-  case (VK_FORMAT_R8G8B8A8_SRGB):
-  case (VK_FORMAT_B8G8R8A8_UNORM):
-  case (VK_FORMAT_B8G8R8A8_SNORM):
-  case (VK_FORMAT_B8G8R8A8_USCALED):
-  case (VK_FORMAT_B8G8R8A8_SSCALED):
-  case (VK_FORMAT_B8G8R8A8_UINT):
-  case (VK_FORMAT_B8G8R8A8_SINT):
-  case (VK_FORMAT_B8G8R8A8_SRGB):
-  case (VK_FORMAT_A8B8G8R8_UNORM_PACK32):
-  case (VK_FORMAT_A8B8G8R8_SNORM_PACK32):
-  case (VK_FORMAT_A8B8G8R8_USCALED_PACK32):
-  case (VK_FORMAT_A8B8G8R8_SSCALED_PACK32):
-  case (VK_FORMAT_A8B8G8R8_UINT_PACK32):
-  case (VK_FORMAT_A8B8G8R8_SINT_PACK32):
-  case (VK_FORMAT_A8B8G8R8_SRGB_PACK32):
-  case (VK_FORMAT_A2R10G10B10_UNORM_PACK32):
-  case (VK_FORMAT_A2R10G10B10_SNORM_PACK32):
-  case (VK_FORMAT_A2R10G10B10_USCALED_PACK32):
-  case (VK_FORMAT_A2R10G10B10_SSCALED_PACK32):
-  case (VK_FORMAT_A2R10G10B10_UINT_PACK32):
-  case (VK_FORMAT_A2R10G10B10_SINT_PACK32):
-  case (VK_FORMAT_A2B10G10R10_UNORM_PACK32):
-  case (VK_FORMAT_A2B10G10R10_SNORM_PACK32):
-  case (VK_FORMAT_A2B10G10R10_USCALED_PACK32):
-  case (VK_FORMAT_A2B10G10R10_SSCALED_PACK32):
-  case (VK_FORMAT_A2B10G10R10_UINT_PACK32):
-  case (VK_FORMAT_A2B10G10R10_SINT_PACK32):
-  case (VK_FORMAT_R16G16_UNORM):
-  case (VK_FORMAT_R16G16_SNORM):
-  case (VK_FORMAT_R16G16_USCALED):
-  case (VK_FORMAT_R16G16_SSCALED):
-  case (VK_FORMAT_R16G16_UINT):
-  case (VK_FORMAT_R16G16_SINT):
-  case (VK_FORMAT_R16G16_SFLOAT):
-  case (VK_FORMAT_B10G11R11_UFLOAT_PACK32):
-  case (VK_FORMAT_E5B9G9R9_UFLOAT_PACK32):
-  case (VK_FORMAT_R32_UINT):
-  case (VK_FORMAT_R32_SINT):
-  case (VK_FORMAT_R32_SFLOAT):
-  case (VK_FORMAT_D32_SFLOAT):
-    return 32;
-
-  case (VK_FORMAT_R16G16B16_UNORM):
-  case (VK_FORMAT_R16G16B16_SNORM):
-  case (VK_FORMAT_R16G16B16_USCALED):
-  case (VK_FORMAT_R16G16B16_SSCALED):
-  case (VK_FORMAT_R16G16B16_UINT):
-  case (VK_FORMAT_R16G16B16_SINT):
-  case (VK_FORMAT_R16G16B16_SFLOAT):
-    return 48;
-
-  case (VK_FORMAT_R16G16B16A16_UNORM):
-  case (VK_FORMAT_R16G16B16A16_SNORM):
-  case (VK_FORMAT_R16G16B16A16_USCALED):
-  case (VK_FORMAT_R16G16B16A16_SSCALED):
-  case (VK_FORMAT_R16G16B16A16_UINT):
-  case (VK_FORMAT_R16G16B16A16_SINT):
-  case (VK_FORMAT_R16G16B16A16_SFLOAT):
-  case (VK_FORMAT_R32G32_UINT):
-  case (VK_FORMAT_R32G32_SINT):
-  case (VK_FORMAT_R32G32_SFLOAT):
-  case (VK_FORMAT_R64_UINT):
-  case (VK_FORMAT_R64_SINT):
-  case (VK_FORMAT_R64_SFLOAT):
-    return 64;
-
-  case (VK_FORMAT_R32G32B32_UINT):
-  case (VK_FORMAT_R32G32B32_SINT):
-  case (VK_FORMAT_R32G32B32_SFLOAT):
-    return 96;
-
-  case (VK_FORMAT_R32G32B32A32_UINT):
-  case (VK_FORMAT_R32G32B32A32_SINT):
-  case (VK_FORMAT_R32G32B32A32_SFLOAT):
-  case (VK_FORMAT_R64G64_UINT):
-  case (VK_FORMAT_R64G64_SINT):
-  case (VK_FORMAT_R64G64_SFLOAT):
-    return 128;
-
-  case (VK_FORMAT_R64G64B64_UINT):
-  case (VK_FORMAT_R64G64B64_SINT):
-  case (VK_FORMAT_R64G64B64_SFLOAT):
-    return 192;
-
-  case (VK_FORMAT_R64G64B64A64_UINT):
-  case (VK_FORMAT_R64G64B64A64_SINT):
-  case (VK_FORMAT_R64G64B64A64_SFLOAT):
-    return 256;
+  auto &info = vdu::getFormatInfo(m_format);
+  return info.isCompressed() ? 0 : info.bytesPerBlock * 8;
+}
 
-  default:
-    return 0;
-  };
+bool vdu::Texture::isTransient() {
+  return m_usageFlags != VK_IMAGE_USAGE_FLAG_BITS_MAX_ENUM &&
+         (m_usageFlags & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT);
 }
 
 uint32_t vdu::Texture::getBytesPerPixel() { return getBitsPerPixel() / 8; }
 
 uint32_t vdu::Texture::getNumComponents() {
-  switch (m_format) {
-  case (VK_FORMAT_R8_UNORM):
-  case (VK_FORMAT_R8_SNORM):
-  case (VK_FORMAT_R8_USCALED):
-  case (VK_FORMAT_R8_SSCALED):
-  case (VK_FORMAT_R8_UINT):
-  case (VK_FORMAT_R8_SINT):
-  case (VK_FORMAT_R8_SRGB):
-  case (VK_FORMAT_R16_UNORM):
-  case (VK_FORMAT_R16_SNORM):
-  case (VK_FORMAT_R16_USCALED):
-  case (VK_FORMAT_R16_SSCALED):
-  case (VK_FORMAT_R16_UINT):
-  case (VK_FORMAT_R16_SINT):
-  case (VK_FORMAT_R16_SFLOAT):
-  case (VK_FORMAT_R32_UINT):
-  case (VK_FORMAT_R32_SINT):
-  case (VK_FORMAT_R32_SFLOAT):
-  case (VK_FORMAT_D32_SFLOAT):
-  case (VK_FORMAT_R64_UINT):
-  case (VK_FORMAT_R64_SINT):
-  case (VK_FORMAT_R64_SFLOAT):
-    return 1;
+  return vdu::getFormatInfo(m_format).componentCount;
+}
 
-  case (VK_FORMAT_R4G4_UNORM_PACK8):
-  case (VK_FORMAT_R8G8_UNORM):
-  case (VK_FORMAT_R8G8_SNORM):
-  case (VK_FORMAT_R8G8_USCALED):
-  case (VK_FORMAT_R8G8_SSCALED):
-  case (VK_FORMAT_R8G8_UINT):
-  case (VK_FORMAT_R8G8_SINT):
-  case (VK_FORMAT_R8G8_SRGB):
-  case (VK_FORMAT_R16G16_UNORM):
-  case (VK_FORMAT_R16G16_SNORM):
-  case (VK_FORMAT_R16G16_USCALED):
-  case (VK_FORMAT_R16G16_SSCALED):
-  case (VK_FORMAT_R16G16_UINT):
-  case (VK_FORMAT_R16G16_SINT):
-  case (VK_FORMAT_R16G16_SFLOAT):
-  case (VK_FORMAT_R32G32_UINT):
-  case (VK_FORMAT_R32G32_SINT):
-  case (VK_FORMAT_R32G32_SFLOAT):
-  case (VK_FORMAT_R64G64_UINT):
-  case (VK_FORMAT_R64G64_SINT):
-  case (VK_FORMAT_R64G64_SFLOAT):
-    return 2;
-
-  case (VK_FORMAT_R5G6B5_UNORM_PACK16):
-  case (VK_FORMAT_B5G6R5_UNORM_PACK16):
-  case (VK_FORMAT_R8G8B8_UNORM):
-  case (VK_FORMAT_R8G8B8_SNORM):
-  case (VK_FORMAT_R8G8B8_USCALED):
-  case (VK_FORMAT_R8G8B8_SSCALED):
-  case (VK_FORMAT_R8G8B8_UINT):
-  case (VK_FORMAT_R8G8B8_SINT):
-  case (VK_FORMAT_R8G8B8_SRGB):
-  case (VK_FORMAT_B8G8R8_UNORM):
-  case (VK_FORMAT_B8G8R8_SNORM):
-  case (VK_FORMAT_B8G8R8_USCALED):
-  case (VK_FORMAT_B8G8R8_SSCALED):
-  case (VK_FORMAT_B8G8R8_UINT):
-  case (VK_FORMAT_B8G8R8_SINT):
-  case (VK_FORMAT_B8G8R8_SRGB):
-  case (VK_FORMAT_B10G11R11_UFLOAT_PACK32):
-  case (VK_FORMAT_R16G16B16_UNORM):
-  case (VK_FORMAT_R16G16B16_SNORM):
-  case (VK_FORMAT_R16G16B16_USCALED):
-  case (VK_FORMAT_R16G16B16_SSCALED):
-  case (VK_FORMAT_R16G16B16_UINT):
-  case (VK_FORMAT_R16G16B16_SINT):
-  case (VK_FORMAT_R16G16B16_SFLOAT):
-  case (VK_FORMAT_R32G32B32_UINT):
-  case (VK_FORMAT_R32G32B32_SINT):
-  case (VK_FORMAT_R32G32B32_SFLOAT):
-  case (VK_FORMAT_R64G64B64_UINT):
-  case (VK_FORMAT_R64G64B64_SINT):
-  case (VK_FORMAT_R64G64B64_SFLOAT):
-    return 3;
-
-  case (VK_FORMAT_R4G4B4A4_UNORM_PACK16):
-  case (VK_FORMAT_B4G4R4A4_UNORM_PACK16):
-  case (VK_FORMAT_R5G5B5A1_UNORM_PACK16):
-  case (VK_FORMAT_B5G5R5A1_UNORM_PACK16):
-  case (VK_FORMAT_A1R5G5B5_UNORM_PACK16):
-  case (VK_FORMAT_R8G8B8A8_UNORM):
-  case (VK_FORMAT_R8G8B8A8_SNORM):
-  case (VK_FORMAT_R8G8B8A8_USCALED):
-  case (VK_FORMAT_R8G8B8A8_SSCALED):
-  case (VK_FORMAT_R8G8B8A8_UINT):
-  case (VK_FORMAT_R8G8B8A8_SINT):
-  case (VK_FORMAT_R8G8B8A8_SRGB):
-  case (VK_FORMAT_B8G8R8A8_UNORM):
-  case (VK_FORMAT_B8G8R8A8_SNORM):
-  case (VK_FORMAT_B8G8R8A8_USCALED):
-  case (VK_FORMAT_B8G8R8A8_SSCALED):
-  case (VK_FORMAT_B8G8R8A8_UINT):
-  case (VK_FORMAT_B8G8R8A8_SINT):
-  case (VK_FORMAT_B8G8R8A8_SRGB):
-  case (VK_FORMAT_A8B8G8R8_UNORM_PACK32):
-  case (VK_FORMAT_A8B8G8R8_SNORM_PACK32):
-  case (VK_FORMAT_A8B8G8R8_USCALED_PACK32):
-  case (VK_FORMAT_A8B8G8R8_SSCALED_PACK32):
-  case (VK_FORMAT_A8B8G8R8_UINT_PACK32):
-  case (VK_FORMAT_A8B8G8R8_SINT_PACK32):
-  case (VK_FORMAT_A8B8G8R8_SRGB_PACK32):
-  case (VK_FORMAT_A2R10G10B10_UNORM_PACK32):
-  case (VK_FORMAT_A2R10G10B10_SNORM_PACK32):
-  case (VK_FORMAT_A2R10G10B10_USCALED_PACK32):
-  case (VK_FORMAT_A2R10G10B10_SSCALED_PACK32):
-  case (VK_FORMAT_A2R10G10B10_UINT_PACK32):
-  case (VK_FORMAT_A2R10G10B10_SINT_PACK32):
-  case (VK_FORMAT_A2B10G10R10_UNORM_PACK32):
-  case (VK_FORMAT_A2B10G10R10_SNORM_PACK32):
-  case (VK_FORMAT_A2B10G10R10_USCALED_PACK32):
-  case (VK_FORMAT_A2B10G10R10_SSCALED_PACK32):
-  case (VK_FORMAT_A2B10G10R10_UINT_PACK32):
-  case (VK_FORMAT_A2B10G10R10_SINT_PACK32):
-  case (VK_FORMAT_R16G16B16A16_UNORM):
-  case (VK_FORMAT_R16G16B16A16_SNORM):
-  case (VK_FORMAT_R16G16B16A16_USCALED):
-  case (VK_FORMAT_R16G16B16A16_SSCALED):
-  case (VK_FORMAT_R16G16B16A16_UINT):
-  case (VK_FORMAT_R16G16B16A16_SINT):
-  case (VK_FORMAT_R16G16B16A16_SFLOAT):
-  case (VK_FORMAT_R32G32B32A32_UINT):
-  case (VK_FORMAT_R32G32B32A32_SINT):
-  case (VK_FORMAT_R32G32B32A32_SFLOAT):
-  case (VK_FORMAT_R64G64B64A64_UINT):
-  case (VK_FORMAT_R64G64B64A64_SINT):
-  case (VK_FORMAT_R64G64B64A64_SFLOAT):
-    return 4;
+vdu::TextureUploadLayout
+vdu::Texture::getPackedLayout(uint32_t baseMipLevel, uint32_t mipCount,
+                              uint32_t baseLayer, uint32_t layerCount,
+                              VkOffset3D offset, VkExtent3D extent) {
+  TextureUploadLayout layout;
+  layout.baseMipLevel = baseMipLevel;
+  layout.baseLayer = baseLayer;
+  layout.layerCount = layerCount ? layerCount : m_layers - baseLayer;
+  layout.offset = offset;
+  layout.extent = extent;
+  if (mipCount == 0)
+    mipCount = m_numMipLevels - baseMipLevel;
+
+  auto colourSize = getAspectTexelSize(VK_IMAGE_ASPECT_COLOR_BIT);
+  auto depthSize = getAspectTexelSize(VK_IMAGE_ASPECT_DEPTH_BIT);
+  auto stencilSize = getAspectTexelSize(VK_IMAGE_ASPECT_STENCIL_BIT);
+  auto texelSize = (m_aspectFlags & VK_IMAGE_ASPECT_DEPTH_BIT) ? depthSize
+                                                               : colourSize;
+  if (texelSize == 0) {
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Error,
+        "Packed upload layouts need a known block size");
+    return layout;
+  }
 
-  default:
-    return 0;
+  // Region offsets must be multiples of 4 and of the block size
+  auto alignTo = [](VkDeviceSize offset, VkDeviceSize alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
   };
+  auto alignment = VkDeviceSize(texelSize);
+  while (alignment % 4)
+    alignment += texelSize;
+
+  auto &info = getFormatInfo();
+  VkDeviceSize size = 0;
+  layout.mips.resize(mipCount);
+  for (uint32_t i = 0; i < mipCount; ++i) {
+    VkOffset3D mipOffset;
+    VkExtent3D mipExtent;
+    getUploadRegion(layout, i, mipOffset, mipExtent);
+    VkDeviceSize blocks =
+        VkDeviceSize(info.getBlockCount(mipExtent.width, info.blockWidth)) *
+        info.getBlockCount(mipExtent.height, info.blockHeight) *
+        mipExtent.depth * layout.layerCount;
+
+    auto &mip = layout.mips[i];
+    mip.offset = alignTo(size, alignment);
+    size = mip.offset + blocks * texelSize;
+    if ((m_aspectFlags & VK_IMAGE_ASPECT_DEPTH_BIT) &&
+        (m_aspectFlags & VK_IMAGE_ASPECT_STENCIL_BIT)) {
+      mip.stencilOffset = alignTo(size, 4);
+      size = mip.stencilOffset + blocks * stencilSize;
+    }
+  }
+  layout.size = size;
+  return layout;
+}
+
+void vdu::Texture::getUploadRegions(const TextureUploadLayout &layout,
+                                    std::vector<VkBufferImageCopy> &regions,
+                                    VkDeviceSize bufferOffset) {
+  for (uint32_t i = 0; i < layout.mips.size(); ++i) {
+    auto &mip = layout.mips[i];
+    VkBufferImageCopy region = {};
+    region.bufferOffset = bufferOffset + mip.offset;
+    region.bufferRowLength = mip.rowLength;
+    region.bufferImageHeight = mip.imageHeight;
+    region.imageSubresource.mipLevel = layout.baseMipLevel + i;
+    region.imageSubresource.baseArrayLayer = layout.baseLayer;
+    region.imageSubresource.layerCount = layout.layerCount;
+    getUploadRegion(layout, i, region.imageOffset, region.imageExtent);
+
+    if (!(m_aspectFlags & VK_IMAGE_ASPECT_DEPTH_BIT)) {
+      region.imageSubresource.aspectMask =
+          m_aspectFlags & ~VK_IMAGE_ASPECT_STENCIL_BIT;
+      if (!region.imageSubresource.aspectMask)
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_STENCIL_BIT;
+      regions.push_back(region);
+      continue;
+    }
+
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    regions.push_back(region);
+    if (m_aspectFlags & VK_IMAGE_ASPECT_STENCIL_BIT) {
+      region.bufferOffset = bufferOffset + mip.stencilOffset;
+      region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_STENCIL_BIT;
+      regions.push_back(region);
+    }
+  }
+}
+
+void vdu::Texture::cmdUpload(CommandBuffer *cmd, Buffer *src,
+                             const TextureUploadLayout &layout,
+                             VkDeviceSize srcOffset) {
+  cmdUpload(cmd->getHandle(), src, layout, srcOffset);
+}
+
+void vdu::Texture::cmdUpload(const VkCommandBuffer &cmd, Buffer *src,
+                             const TextureUploadLayout &layout,
+                             VkDeviceSize srcOffset) {
+  std::vector<VkBufferImageCopy> regions;
+  getUploadRegions(layout, regions, srcOffset);
+  if (regions.empty())
+    return;
+  vkCmdCopyBufferToImage(cmd, src->getHandle(), m_image,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regions.size(),
+                         regions.data());
+}
+
+void vdu::Texture::getUploadRegion(const TextureUploadLayout &layout,
+                                   uint32_t mip, VkOffset3D &offset,
+                                   VkExtent3D &extent) {
+  auto level = layout.baseMipLevel + mip;
+  uint32_t size[3] = {std::max(1u, m_width >> level),
+                      std::max(1u, m_height >> level),
+                      std::max(1u, m_depth >> level)};
+  if (layout.extent.width == 0) {
+    offset = {0, 0, 0};
+    extent = {size[0], size[1], size[2]};
+    return;
+  }
+
+  int32_t begin[3] = {layout.offset.x, layout.offset.y, layout.offset.z};
+  uint32_t length[3] = {layout.extent.width, layout.extent.height,
+                        layout.extent.depth};
+  uint32_t end[3];
+  // Compressed regions start and end on block boundaries or the mip's edge
+  auto &info = getFormatInfo();
+  uint32_t block[3] = {info.blockWidth, info.blockHeight, info.blockDepth};
+  for (int i = 0; i < 3; ++i) {
+    end[i] = (uint32_t(begin[i]) + std::max(1u, length[i]) + (1u << mip) - 1) >>
+             mip;
+    end[i] = std::min((end[i] + block[i] - 1) / block[i] * block[i], size[i]);
+    begin[i] = std::min(uint32_t(begin[i]) >> mip, end[i] - 1);
+    begin[i] -= begin[i] % block[i];
+  }
+  offset = {begin[0], begin[1], begin[2]};
+  extent = {end[0] - begin[0], end[1] - begin[1], end[2] - begin[2]};
+}
+
+uint32_t vdu::Texture::getAspectTexelSize(VkImageAspectFlagBits aspect) {
+  // Depth and stencil planes are copied in their own packed formats
+  if (aspect == VK_IMAGE_ASPECT_STENCIL_BIT)
+    return 1;
+  if (aspect == VK_IMAGE_ASPECT_DEPTH_BIT) {
+    switch (m_format) {
+    case VK_FORMAT_D16_UNORM:
+    case VK_FORMAT_D16_UNORM_S8_UINT:
+      return 2;
+    case VK_FORMAT_S8_UINT:
+      return 0;
+    default:
+      return 4;
+    }
+  }
+  return getFormatInfo().bytesPerBlock;
 }
 
 void vdu::Texture::cmdTransitionLayout(CommandBuffer &cmd,
@@ -751,3 +1015,106 @@ void vdu::Texture::cmdTransitionLayout(CommandBuffer &cmd,
   vkCmdPipelineBarrier(cmd.getHandle(), srcStageMask, dstStageMask, 0, 0,
                        nullptr, 0, nullptr, 1, &imageBarrier);
 }
+
+static bool hasLayout(const std::vector<VkImageLayout> &layouts,
+                      VkImageLayout layout) {
+  return std::find(layouts.begin(), layouts.end(), layout) != layouts.end();
+}
+
+bool vdu::Texture::copyFromMemory(const void *data,
+                                  const TextureUploadLayout &layout,
+                                  VkImageLayout oldLayout,
+                                  VkImageLayout newLayout) {
+#ifdef VK_EXT_host_image_copy
+  auto &hostImageCopy = m_logicalDevice->getHostImageCopy();
+  if (!m_hostCopyable || layout.size == 0 ||
+      !hasLayout(hostImageCopy.dstLayouts, newLayout))
+    return false;
+  bool discard = oldLayout == VK_IMAGE_LAYOUT_UNDEFINED ||
+                 oldLayout == VK_IMAGE_LAYOUT_PREINITIALIZED;
+  if (oldLayout != newLayout && !discard &&
+      !hasLayout(hostImageCopy.srcLayouts, oldLayout))
+    return false;
+
+  if (oldLayout != newLayout) {
+    VkHostImageLayoutTransitionInfoEXT transition = {};
+    transition.sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO_EXT;
+    transition.image = m_image;
+    transition.oldLayout = oldLayout;
+    transition.newLayout = newLayout;
+    transition.subresourceRange.aspectMask = m_aspectFlags;
+    transition.subresourceRange.baseMipLevel = layout.baseMipLevel;
+    transition.subresourceRange.levelCount = layout.mips.size();
+    transition.subresourceRange.baseArrayLayer = layout.baseLayer;
+    transition.subresourceRange.layerCount = layout.layerCount;
+    VDU_VK_CHECK_RESULT(hostImageCopy.transitionImageLayout(
+                            m_logicalDevice->getHandle(), 1, &transition),
+                        "transitioning image layout on the host");
+  }
+
+  // The staging regions with host pointers in place of buffer offsets
+  std::vector<VkBufferImageCopy> regions;
+  getUploadRegions(layout, regions);
+  std::vector<VkMemoryToImageCopyEXT> copies(regions.size());
+  for (size_t i = 0; i < regions.size(); ++i) {
+    auto &copy = copies[i];
+    copy.sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY_EXT;
+    copy.pHostPointer = (const char *)data + regions[i].bufferOffset;
+    copy.memoryRowLength = regions[i].bufferRowLength;
+    copy.memoryImageHeight = regions[i].bufferImageHeight;
+    copy.imageSubresource = regions[i].imageSubresource;
+    copy.imageOffset = regions[i].imageOffset;
+    copy.imageExtent = regions[i].imageExtent;
+  }
+
+  VkCopyMemoryToImageInfoEXT copyInfo = {};
+  copyInfo.sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO_EXT;
+  copyInfo.dstImage = m_image;
+  copyInfo.dstImageLayout = newLayout;
+  copyInfo.regionCount = copies.size();
+  copyInfo.pRegions = copies.data();
+  auto copied =
+      hostImageCopy.copyMemoryToImage(m_logicalDevice->getHandle(), &copyInfo);
+  VDU_VK_CHECK_RESULT(copied, "copying memory to image");
+  return copied == VK_SUCCESS;
+#else
+  return false;
+#endif
+}
+
+bool vdu::Texture::copyToMemory(void *data, const TextureUploadLayout &layout,
+                                VkImageLayout currentLayout) {
+#ifdef VK_EXT_host_image_copy
+  auto &hostImageCopy = m_logicalDevice->getHostImageCopy();
+  if (!m_hostCopyable || layout.size == 0 ||
+      !hasLayout(hostImageCopy.srcLayouts, currentLayout))
+    return false;
+
+  std::vector<VkBufferImageCopy> regions;
+  getUploadRegions(layout, regions);
+  std::vector<VkImageToMemoryCopyEXT> copies(regions.size());
+  for (size_t i = 0; i < regions.size(); ++i) {
+    auto &copy = copies[i];
+    copy.sType = VK_STRUCTURE_TYPE_IMAGE_TO_MEMORY_COPY_EXT;
+    copy.pHostPointer = (char *)data + regions[i].bufferOffset;
+    copy.memoryRowLength = regions[i].bufferRowLength;
+    copy.memoryImageHeight = regions[i].bufferImageHeight;
+    copy.imageSubresource = regions[i].imageSubresource;
+    copy.imageOffset = regions[i].imageOffset;
+    copy.imageExtent = regions[i].imageExtent;
+  }
+
+  VkCopyImageToMemoryInfoEXT copyInfo = {};
+  copyInfo.sType = VK_STRUCTURE_TYPE_COPY_IMAGE_TO_MEMORY_INFO_EXT;
+  copyInfo.srcImage = m_image;
+  copyInfo.srcImageLayout = currentLayout;
+  copyInfo.regionCount = copies.size();
+  copyInfo.pRegions = copies.data();
+  auto copied =
+      hostImageCopy.copyImageToMemory(m_logicalDevice->getHandle(), &copyInfo);
+  VDU_VK_CHECK_RESULT(copied, "copying image to memory");
+  return copied == VK_SUCCESS;
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,70 @@
+#include "HostCopy.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VDU_STREAM_SIMD
+#include <immintrin.h>
+#endif
+
+// Below this the fence costs more than the stores save
+static const size_t minStreamSize = 256;
+
+void vdu::streamCopy(void *dst, const void *src, size_t size) {
+#ifdef VDU_STREAM_SIMD
+  if (size < minStreamSize) {
+    memcpy(dst, src, size);
+    return;
+  }
+
+  auto d = (uint8_t *)dst;
+  auto s = (const uint8_t *)src;
+
+#ifdef __AVX__
+  const size_t alignment = 32;
+#else
+  const size_t alignment = 16;
+#endif
+
+  // Unaligned head with ordinary stores, the body's stores must be aligned
+  size_t head = (alignment - (uintptr_t(d) & (alignment - 1))) & (alignment - 1);
+  memcpy(d, s, head);
+  d += head;
+  s += head;
+  size -= head;
+
+  // A whole 64 byte write-combining line per iteration
+  size_t body = size & ~size_t(63);
+  for (auto end = d + body; d != end; d += 64, s += 64) {
+#ifdef __AVX__
+    auto a = _mm256_loadu_si256((const __m256i *)s);
+    auto b = _mm256_loadu_si256((const __m256i *)(s + 32));
+    _mm256_stream_si256((__m256i *)d, a);
+    _mm256_stream_si256((__m256i *)(d + 32), b);
+#else
+    auto a = _mm_loadu_si128((const __m128i *)s);
+    auto b = _mm_loadu_si128((const __m128i *)(s + 16));
+    auto c = _mm_loadu_si128((const __m128i *)(s + 32));
+    auto e = _mm_loadu_si128((const __m128i *)(s + 48));
+    _mm_stream_si128((__m128i *)d, a);
+    _mm_stream_si128((__m128i *)(d + 16), b);
+    _mm_stream_si128((__m128i *)(d + 32), c);
+    _mm_stream_si128((__m128i *)(d + 48), e);
+#endif
+  }
+  memcpy(d, s, size - body);
+
+  // Non-temporal stores are weakly ordered, make them visible before any
+  // later store (such as a submission) can be observed
+  _mm_sfence();
+#else
+  memcpy(dst, src, size);
+#endif
+}
+
+void vdu::copyToMapped(void *dst, const void *src, size_t size,
+                       VkMemoryPropertyFlags memoryFlags) {
+  if (memoryFlags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT)
+    memcpy(dst, src, size);
+  else
+    streamCopy(dst, src, size);
+}
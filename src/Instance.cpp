@@ -124,8 +124,8 @@ std::vector<vdu::PhysicalDevice> &vdu::Instance::enumratePhysicalDevices() {
 
   // For each handle add it to our device list and query (fill in) its details
   for (auto physicalDevice : physicalDeviceHandles) {
-    m_physicalDevices.emplace_back(
-        physicalDevice); // Constructor queries all device details
+    // Constructor queries all device details
+    m_physicalDevices.emplace_back(physicalDevice, m_apiVersion);
   }
   return m_physicalDevices;
 }
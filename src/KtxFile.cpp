@@ -0,0 +1,237 @@
+#include "KtxFile.hpp"
+#include "LogicalDevice.hpp"
+#include "UploadManager.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const uint8_t ktx2Identifier[12] = {0xAB, 'K',  'T',  'X', ' ',  '2',
+                                           '0',  0xBB, '\r', '\n', 0x1A, '\n'};
+
+// Identifier, header and index up to the level index
+static const size_t ktx2HeaderSize = 80;
+static const size_t ktx2LevelIndexEntrySize = 24;
+
+static const void *mapFile(const std::string &path, size_t &size) {
+  size = 0;
+#ifdef _WIN32
+  auto file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                          OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return nullptr;
+  LARGE_INTEGER fileSize;
+  HANDLE mapping = nullptr;
+  if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  void *data = nullptr;
+  if (mapping) {
+    // The view keeps the mapping and the file alive
+    data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+  }
+  CloseHandle(file);
+  if (data)
+    size = size_t(fileSize.QuadPart);
+  return data;
+#else
+  int file = ::open(path.c_str(), O_RDONLY);
+  if (file < 0)
+    return nullptr;
+  struct stat fileStat;
+  void *data = nullptr;
+  if (fstat(file, &fileStat) == 0 && fileStat.st_size > 0) {
+    data = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (data == MAP_FAILED)
+      data = nullptr;
+  }
+  ::close(file);
+  if (data) {
+    size = size_t(fileStat.st_size);
+    madvise(data, size, MADV_SEQUENTIAL);
+  }
+  return data;
+#endif
+}
+
+static void unmapFile(const void *data, size_t size) {
+#ifdef _WIN32
+  UnmapViewOfFile(data);
+#else
+  munmap(const_cast<void *>(data), size);
+#endif
+}
+
+// KTX2 is little endian, as is every platform Vulkan runs on
+template <typename T> static T read(const uint8_t *data, size_t offset) {
+  T value;
+  memcpy(&value, data + offset, sizeof(T));
+  return value;
+}
+
+void vdu::KtxFile::setDecoder(Supercompression scheme, Decoder decoder) {
+  m_decoders[scheme] = decoder;
+}
+
+bool vdu::KtxFile::open(LogicalDevice *logicalDevice, const std::string &path) {
+  close();
+  m_logicalDevice = logicalDevice;
+  m_path = path;
+
+  m_data = (const uint8_t *)mapFile(path, m_size);
+  if (!m_data) {
+    reportError("Failed to map KTX2 file " + path);
+    return false;
+  }
+  if (!validate()) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void vdu::KtxFile::close() {
+  if (m_data)
+    unmapFile(m_data, m_size);
+  m_data = nullptr;
+  m_size = 0;
+  m_levels.clear();
+}
+
+vdu::TextureCreateInfo vdu::KtxFile::getTextureCreateInfo() {
+  TextureCreateInfo ci;
+  ci.width = m_width;
+  ci.height = m_height;
+  ci.depth = m_depth;
+  ci.layers = m_layers;
+  ci.numMipLevels = m_levels.size();
+  ci.format = m_format;
+  ci.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  ci.aspectFlags = vdu::getFormatInfo(m_format).aspect;
+  ci.usageFlags = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  return ci;
+}
+
+void vdu::KtxFile::createTexture(Texture &texture) {
+  texture.setProperties(getTextureCreateInfo());
+  texture.create(m_logicalDevice);
+}
+
+bool vdu::KtxFile::upload(UploadManager *uploader, Texture *dst,
+                          VkImageLayout oldLayout) {
+  for (uint32_t i = 0; i < m_levels.size(); ++i) {
+    auto layout = dst->getPackedLayout(i, 1);
+    if (layout.size != m_levels[i].uncompressedSize) {
+      reportError("KTX2 level does not match the texture in " + m_path);
+      return false;
+    }
+
+    // The level lands in the arena straight from the mapping
+    auto staging = uploader->allocateStaging(
+        layout.size, uploader->getStagingAlignment(dst));
+    if (!staging.data || !copyLevel(i, staging.data) ||
+        !uploader->queueCopy(staging, dst, layout, oldLayout))
+      return false;
+  }
+  return true;
+}
+
+bool vdu::KtxFile::copyLevel(uint32_t level, void *dst) {
+  auto &l = m_levels[level];
+  if (m_supercompression == Supercompression::None) {
+    memcpy(dst, m_data + l.offset, l.size);
+    return true;
+  }
+
+  auto decoder = m_decoders.find(m_supercompression);
+  if (decoder == m_decoders.end() || !decoder->second) {
+    reportError("No decoder set for the supercompression of " + m_path);
+    return false;
+  }
+  if (!decoder->second(m_data + l.offset, l.size, dst, l.uncompressedSize)) {
+    reportError("Failed to decode KTX2 level of " + m_path);
+    return false;
+  }
+  return true;
+}
+
+bool vdu::KtxFile::validate() {
+  if (m_size < ktx2HeaderSize ||
+      memcmp(m_data, ktx2Identifier, sizeof(ktx2Identifier)) != 0) {
+    reportError("Not a KTX2 file " + m_path);
+    return false;
+  }
+
+  m_format = VkFormat(read<uint32_t>(m_data, 12));
+  m_width = read<uint32_t>(m_data, 20);
+  m_height = std::max(1u, read<uint32_t>(m_data, 24));
+  m_depth = std::max(1u, read<uint32_t>(m_data, 28));
+  auto layerCount = read<uint32_t>(m_data, 32);
+  auto faceCount = read<uint32_t>(m_data, 36);
+  auto levelCount = std::max(1u, read<uint32_t>(m_data, 40));
+  m_supercompression = Supercompression(read<uint32_t>(m_data, 44));
+  m_layers = std::max(1u, layerCount) * faceCount;
+
+  auto &info = vdu::getFormatInfo(m_format);
+  if (info.bytesPerBlock == 0 ||
+      ((info.aspect & VK_IMAGE_ASPECT_DEPTH_BIT) &&
+       (info.aspect & VK_IMAGE_ASPECT_STENCIL_BIT))) {
+    reportError("Unsupported KTX2 format in " + m_path);
+    return false;
+  }
+  if (m_supercompression != Supercompression::None &&
+      m_supercompression != Supercompression::Zstandard &&
+      m_supercompression != Supercompression::Zlib) {
+    reportError("Unsupported KTX2 supercompression in " + m_path);
+    return false;
+  }
+
+  // Cubes are square and 2D, arrays of 3D textures do not exist in Vulkan
+  uint32_t largest = std::max(m_width, std::max(m_height, m_depth));
+  uint32_t maxLevelCount = 1;
+  while (largest >> maxLevelCount)
+    ++maxLevelCount;
+  if (m_width == 0 || (faceCount != 1 && faceCount != 6) ||
+      (faceCount == 6 && (m_width != m_height || m_depth != 1)) ||
+      (m_depth > 1 && m_layers > 1) || levelCount > maxLevelCount) {
+    reportError("Invalid KTX2 dimensions in " + m_path);
+    return false;
+  }
+
+  if (m_size < ktx2HeaderSize + levelCount * ktx2LevelIndexEntrySize) {
+    reportError("Truncated KTX2 level index in " + m_path);
+    return false;
+  }
+  m_levels.resize(levelCount);
+  for (uint32_t i = 0; i < levelCount; ++i) {
+    auto entry = ktx2HeaderSize + i * ktx2LevelIndexEntrySize;
+    auto &level = m_levels[i];
+    level.offset = read<uint64_t>(m_data, entry);
+    level.size = read<uint64_t>(m_data, entry + 8);
+    level.uncompressedSize = read<uint64_t>(m_data, entry + 16);
+
+    auto expectedSize = info.getSize(std::max(1u, m_width >> i),
+                                     std::max(1u, m_height >> i),
+                                     std::max(1u, m_depth >> i)) *
+                        m_layers;
+    if (level.offset > m_size || level.size > m_size - level.offset ||
+        level.uncompressedSize != expectedSize ||
+        (m_supercompression == Supercompression::None &&
+         level.size != level.uncompressedSize)) {
+      reportError("Invalid KTX2 level index in " + m_path);
+      return false;
+    }
+  }
+  return true;
+}
+
+void vdu::KtxFile::reportError(const std::string &message) {
+  if (m_logicalDevice)
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Error, message);
+}
@@ -25,6 +25,28 @@ VkResult vdu::LogicalDevice::create(PhysicalDevice *physicalDevice) {
   dci.ppEnabledExtensionNames = m_enabledExtensions.data();
   dci.pEnabledFeatures = &m_enabledDeviceFeatures;
 
+#ifdef VK_EXT_host_image_copy
+  // Its feature and layout lists are queried through the *2 entry points,
+  // which need the instance to be 1.1 as well
+  bool hostImageCopy =
+      isExtensionEnabled(VK_EXT_HOST_IMAGE_COPY_EXTENSION_NAME) &&
+      m_physicalDevice->getApiVersion() >= VK_MAKE_VERSION(1, 1, 0);
+  VkPhysicalDeviceHostImageCopyFeaturesEXT hostImageCopyFeatures = {};
+  hostImageCopyFeatures.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_FEATURES_EXT;
+  if (hostImageCopy) {
+    VkPhysicalDeviceFeatures2 features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &hostImageCopyFeatures;
+    vkGetPhysicalDeviceFeatures2(m_physicalDevice->getHandle(), &features2);
+    hostImageCopy = hostImageCopyFeatures.hostImageCopy == VK_TRUE;
+  }
+  if (hostImageCopy) {
+    hostImageCopyFeatures.pNext = const_cast<void *>(dci.pNext);
+    dci.pNext = &hostImageCopyFeatures;
+  }
+#endif
+
   auto result =
       vkCreateDevice(m_physicalDevice->getHandle(), &dci, nullptr, &m_device);
   if (result != VK_SUCCESS)
@@ -36,10 +58,21 @@ VkResult vdu::LogicalDevice::create(PhysicalDevice *physicalDevice) {
                      queue->getIndex(), &queueCreate);
     queue->setQueueHandle(queueCreate);
   }
+
+#ifdef VK_EXT_host_image_copy
+  if (hostImageCopy)
+    loadHostImageCopy();
+#endif
+
+  m_memoryAllocator.create(this);
   return VK_SUCCESS;
 }
 
-void vdu::LogicalDevice::destroy() { vkDestroyDevice(m_device, nullptr); }
+void vdu::LogicalDevice::destroy() {
+  m_memoryAllocator.destroy();
+  vkDestroyDevice(m_device, nullptr);
+  m_hostImageCopy = HostImageCopy();
+}
 
 void vdu::LogicalDevice::addQueue(Queue *queue) {
   auto ins = m_queues.insert(queue);
@@ -87,6 +120,51 @@ void vdu::LogicalDevice::addExtension(const char *extensionName) {
   m_enabledExtensions.push_back(extensionName);
 }
 
+bool vdu::LogicalDevice::isExtensionEnabled(const char *extensionName) const {
+  for (auto enabled : m_enabledExtensions)
+    if (strcmp(enabled, extensionName) == 0)
+      return true;
+  return false;
+}
+
+bool vdu::LogicalDevice::isHostImageCopyEnabled() const {
+#ifdef VK_EXT_host_image_copy
+  return m_hostImageCopy.copyMemoryToImage &&
+         m_hostImageCopy.copyImageToMemory &&
+         m_hostImageCopy.transitionImageLayout;
+#else
+  return false;
+#endif
+}
+
+void vdu::LogicalDevice::loadHostImageCopy() {
+#ifdef VK_EXT_host_image_copy
+  auto &hic = m_hostImageCopy;
+  hic.copyMemoryToImage = (PFN_vkCopyMemoryToImageEXT)vkGetDeviceProcAddr(
+      m_device, "vkCopyMemoryToImageEXT");
+  hic.copyImageToMemory = (PFN_vkCopyImageToMemoryEXT)vkGetDeviceProcAddr(
+      m_device, "vkCopyImageToMemoryEXT");
+  hic.transitionImageLayout =
+      (PFN_vkTransitionImageLayoutEXT)vkGetDeviceProcAddr(
+          m_device, "vkTransitionImageLayoutEXT");
+
+  // Counts first, then the layouts themselves
+  VkPhysicalDeviceHostImageCopyPropertiesEXT properties = {};
+  properties.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_IMAGE_COPY_PROPERTIES_EXT;
+  VkPhysicalDeviceProperties2 properties2 = {};
+  properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties2.pNext = &properties;
+  vkGetPhysicalDeviceProperties2(m_physicalDevice->getHandle(), &properties2);
+
+  hic.srcLayouts.resize(properties.copySrcLayoutCount);
+  hic.dstLayouts.resize(properties.copyDstLayoutCount);
+  properties.pCopySrcLayouts = hic.srcLayouts.data();
+  properties.pCopyDstLayouts = hic.dstLayouts.data();
+  vkGetPhysicalDeviceProperties2(m_physicalDevice->getHandle(), &properties2);
+#endif
+}
+
 void vdu::LogicalDevice::addLayer(const char *layerName) {
   m_enabledLayers.push_back(layerName);
 }
@@ -0,0 +1,556 @@
+#include "MemoryAllocator.hpp"
+#include "DeviceMemory.hpp"
+#include "LogicalDevice.hpp"
+#include "PhysicalDevice.hpp"
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// True when the last byte of range 'a' and the byte at 'bOffset' share a page
+static bool onSamePage(VkDeviceSize aOffset, VkDeviceSize aSize,
+                       VkDeviceSize bOffset, VkDeviceSize pageSize) {
+  return (aOffset + aSize - 1) / pageSize == bOffset / pageSize;
+}
+
+void vdu::MemoryAllocator::create(LogicalDevice *logicalDevice) {
+  m_logicalDevice = logicalDevice;
+  auto limits =
+      m_logicalDevice->getPhysicalDevice()->getDeviceProperties().limits;
+  m_bufferImageGranularity = limits.bufferImageGranularity;
+  if (m_bufferImageGranularity == 0)
+    m_bufferImageGranularity = 1;
+  m_nonCoherentAtomSize = limits.nonCoherentAtomSize;
+  if (m_nonCoherentAtomSize == 0)
+    m_nonCoherentAtomSize = 1;
+
+  // Dedicated allocations are core in 1.1, the instance must be 1.1 as well
+  m_dedicatedSupported =
+      m_logicalDevice->getPhysicalDevice()->getApiVersion() >=
+      VK_MAKE_VERSION(1, 1, 0);
+
+  // The budget is queried through vkGetPhysicalDeviceMemoryProperties2,
+  // which is only usable with a 1.1 instance
+  m_memoryBudgetSupported =
+      m_logicalDevice->getPhysicalDevice()->getApiVersion() >=
+          VK_MAKE_VERSION(1, 1, 0) &&
+      m_logicalDevice->isExtensionEnabled(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+  for (uint32_t i = 0; i < VK_MAX_MEMORY_HEAPS; ++i) {
+    m_heapAllocatedBytes[i] = 0;
+    m_heapAllocationCount[i] = 0;
+  }
+}
+
+void vdu::MemoryAllocator::destroy() {
+  for (auto &typeBlocks : m_blocks)
+    for (auto block : typeBlocks.second)
+      destroyBlock(block);
+  m_blocks.clear();
+  m_allocationCount = 0;
+}
+
+void vdu::MemoryAllocator::setBlockSize(VkDeviceSize blockSize) {
+  m_blockSize = blockSize;
+}
+
+void vdu::MemoryAllocator::setDedicatedThreshold(VkDeviceSize threshold) {
+  m_dedicatedThreshold = threshold;
+}
+
+void vdu::MemoryAllocator::getBufferMemoryRequirements(
+    VkBuffer buffer, VkMemoryRequirements &memReqs, DedicatedInfo &dedicated) {
+  dedicated = DedicatedInfo();
+  dedicated.buffer = buffer;
+  if (!m_dedicatedSupported) {
+    vkGetBufferMemoryRequirements(m_logicalDevice->getHandle(), buffer,
+                                  &memReqs);
+    return;
+  }
+
+  VkBufferMemoryRequirementsInfo2 info = {};
+  info.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2;
+  info.buffer = buffer;
+  VkMemoryDedicatedRequirements dedicatedReqs = {};
+  dedicatedReqs.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+  VkMemoryRequirements2 memReqs2 = {};
+  memReqs2.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+  memReqs2.pNext = &dedicatedReqs;
+  vkGetBufferMemoryRequirements2(m_logicalDevice->getHandle(), &info,
+                                 &memReqs2);
+
+  memReqs = memReqs2.memoryRequirements;
+  dedicated.prefersDedicated = dedicatedReqs.prefersDedicatedAllocation;
+  dedicated.requiresDedicated = dedicatedReqs.requiresDedicatedAllocation;
+}
+
+void vdu::MemoryAllocator::getImageMemoryRequirements(
+    VkImage image, VkMemoryRequirements &memReqs, DedicatedInfo &dedicated) {
+  dedicated = DedicatedInfo();
+  dedicated.image = image;
+  if (!m_dedicatedSupported) {
+    vkGetImageMemoryRequirements(m_logicalDevice->getHandle(), image, &memReqs);
+    return;
+  }
+
+  VkImageMemoryRequirementsInfo2 info = {};
+  info.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+  info.image = image;
+  VkMemoryDedicatedRequirements dedicatedReqs = {};
+  dedicatedReqs.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+  VkMemoryRequirements2 memReqs2 = {};
+  memReqs2.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+  memReqs2.pNext = &dedicatedReqs;
+  vkGetImageMemoryRequirements2(m_logicalDevice->getHandle(), &info,
+                                &memReqs2);
+
+  memReqs = memReqs2.memoryRequirements;
+  dedicated.prefersDedicated = dedicatedReqs.prefersDedicatedAllocation;
+  dedicated.requiresDedicated = dedicatedReqs.requiresDedicatedAllocation;
+}
+
+vdu::DeviceMemory *
+vdu::MemoryAllocator::allocate(const VkMemoryRequirements &resourceMemReqs,
+                               VkMemoryPropertyFlags memFlags,
+                               ResourceType type,
+                               const DedicatedInfo *dedicated) {
+  auto memoryTypeIndex =
+      m_logicalDevice->getPhysicalDevice()->findMemoryTypeIndex(
+          resourceMemReqs.memoryTypeBits, memFlags);
+  if (memoryTypeIndex == ~0u) {
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Error,
+        "No memory type supports the requested memory properties");
+    return nullptr;
+  }
+  return allocateFromType(resourceMemReqs, memoryTypeIndex, memFlags, type,
+                          dedicated);
+}
+
+vdu::DeviceMemory *
+vdu::MemoryAllocator::allocate(const VkMemoryRequirements &memReqs,
+                               MemoryUsage usage, ResourceType type,
+                               const DedicatedInfo *dedicated) {
+  auto memoryTypeIndex =
+      m_logicalDevice->getPhysicalDevice()->findMemoryTypeIndex(
+          memReqs.memoryTypeBits, usage);
+  if (memoryTypeIndex == ~0u) {
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Error,
+        "No memory type is suitable for the requested memory usage");
+    return nullptr;
+  }
+  auto &memProps = m_logicalDevice->getPhysicalDevice()->getMemoryProperties();
+
+  if (usage == MemoryUsage::GpuOnly) {
+    auto memory =
+        allocateFromType(memReqs, memoryTypeIndex,
+                         memProps.memoryTypes[memoryTypeIndex].propertyFlags,
+                         type, dedicated, true);
+    if (memory)
+      return memory;
+
+    // Over budget (or out of device memory), try a type on another heap
+    auto heapIndex = memProps.memoryTypes[memoryTypeIndex].heapIndex;
+    uint32_t otherHeapTypes = 0;
+    for (uint32_t i = 0; i < memProps.memoryTypeCount; ++i)
+      if (memProps.memoryTypes[i].heapIndex != heapIndex)
+        otherHeapTypes |= 1u << i;
+    auto fallbackIndex =
+        m_logicalDevice->getPhysicalDevice()->findMemoryTypeIndex(
+            memReqs.memoryTypeBits & otherHeapTypes, usage,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    if (fallbackIndex != ~0u) {
+      m_logicalDevice->_internalReportVduDebug(
+          vdu::LogicalDevice::VduDebugLevel::Warning,
+          "Device local heap is over budget, placing GPU only allocation in "
+          "host visible memory");
+      memoryTypeIndex = fallbackIndex;
+    }
+  }
+
+  return allocateFromType(memReqs, memoryTypeIndex,
+                          memProps.memoryTypes[memoryTypeIndex].propertyFlags,
+                          type, dedicated);
+}
+
+vdu::DeviceMemory *vdu::MemoryAllocator::allocateFromType(
+    const VkMemoryRequirements &resourceMemReqs, uint32_t memoryTypeIndex,
+    VkMemoryPropertyFlags memFlags, ResourceType type,
+    const DedicatedInfo *dedicated, bool withinBudget) {
+  auto memReqs = padRequirements(resourceMemReqs, memoryTypeIndex);
+
+  bool useDedicated =
+      dedicated && m_dedicatedSupported &&
+      (dedicated->requiresDedicated ||
+       (dedicated->prefersDedicated && memReqs.size >= m_dedicatedThreshold));
+
+  // Lazily allocated memory is committed per VkDeviceMemory, a shared block
+  // would be backed as soon as any of its attachments is
+  bool lazy = memFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+
+  if (useDedicated || lazy ||
+      memReqs.size > getPreferredBlockSize(memoryTypeIndex) / 2) {
+    VkDeviceMemory deviceMemory = 0;
+    auto allocResult =
+        allocateDeviceMemory(memoryTypeIndex, memReqs.size, withinBudget,
+                             deviceMemory, useDedicated ? dedicated : nullptr);
+    if (allocResult != VK_SUCCESS) {
+      if (!withinBudget)
+        VDU_VK_CHECK_RESULT(allocResult, "allocating device memory");
+      return nullptr;
+    }
+
+    auto memory = new DeviceMemory();
+    memory->m_logicalDevice = m_logicalDevice;
+    memory->m_deviceMemory = deviceMemory;
+    memory->m_deviceSize = memReqs.size;
+    memory->m_memoryProperties = memFlags;
+    memory->m_memoryTypeIndex = memoryTypeIndex;
+    ++m_allocationCount;
+    return memory;
+  }
+
+  return subAllocate(memReqs, memoryTypeIndex, memFlags, type, true,
+                     withinBudget);
+}
+
+VkMemoryRequirements
+vdu::MemoryAllocator::padRequirements(const VkMemoryRequirements &memReqs,
+                                      uint32_t memoryTypeIndex) {
+  auto padded = memReqs;
+  auto typeFlags = m_logicalDevice->getPhysicalDevice()
+                       ->getMemoryProperties()
+                       .memoryTypes[memoryTypeIndex]
+                       .propertyFlags;
+  if ((typeFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+      !(typeFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+    if (padded.alignment < m_nonCoherentAtomSize)
+      padded.alignment = m_nonCoherentAtomSize;
+    padded.size = alignUp(padded.size, m_nonCoherentAtomSize);
+  }
+  return padded;
+}
+
+vdu::DeviceMemory *vdu::MemoryAllocator::subAllocate(
+    const VkMemoryRequirements &memReqs, uint32_t memoryTypeIndex,
+    VkMemoryPropertyFlags memFlags, ResourceType type, bool canCreateBlock,
+    bool withinBudget) {
+  Block *bestBlock = nullptr;
+  VkDeviceSize bestOffset = 0;
+  VkDeviceSize bestFitSize = ~VkDeviceSize(0);
+  for (auto block : m_blocks[memoryTypeIndex]) {
+    VkDeviceSize offset, fitSize;
+    if (block->evacuating)
+      continue;
+    if (findFreeRange(block, memReqs, type, offset, fitSize) &&
+        fitSize < bestFitSize) {
+      bestBlock = block;
+      bestOffset = offset;
+      bestFitSize = fitSize;
+    }
+  }
+
+  if (!bestBlock) {
+    if (!canCreateBlock)
+      return nullptr;
+    bestBlock =
+        createBlock(memoryTypeIndex, memReqs.size, memFlags, withinBudget);
+    if (!bestBlock)
+      return nullptr;
+    findFreeRange(bestBlock, memReqs, type, bestOffset, bestFitSize);
+  }
+
+  reserveRange(bestBlock, bestOffset, memReqs.size, type);
+
+  auto memory = new DeviceMemory();
+  memory->m_logicalDevice = m_logicalDevice;
+  memory->m_deviceMemory = bestBlock->memory->m_deviceMemory;
+  memory->m_deviceSize = memReqs.size;
+  memory->m_offset = bestOffset;
+  memory->m_memoryProperties = memFlags;
+  memory->m_memoryTypeIndex = memoryTypeIndex;
+  memory->m_parentBlock = bestBlock->memory;
+
+  ++m_allocationCount;
+  return memory;
+}
+
+void vdu::MemoryAllocator::free(DeviceMemory *memory) {
+  if (!memory)
+    return;
+  memory->free();
+  delete memory;
+  if (m_allocationCount)
+    --m_allocationCount;
+}
+
+std::vector<vdu::MemoryHeapBudget> vdu::MemoryAllocator::getMemoryBudget() {
+  auto heapCount = m_logicalDevice->getPhysicalDevice()
+                       ->getMemoryProperties()
+                       .memoryHeapCount;
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProps = {};
+  bool queried = queryDriverBudget(budgetProps);
+
+  std::vector<MemoryHeapBudget> budgets(heapCount);
+  for (uint32_t i = 0; i < heapCount; ++i)
+    budgets[i] = makeHeapBudget(i, queried ? &budgetProps : nullptr);
+  return budgets;
+}
+
+vdu::MemoryHeapBudget vdu::MemoryAllocator::getHeapBudget(uint32_t heapIndex) {
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProps = {};
+  bool queried = queryDriverBudget(budgetProps);
+  return makeHeapBudget(heapIndex, queried ? &budgetProps : nullptr);
+}
+
+bool vdu::MemoryAllocator::queryDriverBudget(
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT &budgetProps) {
+  if (!m_memoryBudgetSupported)
+    return false;
+  budgetProps.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+  VkPhysicalDeviceMemoryProperties2 memProps2 = {};
+  memProps2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+  memProps2.pNext = &budgetProps;
+  vkGetPhysicalDeviceMemoryProperties2(
+      m_logicalDevice->getPhysicalDevice()->getHandle(), &memProps2);
+  return true;
+}
+
+vdu::MemoryHeapBudget vdu::MemoryAllocator::makeHeapBudget(
+    uint32_t heapIndex,
+    const VkPhysicalDeviceMemoryBudgetPropertiesEXT *budgetProps) {
+  auto &heap = m_logicalDevice->getPhysicalDevice()
+                   ->getMemoryProperties()
+                   .memoryHeaps[heapIndex];
+  MemoryHeapBudget budget;
+  budget.heapSize = heap.size;
+  budget.heapFlags = heap.flags;
+  budget.budget = heap.size / 10 * 8;
+  budget.usage = m_heapAllocatedBytes[heapIndex];
+  budget.allocatedBytes = m_heapAllocatedBytes[heapIndex];
+  budget.allocationCount = m_heapAllocationCount[heapIndex];
+
+  // Some drivers leave heaps they do not track zeroed
+  if (budgetProps && budgetProps->heapBudget[heapIndex] != 0) {
+    budget.budget = budgetProps->heapBudget[heapIndex];
+    budget.usage = budgetProps->heapUsage[heapIndex];
+  }
+  return budget;
+}
+
+void vdu::MemoryAllocator::_internalTrackAllocation(uint32_t memoryTypeIndex,
+                                                    VkDeviceSize size) {
+  auto &memProps = m_logicalDevice->getPhysicalDevice()->getMemoryProperties();
+  if (memoryTypeIndex >= memProps.memoryTypeCount)
+    return;
+  auto heapIndex = memProps.memoryTypes[memoryTypeIndex].heapIndex;
+  m_heapAllocatedBytes[heapIndex] += size;
+  ++m_heapAllocationCount[heapIndex];
+}
+
+void vdu::MemoryAllocator::_internalTrackFree(uint32_t memoryTypeIndex,
+                                              VkDeviceSize size) {
+  auto &memProps = m_logicalDevice->getPhysicalDevice()->getMemoryProperties();
+  if (memoryTypeIndex >= memProps.memoryTypeCount)
+    return;
+  auto heapIndex = memProps.memoryTypes[memoryTypeIndex].heapIndex;
+  m_heapAllocatedBytes[heapIndex] -=
+      std::min(size, m_heapAllocatedBytes[heapIndex]);
+  if (m_heapAllocationCount[heapIndex])
+    --m_heapAllocationCount[heapIndex];
+}
+
+uint32_t vdu::MemoryAllocator::getBlockCount() {
+  uint32_t count = 0;
+  for (auto &typeBlocks : m_blocks)
+    count += typeBlocks.second.size();
+  return count;
+}
+
+void vdu::MemoryAllocator::_internalFreeRange(DeviceMemory *memory) {
+  auto &blocks = m_blocks[memory->m_memoryTypeIndex];
+  for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+    auto block = *it;
+    if (block->memory != memory->m_parentBlock)
+      continue;
+
+    auto used = block->usedRanges.find(memory->m_offset);
+    if (used == block->usedRanges.end())
+      return;
+    auto offset = used->first;
+    auto size = used->second.size;
+    block->usedRanges.erase(used);
+
+    // Coalesce with the neighbouring free ranges
+    auto next = block->freeRanges.lower_bound(offset);
+    if (next != block->freeRanges.end() && offset + size == next->first) {
+      size += next->second;
+      next = block->freeRanges.erase(next);
+    }
+    if (next != block->freeRanges.begin()) {
+      auto prev = std::prev(next);
+      if (prev->first + prev->second == offset) {
+        offset = prev->first;
+        size += prev->second;
+      }
+    }
+    block->freeRanges[offset] = size;
+
+    // Keep one empty block per memory type around to avoid thrashing
+    if (block->usedRanges.empty() && blocks.size() > 1) {
+      destroyBlock(block);
+      blocks.erase(it);
+    }
+    return;
+  }
+}
+
+VkResult vdu::MemoryAllocator::allocateDeviceMemory(
+    uint32_t memoryTypeIndex, VkDeviceSize size, bool withinBudget,
+    VkDeviceMemory &deviceMemory, const DedicatedInfo *dedicated) {
+  if (withinBudget) {
+    auto heapIndex = m_logicalDevice->getPhysicalDevice()
+                         ->getMemoryProperties()
+                         .memoryTypes[memoryTypeIndex]
+                         .heapIndex;
+    auto heapBudget = getHeapBudget(heapIndex);
+    if (heapBudget.usage + size > heapBudget.budget)
+      return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  }
+
+  VkMemoryAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = size;
+  allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+  VkMemoryDedicatedAllocateInfo dedicatedInfo = {};
+  if (dedicated) {
+    dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dedicatedInfo.image = dedicated->image;
+    dedicatedInfo.buffer = dedicated->buffer;
+    allocInfo.pNext = &dedicatedInfo;
+  }
+
+  auto allocResult = vkAllocateMemory(m_logicalDevice->getHandle(), &allocInfo,
+                                      nullptr, &deviceMemory);
+  if (allocResult == VK_SUCCESS)
+    _internalTrackAllocation(memoryTypeIndex, size);
+  return allocResult;
+}
+
+vdu::MemoryAllocator::Block *
+vdu::MemoryAllocator::createBlock(uint32_t memoryTypeIndex,
+                                  VkDeviceSize minSize,
+                                  VkMemoryPropertyFlags memFlags,
+                                  bool withinBudget) {
+  auto blockSize = getPreferredBlockSize(memoryTypeIndex);
+
+  // Retry with smaller blocks before giving up
+  VkDeviceMemory deviceMemory = 0;
+  VkResult allocResult = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  while (blockSize >= minSize) {
+    allocResult = allocateDeviceMemory(memoryTypeIndex, blockSize,
+                                       withinBudget, deviceMemory);
+    if (allocResult == VK_SUCCESS)
+      break;
+    blockSize /= 2;
+  }
+  if (allocResult != VK_SUCCESS) {
+    if (!withinBudget)
+      VDU_VK_CHECK_RESULT(allocResult, "allocating device memory block");
+    return nullptr;
+  }
+
+  auto block = new Block();
+  block->memory = new DeviceMemory();
+  block->memory->m_logicalDevice = m_logicalDevice;
+  block->memory->m_deviceMemory = deviceMemory;
+  block->memory->m_deviceSize = blockSize;
+  block->memory->m_memoryProperties = memFlags;
+  block->memory->m_memoryTypeIndex = memoryTypeIndex;
+  block->freeRanges[0] = blockSize;
+
+  m_blocks[memoryTypeIndex].push_back(block);
+  return block;
+}
+
+void vdu::MemoryAllocator::destroyBlock(Block *block) {
+  block->memory->free();
+  delete block->memory;
+  delete block;
+}
+
+bool vdu::MemoryAllocator::findFreeRange(Block *block,
+                                         const VkMemoryRequirements &memReqs,
+                                         ResourceType type,
+                                         VkDeviceSize &offset,
+                                         VkDeviceSize &bestFitSize) {
+  bool found = false;
+  for (auto &freeRange : block->freeRanges) {
+    if (freeRange.second < memReqs.size ||
+        (found && freeRange.second >= bestFitSize))
+      continue;
+
+    auto candidate = alignUp(freeRange.first, memReqs.alignment);
+    auto freeEnd = freeRange.first + freeRange.second;
+
+    // Linear and optimal resources may not share a bufferImageGranularity page
+    if (m_bufferImageGranularity > 1) {
+      auto prev = block->usedRanges.lower_bound(freeRange.first);
+      if (prev != block->usedRanges.begin()) {
+        --prev;
+        if (prev->second.type != type &&
+            onSamePage(prev->first, prev->second.size, candidate,
+                       m_bufferImageGranularity))
+          candidate = alignUp(candidate, m_bufferImageGranularity);
+      }
+    }
+
+    if (candidate + memReqs.size > freeEnd)
+      continue;
+
+    if (m_bufferImageGranularity > 1) {
+      auto next = block->usedRanges.lower_bound(freeEnd);
+      if (next != block->usedRanges.end() && next->second.type != type &&
+          onSamePage(candidate, memReqs.size, next->first,
+                     m_bufferImageGranularity))
+        continue;
+    }
+
+    offset = candidate;
+    bestFitSize = freeRange.second;
+    found = true;
+  }
+  return found;
+}
+
+void vdu::MemoryAllocator::reserveRange(Block *block, VkDeviceSize offset,
+                                        VkDeviceSize size, ResourceType type) {
+  auto freeRange = std::prev(block->freeRanges.upper_bound(offset));
+  auto freeOffset = freeRange->first;
+  auto freeEnd = freeRange->first + freeRange->second;
+  block->freeRanges.erase(freeRange);
+
+  if (offset > freeOffset)
+    block->freeRanges[freeOffset] = offset - freeOffset;
+  if (offset + size < freeEnd)
+    block->freeRanges[offset + size] = freeEnd - (offset + size);
+
+  block->usedRanges[offset] = {size, type};
+}
+
+VkDeviceSize
+vdu::MemoryAllocator::getPreferredBlockSize(uint32_t memoryTypeIndex) {
+  auto &memProps = m_logicalDevice->getPhysicalDevice()->getMemoryProperties();
+  auto heapIndex = memProps.memoryTypes[memoryTypeIndex].heapIndex;
+  auto heapSize = memProps.memoryHeaps[heapIndex].size;
+
+  // Small heaps (e.g. the 256MB host visible device local heap) get
+  // proportionally smaller blocks
+  if (heapSize <= VkDeviceSize(1024) * 1024 * 1024 &&
+      heapSize / 8 < m_blockSize)
+    return heapSize / 8;
+  return m_blockSize;
+}
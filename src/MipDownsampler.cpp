@@ -0,0 +1,391 @@
+#include "MipDownsampler.hpp"
+#include "CommandBuffer.hpp"
+#include "LogicalDevice.hpp"
+#include "PhysicalDevice.hpp"
+
+// Bindings 0 to maxMipCount hold the base mip and the generated mips
+static const uint32_t maxMipCount = 12;
+static const uint32_t counterBinding = maxMipCount + 1;
+
+static const char *downsampleSource = R"glsl(
+layout(local_size_x = 256) in;
+
+layout(std430, binding = COUNTER_BINDING) coherent buffer Counters {
+  uint counters[];
+};
+
+layout(push_constant) uniform Params {
+  uint groupsPerLayer;
+}
+params;
+
+shared vec4 tile[16][16];
+shared bool isLastGroup;
+
+vec4 decode(vec4 v) {
+#ifdef SRGB
+  v.rgb = mix(v.rgb / 12.92, pow((v.rgb + 0.055) / 1.055, vec3(2.4)),
+              greaterThan(v.rgb, vec3(0.04045)));
+#endif
+  return v;
+}
+
+vec4 encode(vec4 v) {
+#ifdef SRGB
+  v.rgb = clamp(v.rgb, 0.0, 1.0);
+  v.rgb = mix(v.rgb * 12.92, 1.055 * pow(v.rgb, vec3(1.0 / 2.4)) - 0.055,
+              greaterThan(v.rgb, vec3(0.0031308)));
+#endif
+  return v;
+}
+
+vec4 reduce(vec4 a, vec4 b, vec4 c, vec4 d) {
+#if REDUCTION == 1
+  return min(min(a, b), min(c, d));
+#elif REDUCTION == 2
+  return max(max(a, b), max(c, d));
+#else
+  return (a + b + c + d) * 0.25;
+#endif
+}
+
+// Clamped to the mip so partial tiles and odd sizes never read outside it
+vec4 load(int m, ivec2 p, int layer) {
+  return decode(loadMip(m, ivec3(min(p, mipSize(m) - 1), layer)));
+}
+
+void store(int m, ivec2 p, int layer, vec4 v) {
+  if (all(lessThan(p, mipSize(m))))
+    storeMip(m, ivec3(p, layer), encode(v));
+}
+
+// Reduces the 64x64 tile 'tileId' of mip 'srcMip' into the next six mips
+void downsampleTile(int srcMip, ivec2 tileId, int layer) {
+  uint t = gl_LocalInvocationIndex;
+  ivec2 local = ivec2(t % 16u, t / 16u);
+
+  // Each invocation makes a 2x2 block of the first mip and reduces it again
+  vec4 v[4];
+  for (int i = 0; i < 4; ++i) {
+    ivec2 p = tileId * 32 + local * 2 + ivec2(i & 1, i >> 1);
+    ivec2 s = p * 2;
+    v[i] = reduce(load(srcMip, s, layer), load(srcMip, s + ivec2(1, 0), layer),
+                  load(srcMip, s + ivec2(0, 1), layer),
+                  load(srcMip, s + ivec2(1, 1), layer));
+    store(srcMip + 1, p, layer, v[i]);
+  }
+  if (srcMip + 2 > MIP_COUNT)
+    return;
+
+  vec4 r = reduce(v[0], v[1], v[2], v[3]);
+  store(srcMip + 2, tileId * 16 + local, layer, r);
+  tile[local.y][local.x] = r;
+
+  for (int m = srcMip + 3, size = 8; m <= min(srcMip + 6, MIP_COUNT);
+       ++m, size /= 2) {
+    barrier();
+    bool active = t < uint(size * size);
+    ivec2 q = ivec2(t % uint(size), t / uint(size));
+    if (active) {
+      r = reduce(tile[q.y * 2][q.x * 2], tile[q.y * 2][q.x * 2 + 1],
+                 tile[q.y * 2 + 1][q.x * 2], tile[q.y * 2 + 1][q.x * 2 + 1]);
+      store(m, tileId * size + q, layer, r);
+    }
+    barrier();
+    if (active)
+      tile[q.y][q.x] = r;
+  }
+}
+
+void main() {
+  int layer = int(gl_WorkGroupID.z);
+  downsampleTile(0, ivec2(gl_WorkGroupID.xy), layer);
+  if (MIP_COUNT <= 6)
+    return;
+
+  // The last group of the layer to get here sees every tile's mip 6
+  memoryBarrierImage();
+  barrier();
+  if (gl_LocalInvocationIndex == 0u)
+    isLastGroup =
+        atomicAdd(counters[layer], 1u) == params.groupsPerLayer - 1u;
+  barrier();
+  if (!isLastGroup)
+    return;
+  memoryBarrierImage();
+
+  ivec2 tiles = (mipSize(6) + 63) / 64;
+  for (int y = 0; y < tiles.y; ++y)
+    for (int x = 0; x < tiles.x; ++x) {
+      downsampleTile(6, ivec2(x, y), layer);
+      barrier();
+    }
+}
+)glsl";
+
+// sRGB textures are stored to through UNORM views
+static VkFormat getStorageViewFormat(VkFormat format) {
+  auto &info = vdu::getFormatInfo(format);
+  return info.srgb ? info.srgbPair : format;
+}
+
+static const char *getImageFormatQualifier(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_R8G8B8A8_UNORM:
+    return "rgba8";
+  case VK_FORMAT_R8G8_UNORM:
+    return "rg8";
+  case VK_FORMAT_R8_UNORM:
+    return "r8";
+  case VK_FORMAT_R8G8B8A8_SNORM:
+    return "rgba8_snorm";
+  case VK_FORMAT_R16_UNORM:
+    return "r16";
+  case VK_FORMAT_R16G16_UNORM:
+    return "rg16";
+  case VK_FORMAT_R16G16B16A16_UNORM:
+    return "rgba16";
+  case VK_FORMAT_R16_SFLOAT:
+    return "r16f";
+  case VK_FORMAT_R16G16_SFLOAT:
+    return "rg16f";
+  case VK_FORMAT_R16G16B16A16_SFLOAT:
+    return "rgba16f";
+  case VK_FORMAT_R32_SFLOAT:
+    return "r32f";
+  case VK_FORMAT_R32G32_SFLOAT:
+    return "rg32f";
+  case VK_FORMAT_R32G32B32A32_SFLOAT:
+    return "rgba32f";
+  case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+    return "r11f_g11f_b10f";
+  case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+    return "rgb10_a2";
+  default:
+    return nullptr;
+  }
+}
+
+void vdu::MipDownsampler::setReduction(Reduction reduction) {
+  m_reduction = reduction;
+}
+
+void vdu::MipDownsampler::create(LogicalDevice *logicalDevice,
+                                 Texture *texture) {
+  m_logicalDevice = logicalDevice;
+  m_texture = texture;
+
+  auto viewFormat = getStorageViewFormat(m_texture->getFormat());
+  auto imageFormat = getImageFormatQualifier(viewFormat);
+  if (!imageFormat || m_texture->getDepth() > 1 ||
+      !(m_texture->getUsageFlags() & VK_IMAGE_USAGE_STORAGE_BIT)) {
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Error,
+        "Mip downsampling needs a 2D storage texture with a storable format");
+    return;
+  }
+
+  // Some formats the shader can name are optional as storage images
+  if (m_logicalDevice->getPhysicalDevice()->findSupportedFormat(
+          {viewFormat}, VK_IMAGE_TILING_OPTIMAL,
+          VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT) == VK_FORMAT_UNDEFINED) {
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Error,
+        "Mip downsampling format is not supported for storage on this device");
+    return;
+  }
+
+  m_mipCount = std::min(m_texture->getNumMipLevels() - 1, maxMipCount);
+  if (m_mipCount == 0)
+    return;
+  if (m_mipCount < m_texture->getNumMipLevels() - 1)
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Warning,
+        "Mip downsampler generates 12 mips, the rest of the chain is left");
+  m_groupCountX = (m_texture->getWidth() + 63) / 64;
+  m_groupCountY = (m_texture->getHeight() + 63) / 64;
+
+  for (uint32_t mip = 0; mip <= m_mipCount; ++mip) {
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = m_texture->getHandle();
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    viewInfo.format = viewFormat;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = mip;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = m_texture->getLayers();
+
+    VkImageView view = 0;
+    VDU_VK_CHECK_RESULT(vkCreateImageView(m_logicalDevice->getHandle(),
+                                          &viewInfo, nullptr, &view),
+                        "creating mip storage view");
+    m_mipViews.push_back(view);
+  }
+
+  m_counters.setUsage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                      VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  m_counters.setMemoryUsage(MemoryUsage::GpuOnly);
+  m_counters.create(m_logicalDevice, sizeof(uint32_t) * m_texture->getLayers());
+
+  m_shader.addModuleFromSource(
+      ShaderStage::Compute,
+      getShaderSource(imageFormat, viewFormat != m_texture->getFormat()),
+      "vdu_downsample.comp");
+  m_shader.create(m_logicalDevice);
+  m_shader.compile();
+
+  m_descriptorPool.addPoolCount(VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                m_mipCount + 1);
+  m_descriptorPool.addPoolCount(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1);
+  m_descriptorPool.addSetCount(1);
+  m_descriptorPool.create(m_logicalDevice);
+
+  for (uint32_t mip = 0; mip <= m_mipCount; ++mip)
+    m_descriptorSetLayout.addBinding("mip" + std::to_string(mip),
+                                     DescriptorType::StorageImage, mip, 1,
+                                     ShaderStage::Compute);
+  m_descriptorSetLayout.addBinding("counters", DescriptorType::StorageBuffer,
+                                   counterBinding, 1, ShaderStage::Compute);
+  m_descriptorSetLayout.create(m_logicalDevice);
+
+  m_descriptorSet.allocate(m_logicalDevice, &m_descriptorSetLayout,
+                           &m_descriptorPool);
+  auto updater = m_descriptorSet.makeUpdater();
+  for (uint32_t mip = 0; mip <= m_mipCount; ++mip) {
+    auto imageUpdate = updater->addImageUpdate("mip" + std::to_string(mip));
+    imageUpdate->imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    imageUpdate->imageView = m_mipViews[mip];
+    imageUpdate->sampler = 0;
+  }
+  auto bufferUpdate = updater->addBufferUpdate("counters");
+  bufferUpdate->buffer = m_counters.getHandle();
+  bufferUpdate->offset = 0;
+  bufferUpdate->range = VK_WHOLE_SIZE;
+  m_descriptorSet.submitUpdater(updater);
+  m_descriptorSet.destroyUpdater(updater);
+
+  m_pipelineLayout.addDescriptorSetLayout(&m_descriptorSetLayout);
+  m_pipelineLayout.addPushConstantRange(
+      PushConstantRange{ShaderStage::Compute, 0u, sizeof(uint32_t)});
+  m_pipelineLayout.create(m_logicalDevice);
+
+  m_pipeline.setPipelineLayout(&m_pipelineLayout);
+  m_pipeline.setShaderProgram(&m_shader);
+  m_pipeline.create(m_logicalDevice);
+}
+
+void vdu::MipDownsampler::destroy() {
+  if (!m_logicalDevice)
+    return;
+  m_pipeline.destroy();
+  m_pipelineLayout.destroy();
+  m_descriptorSetLayout.destroy();
+  m_descriptorPool.destroy();
+  m_shader.destroy();
+  m_counters.destroy();
+  for (auto view : m_mipViews)
+    vkDestroyImageView(m_logicalDevice->getHandle(), view, nullptr);
+  m_mipViews.clear();
+}
+
+void vdu::MipDownsampler::cmdDownsample(CommandBuffer *cmd,
+                                        VkImageLayout currentLayout) {
+  cmdDownsample(cmd->getHandle(), currentLayout);
+}
+
+void vdu::MipDownsampler::cmdDownsample(const VkCommandBuffer &cmd,
+                                        VkImageLayout currentLayout) {
+  if (m_mipViews.empty())
+    return;
+
+  // Counters start from zero on every dispatch
+  vkCmdFillBuffer(cmd, m_counters.getHandle(), 0, VK_WHOLE_SIZE, 0);
+
+  VkBufferMemoryBarrier counterBarrier = {};
+  counterBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  counterBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  counterBarrier.dstAccessMask =
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  counterBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  counterBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  counterBarrier.buffer = m_counters.getHandle();
+  counterBarrier.offset = 0;
+  counterBarrier.size = VK_WHOLE_SIZE;
+
+  VkImageMemoryBarrier imageBarrier = {};
+  imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  imageBarrier.image = m_texture->getHandle();
+  imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  imageBarrier.subresourceRange.baseMipLevel = 0;
+  imageBarrier.subresourceRange.levelCount = m_mipCount + 1;
+  imageBarrier.subresourceRange.baseArrayLayer = 0;
+  imageBarrier.subresourceRange.layerCount = m_texture->getLayers();
+  imageBarrier.oldLayout = currentLayout;
+  imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  imageBarrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+  imageBarrier.dstAccessMask =
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1,
+                       &counterBarrier, 1, &imageBarrier);
+
+  uint32_t groupsPerLayer = m_groupCountX * m_groupCountY;
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    m_pipeline.getHandle());
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          m_pipelineLayout.getHandle(), 0, 1,
+                          &m_descriptorSet.getHandle(), 0, nullptr);
+  vkCmdPushConstants(cmd, m_pipelineLayout.getHandle(),
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(groupsPerLayer),
+                     &groupsPerLayer);
+  vkCmdDispatch(cmd, m_groupCountX, m_groupCountY, m_texture->getLayers());
+
+  imageBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+  imageBarrier.newLayout = m_texture->getLayout();
+  if (imageBarrier.newLayout == VK_IMAGE_LAYOUT_UNDEFINED)
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  imageBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  imageBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &imageBarrier);
+}
+
+std::string vdu::MipDownsampler::getShaderSource(const char *imageFormat,
+                                                 bool srgb) {
+  std::stringstream source;
+  source << "#version 450\n";
+  source << "#define MIP_COUNT " << m_mipCount << "\n";
+  source << "#define COUNTER_BINDING " << counterBinding << "\n";
+  source << "#define REDUCTION " << int(m_reduction) << "\n";
+  if (srgb)
+    source << "#define SRGB\n";
+
+  // One binding per mip, selected by constant so no dynamic indexing is needed
+  for (uint32_t mip = 0; mip <= m_mipCount; ++mip)
+    source << "layout(binding = " << mip << ", " << imageFormat
+           << ") uniform coherent image2DArray mip" << mip << ";\n";
+
+  source << "ivec2 mipSize(int m) {\n  switch (m) {\n";
+  for (uint32_t mip = 0; mip <= m_mipCount; ++mip)
+    source << "  case " << mip << ": return imageSize(mip" << mip << ").xy;\n";
+  source << "  }\n  return ivec2(1);\n}\n";
+
+  source << "vec4 loadMip(int m, ivec3 p) {\n  switch (m) {\n";
+  for (uint32_t mip = 0; mip <= m_mipCount; ++mip)
+    source << "  case " << mip << ": return imageLoad(mip" << mip << ", p);\n";
+  source << "  }\n  return vec4(0.0);\n}\n";
+
+  source << "void storeMip(int m, ivec3 p, vec4 v) {\n  switch (m) {\n";
+  for (uint32_t mip = 1; mip <= m_mipCount; ++mip)
+    source << "  case " << mip << ": imageStore(mip" << mip
+           << ", p, v); break;\n";
+  source << "  }\n}\n";
+
+  source << downsampleSource;
+  return source.str();
+}
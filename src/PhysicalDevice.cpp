@@ -29,6 +29,66 @@ uint32_t vdu::PhysicalDevice::findMemoryTypeIndex(
   return ~(uint32_t(0));
 }
 
+static uint32_t countBits(VkMemoryPropertyFlags flags) {
+  uint32_t count = 0;
+  for (; flags; flags &= flags - 1)
+    ++count;
+  return count;
+}
+
+uint32_t vdu::PhysicalDevice::findMemoryTypeIndex(
+    uint32_t typeFilter, MemoryUsage usage,
+    VkMemoryPropertyFlags requiredProperties) const {
+  VkMemoryPropertyFlags required = requiredProperties;
+  VkMemoryPropertyFlags preferred = 0;
+  VkMemoryPropertyFlags weighted = 0; // Preferred bits that cost twice
+  VkMemoryPropertyFlags avoided = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+
+  switch (usage) {
+  case MemoryUsage::GpuOnly:
+    preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    avoided |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    break;
+  case MemoryUsage::CpuToGpu:
+    // Device local host visible memory (ReBAR/UMA) saves a staging copy
+    required |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    preferred = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    avoided |= VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    break;
+  case MemoryUsage::GpuToCpu:
+    // Uncached (write-combined) memory is very slow to read on the host
+    required |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT |
+                VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    weighted = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+    break;
+  case MemoryUsage::GpuLazy:
+    preferred = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT |
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    avoided = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    break;
+  default:
+    break;
+  }
+  avoided &= ~required;
+
+  uint32_t bestIndex = ~(uint32_t(0));
+  uint32_t bestCost = ~(uint32_t(0));
+  for (uint32_t i = 0; i < m_memoryProperties.memoryTypeCount; i++) {
+    auto flags = m_memoryProperties.memoryTypes[i].propertyFlags;
+    if (!(typeFilter & (1 << i)) || (flags & required) != required)
+      continue;
+    auto cost = countBits(preferred & ~flags) + countBits(weighted & ~flags) +
+                countBits(avoided & flags);
+    if (cost < bestCost) {
+      bestIndex = i;
+      bestCost = cost;
+    }
+  }
+  return bestIndex;
+}
+
 VkFormat vdu::PhysicalDevice::findSupportedFormat(
     const std::vector<VkFormat> &candidates, VkImageTiling tiling,
     VkFormatFeatureFlags features) const {
@@ -74,6 +134,15 @@ VkPhysicalDeviceProperties vdu::PhysicalDevice::getDeviceProperties() const {
   return m_deviceProperties;
 }
 
+uint32_t vdu::PhysicalDevice::getApiVersion() const {
+  return std::min(m_deviceProperties.apiVersion, m_instanceApiVersion);
+}
+
+const VkPhysicalDeviceMemoryProperties &
+vdu::PhysicalDevice::getMemoryProperties() const {
+  return m_memoryProperties;
+}
+
 void vdu::PhysicalDevice::queryDetails() {
   // Query device properties and features
   {
@@ -0,0 +1,505 @@
+#include "PixelConverter.hpp"
+#include "FormatTraits.hpp"
+#include "PhysicalDevice.hpp"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||             \
+    defined(_M_IX86)
+#define VDU_PIXEL_SIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define VDU_TARGET(isa)
+#else
+#define VDU_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+enum class InstructionSet { Scalar, Sse41, Avx2 };
+
+static InstructionSet detectInstructionSet() {
+#if defined(VDU_PIXEL_SIMD) && defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  int maxLeaf = info[0];
+  __cpuid(info, 1);
+  bool sse41 = info[2] & (1 << 19);
+  bool osxsave = info[2] & (1 << 27);
+  bool avx = info[2] & (1 << 28);
+  bool f16c = info[2] & (1 << 29);
+  bool avx2 = false;
+  if (maxLeaf >= 7 && osxsave && avx && f16c &&
+      (_xgetbv(0) & 0x6) == 0x6) { // The OS saves the YMM registers
+    __cpuidex(info, 7, 0);
+    avx2 = info[1] & (1 << 5);
+  }
+  if (avx2)
+    return InstructionSet::Avx2;
+  if (sse41)
+    return InstructionSet::Sse41;
+#elif defined(VDU_PIXEL_SIMD)
+  // Every CPU with AVX2 also has F16C
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return InstructionSet::Avx2;
+  if (__builtin_cpu_supports("sse4.1"))
+    return InstructionSet::Sse41;
+#endif
+  return InstructionSet::Scalar;
+}
+
+static InstructionSet getInstructionSetLevel() {
+  static InstructionSet level = detectInstructionSet();
+  return level;
+}
+
+// Byte order of the 8 bit formats, each lists its seven numeric types in
+// the same order (UNORM, SNORM, USCALED, SSCALED, UINT, SINT, SRGB)
+static const VkFormat byteOrderBases[4] = {
+    VK_FORMAT_R8G8B8_UNORM, VK_FORMAT_B8G8R8_UNORM, VK_FORMAT_R8G8B8A8_UNORM,
+    VK_FORMAT_B8G8R8A8_UNORM};
+static const uint8_t byteOrderChannels[4][4] = {
+    {0, 1, 2, 0xFF}, {2, 1, 0, 0xFF}, {0, 1, 2, 3}, {2, 1, 0, 3}};
+static const uint8_t byteTypeAlphaOne[7] = {0xFF, 0x7F, 1, 1, 1, 1, 0xFF};
+
+static bool getByteOrder(VkFormat format, uint32_t &order, uint32_t &type) {
+  for (order = 0; order < 4; ++order) {
+    if (format >= byteOrderBases[order] && format < byteOrderBases[order] + 7) {
+      type = format - byteOrderBases[order];
+      return true;
+    }
+  }
+  return false;
+}
+
+static VkFormat getByteFormat(uint32_t order, uint32_t type) {
+  return VkFormat(byteOrderBases[order] + type);
+}
+
+static VkFormat getHalfFormat(VkFormat floatFormat) {
+  switch (floatFormat) {
+  case VK_FORMAT_R32_SFLOAT:
+    return VK_FORMAT_R16_SFLOAT;
+  case VK_FORMAT_R32G32_SFLOAT:
+    return VK_FORMAT_R16G16_SFLOAT;
+  case VK_FORMAT_R32G32B32_SFLOAT:
+    return VK_FORMAT_R16G16B16_SFLOAT;
+  case VK_FORMAT_R32G32B32A32_SFLOAT:
+    return VK_FORMAT_R16G16B16A16_SFLOAT;
+  default:
+    return VK_FORMAT_UNDEFINED;
+  }
+}
+
+// Linear values in [0, 1] rounded to this many steps index the encode table
+static const uint32_t srgbTableSteps = 4095;
+
+static const uint32_t *getSrgbTable() {
+  static const struct Table {
+    uint32_t values[srgbTableSteps + 1];
+    Table() {
+      for (uint32_t i = 0; i <= srgbTableSteps; ++i) {
+        double linear = double(i) / srgbTableSteps;
+        double encoded = linear <= 0.0031308
+                             ? linear * 12.92
+                             : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+        values[i] = uint32_t(encoded * 255.0 + 0.5);
+      }
+    }
+  } table;
+  return table.values;
+}
+
+// NaN clamps to zero, matching SSE min/max with the value first
+static float clampUnit(float value) {
+  return value > 0.f ? (value < 1.f ? value : 1.f) : 0.f;
+}
+
+static uint16_t floatToHalf(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint16_t sign = (bits >> 16) & 0x8000;
+  bits &= 0x7FFFFFFF;
+
+  // Too large for a half, infinity or NaN
+  if (bits >= 0x47800000)
+    return sign | (bits > 0x7F800000 ? 0x7E00 : 0x7C00);
+
+  // Denormal halves, adding 0.5 lets the FPU round the mantissa into place
+  if (bits < 0x38800000) {
+    float magnitude;
+    memcpy(&magnitude, &bits, sizeof(bits));
+    magnitude += 0.5f;
+    memcpy(&bits, &magnitude, sizeof(bits));
+    return sign | (bits - 0x3F000000);
+  }
+
+  // Rebias the exponent and round the mantissa to nearest even
+  return sign | ((bits + 0xC8000FFF + ((bits >> 13) & 1)) >> 13);
+}
+
+static void convertBytesScalar(const uint8_t *src, uint8_t *dst, size_t count,
+                               const uint8_t *map, uint32_t srcBytes,
+                               uint32_t dstBytes, uint8_t fill) {
+  for (size_t i = 0; i < count; ++i) {
+    for (uint32_t c = 0; c < dstBytes; ++c)
+      dst[c] = map[c] < srcBytes ? src[map[c]] : fill;
+    src += srcBytes;
+    dst += dstBytes;
+  }
+}
+
+static void convertHalfScalar(const float *src, uint16_t *dst, size_t count) {
+  for (size_t i = 0; i < count; ++i)
+    dst[i] = floatToHalf(src[i]);
+}
+
+static void encodeSrgbScalar(const float *src, uint8_t *dst, size_t count,
+                             bool swapRedBlue) {
+  auto table = getSrgbTable();
+  for (size_t i = 0; i < count; ++i, src += 4, dst += 4) {
+    uint8_t red = table[lrintf(clampUnit(src[0]) * srgbTableSteps)];
+    uint8_t blue = table[lrintf(clampUnit(src[2]) * srgbTableSteps)];
+    dst[0] = swapRedBlue ? blue : red;
+    dst[1] = table[lrintf(clampUnit(src[1]) * srgbTableSteps)];
+    dst[2] = swapRedBlue ? red : blue;
+    dst[3] = uint8_t(lrintf(clampUnit(src[3]) * 255.f));
+  }
+}
+
+#ifdef VDU_PIXEL_SIMD
+
+/*
+    Shuffle and fill masks moving four pixels of 'srcBytes' into four pixels
+    of 'dstBytes', unused destination bytes are zeroed
+*/
+static void getShuffleMasks(const uint8_t *map, uint32_t srcBytes,
+                            uint32_t dstBytes, uint8_t fill,
+                            uint8_t shuffle[16], uint8_t fills[16]) {
+  memset(shuffle, 0x80, 16);
+  memset(fills, 0, 16);
+  for (uint32_t p = 0; p < 4; ++p) {
+    for (uint32_t c = 0; c < dstBytes; ++c) {
+      if (map[c] < srcBytes)
+        shuffle[p * dstBytes + c] = uint8_t(p * srcBytes + map[c]);
+      else
+        fills[p * dstBytes + c] = fill;
+    }
+  }
+}
+
+/*
+    The loads and stores below move 16 bytes per four pixels even when the
+    pixels are 12 bytes, each loop stops before that runs past the end
+*/
+VDU_TARGET("sse4.1")
+static size_t convertBytesSse41(const uint8_t *src, uint8_t *dst, size_t count,
+                                const uint8_t *map, uint32_t srcBytes,
+                                uint32_t dstBytes, uint8_t fill) {
+  if (srcBytes == 3 && dstBytes == 3)
+    return 0;
+  alignas(16) uint8_t shuffleBytes[16];
+  alignas(16) uint8_t fillBytes[16];
+  getShuffleMasks(map, srcBytes, dstBytes, fill, shuffleBytes, fillBytes);
+  auto shuffle = _mm_load_si128((const __m128i *)shuffleBytes);
+  auto fills = _mm_load_si128((const __m128i *)fillBytes);
+
+  size_t i = 0;
+  for (; i + 6 <= count; i += 4) {
+    auto pixels = _mm_loadu_si128((const __m128i *)(src + i * srcBytes));
+    pixels = _mm_or_si128(_mm_shuffle_epi8(pixels, shuffle), fills);
+    _mm_storeu_si128((__m128i *)(dst + i * dstBytes), pixels);
+  }
+  return i;
+}
+
+VDU_TARGET("avx2")
+static size_t convertBytesAvx2(const uint8_t *src, uint8_t *dst, size_t count,
+                               const uint8_t *map, uint32_t srcBytes,
+                               uint32_t dstBytes, uint8_t fill) {
+  if (srcBytes == 3 && dstBytes == 3)
+    return 0;
+  alignas(16) uint8_t shuffleBytes[16];
+  alignas(16) uint8_t fillBytes[16];
+  getShuffleMasks(map, srcBytes, dstBytes, fill, shuffleBytes, fillBytes);
+  auto shuffle = _mm256_broadcastsi128_si256(
+      _mm_load_si128((const __m128i *)shuffleBytes));
+  auto fills =
+      _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)fillBytes));
+
+  // Four pixels per 128 bit lane, the shuffle cannot cross lanes
+  size_t i = 0;
+  for (; i + 10 <= count; i += 8) {
+    auto s = src + i * srcBytes;
+    auto d = dst + i * dstBytes;
+    auto pixels = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)s)),
+        _mm_loadu_si128((const __m128i *)(s + 4 * srcBytes)), 1);
+    pixels = _mm256_or_si256(_mm256_shuffle_epi8(pixels, shuffle), fills);
+    if (dstBytes == 4) {
+      _mm256_storeu_si256((__m256i *)d, pixels);
+    } else {
+      // The second store overwrites the first's four zeroed bytes
+      _mm_storeu_si128((__m128i *)d, _mm256_castsi256_si128(pixels));
+      _mm_storeu_si128((__m128i *)(d + 12),
+                       _mm256_extracti128_si256(pixels, 1));
+    }
+  }
+  return i + convertBytesSse41(src + i * srcBytes, dst + i * dstBytes,
+                               count - i, map, srcBytes, dstBytes, fill);
+}
+
+// Round to nearest even like F16C, NaNs become the quiet NaN 0x7E00
+VDU_TARGET("sse4.1")
+static __m128i floatToHalfSse41(__m128 value) {
+  auto bits = _mm_castps_si128(value);
+  auto sign = _mm_and_si128(bits, _mm_set1_epi32(int(0x80000000)));
+  auto magnitude = _mm_xor_si128(bits, sign);
+
+  auto isNan = _mm_castps_si128(_mm_cmpunord_ps(value, value));
+  auto isFinite = _mm_cmpgt_epi32(_mm_set1_epi32(0x47800000), magnitude);
+  auto isDenormal = _mm_cmpgt_epi32(_mm_set1_epi32(0x38800000), magnitude);
+
+  auto half = _mm_set1_epi32(0x3F000000);
+  auto denormal = _mm_sub_epi32(
+      _mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(magnitude),
+                                  _mm_castsi128_ps(half))),
+      half);
+
+  auto odd = _mm_and_si128(_mm_srli_epi32(magnitude, 13), _mm_set1_epi32(1));
+  auto normal = _mm_srli_epi32(
+      _mm_add_epi32(_mm_add_epi32(magnitude, _mm_set1_epi32(int(0xC8000FFF))),
+                    odd),
+      13);
+
+  auto special = _mm_or_si128(_mm_set1_epi32(0x7C00),
+                              _mm_and_si128(isNan, _mm_set1_epi32(0x200)));
+  auto result = _mm_blendv_epi8(normal, denormal, isDenormal);
+  result = _mm_blendv_epi8(special, result, isFinite);
+  return _mm_or_si128(result, _mm_srli_epi32(sign, 16));
+}
+
+VDU_TARGET("sse4.1")
+static size_t convertHalfSse41(const float *src, uint16_t *dst, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    auto low = floatToHalfSse41(_mm_loadu_ps(src + i));
+    auto high = floatToHalfSse41(_mm_loadu_ps(src + i + 4));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi32(low, high));
+  }
+  return i;
+}
+
+VDU_TARGET("avx2,f16c")
+static size_t convertHalfAvx2(const float *src, uint16_t *dst, size_t count) {
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8)
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     _mm256_cvtps_ph(_mm256_loadu_ps(src + i),
+                                     _MM_FROUND_TO_NEAREST_INT));
+  return i;
+}
+
+VDU_TARGET("sse4.1")
+static size_t encodeSrgbSse41(const float *src, uint8_t *dst, size_t count,
+                              bool swapRedBlue) {
+  auto table = getSrgbTable();
+  // Colour channels scale to table indices, alpha to its final value
+  auto scale = _mm_setr_ps(float(srgbTableSteps), float(srgbTableSteps),
+                           float(srgbTableSteps), 255.f);
+  auto zero = _mm_setzero_ps();
+  auto one = _mm_set1_ps(1.f);
+  int red = swapRedBlue ? 2 : 0;
+  int blue = swapRedBlue ? 0 : 2;
+
+  size_t i = 0;
+  for (; i < count; ++i, src += 4, dst += 4) {
+    auto value = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src), zero), one);
+    auto indices = _mm_cvtps_epi32(_mm_mul_ps(value, scale));
+    dst[red] = table[_mm_extract_epi32(indices, 0)];
+    dst[1] = table[_mm_extract_epi32(indices, 1)];
+    dst[blue] = table[_mm_extract_epi32(indices, 2)];
+    dst[3] = uint8_t(_mm_extract_epi32(indices, 3));
+  }
+  return i;
+}
+
+// Gathers the colour of two pixels, alpha already holds its value
+VDU_TARGET("avx2")
+static __m256i encodeSrgbPairAvx2(const float *pixels, const int *table,
+                                  __m256 scale) {
+  auto value = _mm256_min_ps(
+      _mm256_max_ps(_mm256_loadu_ps(pixels), _mm256_setzero_ps()),
+      _mm256_set1_ps(1.f));
+  auto indices = _mm256_cvtps_epi32(_mm256_mul_ps(value, scale));
+  auto colour = _mm256_i32gather_epi32(table, indices, 4);
+  return _mm256_blend_epi32(colour, indices, 0x88);
+}
+
+VDU_TARGET("avx2")
+static size_t encodeSrgbAvx2(const float *src, uint8_t *dst, size_t count,
+                             bool swapRedBlue) {
+  auto table = (const int *)getSrgbTable();
+  auto steps = float(srgbTableSteps);
+  auto scale = _mm256_setr_ps(steps, steps, steps, 255.f, steps, steps, steps,
+                              255.f);
+  auto order = swapRedBlue ? _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8,
+                                           11, 14, 13, 12, 15)
+                           : _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+                                           11, 12, 13, 14, 15);
+
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    auto first = encodeSrgbPairAvx2(src + i * 4, table, scale);
+    auto second = encodeSrgbPairAvx2(src + i * 4 + 8, table, scale);
+    auto words = _mm256_permute4x64_epi64(_mm256_packus_epi32(first, second),
+                                          0xD8);
+    auto bytes = _mm_packus_epi16(_mm256_castsi256_si128(words),
+                                  _mm256_extracti128_si256(words, 1));
+    _mm_storeu_si128((__m128i *)(dst + i * 4), _mm_shuffle_epi8(bytes, order));
+  }
+  return i;
+}
+
+#endif
+
+bool vdu::PixelConverter::create(const PhysicalDevice *physicalDevice,
+                                 VkFormat srcFormat, VkImageTiling tiling,
+                                 VkFormatFeatureFlags features) {
+  auto format = physicalDevice->findSupportedFormat(getCandidates(srcFormat),
+                                                    tiling, features);
+  if (format == VK_FORMAT_UNDEFINED) {
+    m_kind = Kind::None;
+    return false;
+  }
+  return create(srcFormat, format);
+}
+
+bool vdu::PixelConverter::create(VkFormat srcFormat, VkFormat dstFormat) {
+  m_srcFormat = srcFormat;
+  m_dstFormat = dstFormat;
+  m_kind = Kind::None;
+
+  uint32_t srcOrder, srcType, dstOrder, dstType;
+  if (srcFormat == dstFormat) {
+    if (getFormatInfo(srcFormat).bytesPerBlock != 0)
+      m_kind = Kind::Copy;
+  } else if (getByteOrder(srcFormat, srcOrder, srcType) &&
+             getByteOrder(dstFormat, dstOrder, dstType)) {
+    if (srcType != dstType)
+      return false;
+    m_shuffle.srcBytes = srcOrder < 2 ? 3 : 4;
+    m_shuffle.dstBytes = dstOrder < 2 ? 3 : 4;
+    m_shuffle.fill = byteTypeAlphaOne[srcType];
+    for (uint32_t c = 0; c < m_shuffle.dstBytes; ++c) {
+      m_shuffle.map[c] = 0xFF;
+      for (uint32_t s = 0; s < m_shuffle.srcBytes; ++s)
+        if (byteOrderChannels[srcOrder][s] == byteOrderChannels[dstOrder][c])
+          m_shuffle.map[c] = s;
+    }
+    m_kind = Kind::Bytes;
+  } else if (getHalfFormat(srcFormat) == dstFormat) {
+    m_componentCount = getFormatInfo(srcFormat).componentCount;
+    m_kind = Kind::Half;
+  } else if (srcFormat == VK_FORMAT_R32G32B32A32_SFLOAT &&
+             (dstFormat == VK_FORMAT_R8G8B8A8_SRGB ||
+              dstFormat == VK_FORMAT_B8G8R8A8_SRGB)) {
+    m_swapRedBlue = dstFormat == VK_FORMAT_B8G8R8A8_SRGB;
+    m_kind = Kind::Srgb;
+  }
+  return m_kind != Kind::None;
+}
+
+void vdu::PixelConverter::convert(const void *src, void *dst,
+                                  size_t pixelCount) {
+  auto level = getInstructionSetLevel();
+  size_t done = 0;
+
+  switch (m_kind) {
+  case Kind::Copy:
+    memcpy(dst, src, getDestinationSize(pixelCount));
+    break;
+  case Kind::Bytes: {
+    auto s = (const uint8_t *)src;
+    auto d = (uint8_t *)dst;
+    auto &b = m_shuffle;
+#ifdef VDU_PIXEL_SIMD
+    if (level == InstructionSet::Avx2)
+      done = convertBytesAvx2(s, d, pixelCount, b.map, b.srcBytes, b.dstBytes,
+                              b.fill);
+    else if (level == InstructionSet::Sse41)
+      done = convertBytesSse41(s, d, pixelCount, b.map, b.srcBytes, b.dstBytes,
+                               b.fill);
+#endif
+    convertBytesScalar(s + done * b.srcBytes, d + done * b.dstBytes,
+                       pixelCount - done, b.map, b.srcBytes, b.dstBytes,
+                       b.fill);
+    break;
+  }
+  case Kind::Half: {
+    auto s = (const float *)src;
+    auto d = (uint16_t *)dst;
+    size_t count = pixelCount * m_componentCount;
+#ifdef VDU_PIXEL_SIMD
+    if (level == InstructionSet::Avx2)
+      done = convertHalfAvx2(s, d, count);
+    else if (level == InstructionSet::Sse41)
+      done = convertHalfSse41(s, d, count);
+#endif
+    convertHalfScalar(s + done, d + done, count - done);
+    break;
+  }
+  case Kind::Srgb: {
+    auto s = (const float *)src;
+    auto d = (uint8_t *)dst;
+#ifdef VDU_PIXEL_SIMD
+    if (level == InstructionSet::Avx2)
+      done = encodeSrgbAvx2(s, d, pixelCount, m_swapRedBlue);
+    else if (level == InstructionSet::Sse41)
+      done = encodeSrgbSse41(s, d, pixelCount, m_swapRedBlue);
+#endif
+    encodeSrgbScalar(s + done * 4, d + done * 4, pixelCount - done,
+                     m_swapRedBlue);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+VkDeviceSize vdu::PixelConverter::getSourceSize(size_t pixelCount) {
+  return VkDeviceSize(pixelCount) * getFormatInfo(m_srcFormat).bytesPerBlock;
+}
+
+VkDeviceSize vdu::PixelConverter::getDestinationSize(size_t pixelCount) {
+  return VkDeviceSize(pixelCount) * getFormatInfo(m_dstFormat).bytesPerBlock;
+}
+
+const char *vdu::PixelConverter::getInstructionSet() {
+  switch (getInstructionSetLevel()) {
+  case InstructionSet::Avx2:
+    return "AVX2";
+  case InstructionSet::Sse41:
+    return "SSE4.1";
+  default:
+    return "Scalar";
+  }
+}
+
+std::vector<VkFormat> vdu::PixelConverter::getCandidates(VkFormat srcFormat) {
+  std::vector<VkFormat> candidates = {srcFormat};
+  uint32_t order, type;
+  if (getByteOrder(srcFormat, order, type)) {
+    // Keep alpha, prefer the same channel order
+    if (order != 2)
+      candidates.push_back(getByteFormat(order == 1 ? 3 : 2, type));
+    if (order != 3)
+      candidates.push_back(getByteFormat(order == 1 ? 2 : 3, type));
+    if (order < 2)
+      candidates.push_back(getByteFormat(1 - order, type));
+  } else if (getHalfFormat(srcFormat) != VK_FORMAT_UNDEFINED) {
+    candidates.push_back(getHalfFormat(srcFormat));
+  }
+  return candidates;
+}
@@ -0,0 +1,255 @@
+#include "Readback.hpp"
+#include "LogicalDevice.hpp"
+#include "Queue.hpp"
+#include "QueueFamily.hpp"
+
+void vdu::Readback::create(LogicalDevice *logicalDevice, Queue *queue) {
+  m_logicalDevice = logicalDevice;
+  m_queue = queue;
+
+  m_commandPool.setQueueFamily(m_queue->getFamily());
+  m_commandPool.setFlags(VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+  m_commandPool.create(m_logicalDevice);
+}
+
+void vdu::Readback::destroy() {
+  if (!m_logicalDevice)
+    return;
+  for (auto &request : m_requests)
+    if (!request.second.ready)
+      request.second.slot->fence.wait();
+  m_requests.clear();
+
+  for (auto &slot : m_slots) {
+    slot.commandBuffer.free();
+    slot.fence.destroy();
+  }
+  m_slots.clear();
+  m_freeSlots.clear();
+  for (auto &buffer : m_buffers)
+    buffer.destroy();
+  m_buffers.clear();
+  m_freeBuffers.clear();
+  m_pooledBytes = 0;
+  m_commandPool.destroy();
+}
+
+vdu::Readback::Handle
+vdu::Readback::requestBuffer(Buffer *src, VkDeviceSize size,
+                             VkDeviceSize srcOffset, const Semaphore *wait,
+                             VkPipelineStageFlags waitStage) {
+  Request request;
+  request.size = size;
+  request.buffer = acquireBuffer(size);
+  if (!request.buffer)
+    return 0;
+  request.slot = acquireSlot();
+
+  VkBufferCopy region = {};
+  region.srcOffset = srcOffset;
+  region.size = size;
+  vkCmdCopyBuffer(request.slot->commandBuffer.getHandle(), src->getHandle(),
+                  request.buffer->getHandle(), 1, &region);
+  return submit(request, wait, waitStage);
+}
+
+vdu::Readback::Handle vdu::Readback::requestTexture(
+    Texture *src, VkImageLayout layout, uint32_t mipLevel, uint32_t baseLayer,
+    uint32_t layerCount, VkOffset3D offset, VkExtent3D extent,
+    const Semaphore *wait, VkPipelineStageFlags waitStage) {
+  auto packed =
+      src->getPackedLayout(mipLevel, 1, baseLayer, layerCount, offset, extent);
+  if (!packed.size)
+    return 0;
+
+  std::vector<VkBufferImageCopy> regions;
+  src->getUploadRegions(packed, regions);
+
+  // Rows of the colour or depth plane, the stencil plane follows it
+  auto &info = src->getFormatInfo();
+  auto &mipExtent = regions.front().imageExtent;
+  auto aspect = (src->getAspectFlags() & VK_IMAGE_ASPECT_DEPTH_BIT)
+                    ? VK_IMAGE_ASPECT_DEPTH_BIT
+                    : VK_IMAGE_ASPECT_COLOR_BIT;
+
+  Request request;
+  request.size = packed.size;
+  request.rowPitch =
+      VkDeviceSize(info.getBlockCount(mipExtent.width, info.blockWidth)) *
+      src->getAspectTexelSize(aspect);
+  request.rowCount = info.getBlockCount(mipExtent.height, info.blockHeight) *
+                     mipExtent.depth * packed.layerCount;
+  request.buffer = acquireBuffer(packed.size);
+  if (!request.buffer)
+    return 0;
+  request.slot = acquireSlot();
+
+  vkCmdCopyImageToBuffer(request.slot->commandBuffer.getHandle(),
+                         src->getHandle(), layout,
+                         request.buffer->getHandle(), regions.size(),
+                         regions.data());
+  return submit(request, wait, waitStage);
+}
+
+bool vdu::Readback::isReady(Handle handle) {
+  auto request = find(handle);
+  if (!request)
+    return false;
+  if (!request->ready && request->slot->fence.isSignalled())
+    request->ready = true;
+  return request->ready;
+}
+
+void vdu::Readback::wait(Handle handle) {
+  auto request = find(handle);
+  if (!request || request->ready)
+    return;
+  request->slot->fence.wait();
+  request->ready = true;
+}
+
+const void *vdu::Readback::getData(Handle handle) {
+  if (!isReady(handle))
+    return nullptr;
+  auto request = find(handle);
+  auto memory = request->buffer->getMemory();
+  if (!request->invalidated) {
+    memory->invalidate(0, request->size);
+    request->invalidated = true;
+  }
+  return memory->map();
+}
+
+VkDeviceSize vdu::Readback::getSize(Handle handle) {
+  auto request = find(handle);
+  return request ? request->size : 0;
+}
+
+VkDeviceSize vdu::Readback::getRowPitch(Handle handle) {
+  auto request = find(handle);
+  return request ? request->rowPitch : 0;
+}
+
+uint32_t vdu::Readback::getRowCount(Handle handle) {
+  auto request = find(handle);
+  return request ? request->rowCount : 0;
+}
+
+bool vdu::Readback::copyRows(Handle handle, void *dst,
+                             VkDeviceSize dstRowPitch) {
+  auto src = (const char *)getData(handle);
+  if (!src)
+    return false;
+  auto request = find(handle);
+  auto rowPitch = request->rowPitch;
+  if (!dstRowPitch)
+    dstRowPitch = rowPitch;
+  if (dstRowPitch == rowPitch) {
+    memcpy(dst, src, rowPitch * request->rowCount);
+    return true;
+  }
+  for (uint32_t i = 0; i < request->rowCount; ++i)
+    memcpy((char *)dst + i * dstRowPitch, src + i * rowPitch,
+           std::min(rowPitch, dstRowPitch));
+  return true;
+}
+
+void vdu::Readback::release(Handle handle) {
+  auto it = m_requests.find(handle);
+  if (it == m_requests.end())
+    return;
+  auto &request = it->second;
+  if (!request.ready)
+    request.slot->fence.wait();
+  m_freeSlots.push_back(request.slot);
+  m_freeBuffers.emplace(request.buffer->getSize(), request.buffer);
+  m_requests.erase(it);
+}
+
+uint32_t vdu::Readback::getInFlightCount() {
+  uint32_t count = 0;
+  for (auto &request : m_requests)
+    if (!isReady(request.first))
+      ++count;
+  return count;
+}
+
+vdu::Readback::Request *vdu::Readback::find(Handle handle) {
+  auto it = m_requests.find(handle);
+  if (it == m_requests.end()) {
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Warning,
+        "Unknown or released readback handle");
+    return nullptr;
+  }
+  return &it->second;
+}
+
+vdu::Readback::Slot *vdu::Readback::acquireSlot() {
+  Slot *slot;
+  if (m_freeSlots.empty()) {
+    m_slots.emplace_back();
+    slot = &m_slots.back();
+    slot->commandBuffer.allocate(m_logicalDevice, &m_commandPool);
+    slot->fence.create(m_logicalDevice);
+  } else {
+    slot = m_freeSlots.back();
+    m_freeSlots.pop_back();
+    slot->commandBuffer.reset();
+    slot->fence.reset();
+  }
+  slot->commandBuffer.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  return slot;
+}
+
+vdu::Buffer *vdu::Readback::acquireBuffer(VkDeviceSize size) {
+  // Smallest pooled buffer that fits, unless it would waste over half of it
+  auto it = m_freeBuffers.lower_bound(size);
+  if (it != m_freeBuffers.end() && it->first / 2 <= size) {
+    auto buffer = it->second;
+    m_freeBuffers.erase(it);
+    return buffer;
+  }
+
+  m_buffers.emplace_back();
+  auto buffer = &m_buffers.back();
+  buffer->setUsage(VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  buffer->setMemoryUsage(MemoryUsage::GpuToCpu);
+  buffer->create(m_logicalDevice, size);
+  if (!buffer->getMemory()) {
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Error,
+        "Failed to create readback buffer");
+    m_buffers.pop_back();
+    return nullptr;
+  }
+  m_pooledBytes += size;
+  return buffer;
+}
+
+vdu::Readback::Handle vdu::Readback::submit(Request &request,
+                                            const Semaphore *wait,
+                                            VkPipelineStageFlags waitStage) {
+  auto &cmd = request.slot->commandBuffer;
+
+  // Make the copy visible to the host once the fence has signalled
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(cmd.getHandle(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr,
+                       0, nullptr);
+  cmd.end();
+
+  QueueSubmission submission;
+  submission.addCommands(&cmd);
+  if (wait)
+    submission.addWait(*wait, waitStage);
+  VDU_VK_CHECK_RESULT(m_queue->submit(submission, request.slot->fence),
+                      "submitting readback");
+
+  auto handle = m_nextHandle++;
+  m_requests[handle] = request;
+  return handle;
+}
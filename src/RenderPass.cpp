@@ -68,6 +68,10 @@ vdu::RenderPass::addColourAttachment(vdu::Texture *texture, std::string name) {
   m_attachmentInfos[name]->setFormat(texture->getFormat());
   m_attachmentInfos[name]->setAttachmentIndex(m_attachments.size() - 1 +
                                               (m_depthAttachment ? 1 : 0));
+  if (texture->isTransient()) {
+    m_attachmentInfos[name]->setLoadOp(VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+    m_attachmentInfos[name]->setStoreOp(VK_ATTACHMENT_STORE_OP_DONT_CARE);
+  }
 
   return insertion.first->second;
 }
@@ -93,6 +97,9 @@ vdu::RenderPass::setDepthAttachment(vdu::Texture *texture) {
 
   m_depthAttachmentInfo->setFormat(texture->getFormat());
   m_depthAttachmentInfo->setAttachmentIndex(m_attachments.size());
+  // Clearing is as free as not loading on tilers and depth testing needs it
+  if (texture->isTransient())
+    m_depthAttachmentInfo->setStoreOp(VK_ATTACHMENT_STORE_OP_DONT_CARE);
 
   return m_depthAttachmentInfo;
 }
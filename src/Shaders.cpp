@@ -2,8 +2,8 @@
 #include "Initializers.hpp"
 
 vdu::ShaderModule::ShaderModule()
-    : m_stage(ShaderStage(0)), m_language(ShaderLanguage::UNKNOWN), m_module(0),
-      m_logicalDevice(nullptr) {}
+    : m_stage(ShaderStage(0)), m_language(ShaderLanguage::UNKNOWN),
+      m_fromSource(false), m_module(0), m_logicalDevice(nullptr) {}
 
 void vdu::ShaderModule::create(ShaderStage stage, const std::string &path,
                                LogicalDevice **logicalDevice) {
@@ -14,6 +14,19 @@ void vdu::ShaderModule::create(ShaderStage stage, const std::string &path,
   load();
 }
 
+void vdu::ShaderModule::createFromSource(ShaderStage stage,
+                                         const std::string &glslSource,
+                                         const std::string &name,
+                                         LogicalDevice **logicalDevice) {
+  m_stage = stage;
+  m_path = name;
+  m_fromSource = true;
+  m_language = ShaderLanguage::GLSL;
+  m_glslSource = glslSource;
+  m_logicalDevice = logicalDevice;
+  setIntStage();
+}
+
 void vdu::ShaderModule::removeMacroDefinition(const std::string &define) {
   m_macroDefinitions.erase(define);
 }
@@ -24,6 +37,8 @@ void vdu::ShaderModule::setMacroDefinition(const std::string &define,
 }
 
 void vdu::ShaderModule::load() {
+  if (m_fromSource)
+    return;
   determineLanguage();
 
   std::fstream file;
@@ -172,6 +187,13 @@ void vdu::ShaderProgram::addModule(ShaderStage stage, const std::string &path) {
   m_modules.back().create(stage, path, &m_logicalDevice);
 }
 
+void vdu::ShaderProgram::addModuleFromSource(ShaderStage stage,
+                                             const std::string &glslSource,
+                                             const std::string &name) {
+  m_modules.push_back(ShaderModule());
+  m_modules.back().createFromSource(stage, glslSource, name, &m_logicalDevice);
+}
+
 void vdu::ShaderProgram::reload() {
   for (auto &m : m_modules) {
     m.load();
@@ -0,0 +1,261 @@
+#include "TextureStreamer.hpp"
+#include "KtxFile.hpp"
+#include "LogicalDevice.hpp"
+#include "Synchro.hpp"
+#include "UploadManager.hpp"
+
+void vdu::TextureStreamer::create(LogicalDevice *logicalDevice,
+                                  UploadManager *uploader,
+                                  uint32_t maxTextures) {
+  m_logicalDevice = logicalDevice;
+  m_uploader = uploader;
+  m_textures.resize(maxTextures);
+
+  m_minLods.setUsage(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  m_minLods.setMemoryProperty(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  m_minLods.create(m_logicalDevice, maxTextures * sizeof(float));
+  if (!m_minLods.getMemory())
+    return;
+
+  m_minLodData = static_cast<float *>(m_minLods.getMemory()->map());
+  memset(m_minLodData, 0, maxTextures * sizeof(float));
+}
+
+void vdu::TextureStreamer::destroy() {
+  if (!m_logicalDevice)
+    return;
+  m_minLods.destroy();
+  m_minLodData = nullptr;
+  m_textures.clear();
+  m_queued.clear();
+  m_residentBytes = 0;
+}
+
+uint32_t vdu::TextureStreamer::addTexture(Texture *texture, Loader loader,
+                                          VkImageLayout oldLayout) {
+  auto slot = std::find_if(
+      m_textures.begin(), m_textures.end(),
+      [](const StreamedTexture &streamed) { return !streamed.texture; });
+  if (slot == m_textures.end()) {
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Warning,
+        "Texture streamer has no free texture slot");
+    return ~0u;
+  }
+  uint32_t index = slot - m_textures.begin();
+
+  auto &streamed = *slot;
+  streamed.texture = texture;
+  streamed.loader = loader;
+  streamed.screenSize = 0.f;
+
+  auto mipCount = texture->getNumMipLevels();
+  auto largest = std::max(texture->getWidth(), texture->getHeight());
+  streamed.initialMip = 0;
+  while (streamed.initialMip + 1 < mipCount &&
+         (largest >> streamed.initialMip) > m_initialSize)
+    ++streamed.initialMip;
+
+  // Coarsest first, nothing is sampleable until the whole tail has landed
+  streamed.residentMip = mipCount;
+  streamed.pendingMip = mipCount;
+  for (auto mip = mipCount; mip-- > streamed.initialMip;)
+    if (!queueMip(streamed, mip, oldLayout)) {
+      for (mip = streamed.pendingMip; mip < mipCount; ++mip)
+        m_residentBytes -= getMipSize(texture, mip);
+      streamed = StreamedTexture();
+      return ~0u;
+    }
+  // The view covers the whole chain, finer mips must be in its layout too
+  if (streamed.initialMip > 0)
+    m_uploader->queueTransition(texture, 0, streamed.initialMip, 0,
+                                texture->getLayers(), oldLayout);
+  m_queued.push_back(index);
+  writeMinLod(index);
+  return index;
+}
+
+uint32_t vdu::TextureStreamer::addTexture(Texture *texture, KtxFile *file,
+                                          VkImageLayout oldLayout) {
+  if (file->getLevelCount() < texture->getNumMipLevels()) {
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Error,
+        "KTX2 file has fewer levels than the streamed texture");
+    return ~0u;
+  }
+  return addTexture(
+      texture,
+      [file](uint32_t mipLevel, void *dst, VkDeviceSize size) {
+        return size == file->getLevelSize(mipLevel) &&
+               file->copyLevel(mipLevel, dst);
+      },
+      oldLayout);
+}
+
+void vdu::TextureStreamer::removeTexture(uint32_t index) {
+  auto &streamed = m_textures[index];
+  if (!streamed.texture)
+    return;
+  auto mipCount = streamed.texture->getNumMipLevels();
+  for (auto mip = std::min(streamed.pendingMip, streamed.residentMip);
+       mip < mipCount; ++mip)
+    m_residentBytes -= getMipSize(streamed.texture, mip);
+
+  streamed = StreamedTexture();
+  m_minLodData[index] = 0.f;
+  m_queued.erase(std::remove(m_queued.begin(), m_queued.end(), index),
+                 m_queued.end());
+}
+
+void vdu::TextureStreamer::setScreenSize(uint32_t index, float pixels) {
+  m_textures[index].screenSize = pixels;
+}
+
+void vdu::TextureStreamer::update() {
+  for (uint32_t i = 0; i < m_textures.size(); ++i) {
+    auto &streamed = m_textures[i];
+    if (!streamed.texture || streamed.pendingMip == streamed.residentMip ||
+        !streamed.fence || !streamed.fence->isSignalled())
+      continue;
+    streamed.residentMip = streamed.pendingMip;
+    streamed.fence = nullptr;
+    writeMinLod(i);
+  }
+
+  struct Request {
+    float priority;
+    uint32_t index;
+    bool operator<(const Request &other) const {
+      return priority < other.priority;
+    }
+  };
+
+  // Larger on screen and further from the wanted mip goes first
+  std::priority_queue<Request> requests;
+  for (uint32_t i = 0; i < m_textures.size(); ++i) {
+    auto &streamed = m_textures[i];
+    if (!streamed.texture || streamed.pendingMip != streamed.residentMip)
+      continue;
+    auto wantedMip = getWantedMip(streamed);
+    if (wantedMip < streamed.residentMip)
+      requests.push({streamed.screenSize *
+                         float(streamed.residentMip - wantedMip),
+                     i});
+  }
+
+  VkDeviceSize uploaded = 0;
+  while (!requests.empty()) {
+    auto index = requests.top().index;
+    requests.pop();
+
+    auto &streamed = m_textures[index];
+    auto mip = streamed.residentMip - 1;
+    auto size = getMipSize(streamed.texture, mip);
+    if (uploaded > 0 && uploaded + size > m_uploadBudget)
+      break;
+    if (m_residentBytes + size > m_residentBudget &&
+        !evict(m_residentBytes + size - m_residentBudget))
+      continue;
+    // Never uploaded or dropped, the old contents are discarded either way
+    if (!queueMip(streamed, mip, VK_IMAGE_LAYOUT_UNDEFINED))
+      continue;
+    uploaded += size;
+    m_queued.push_back(index);
+  }
+
+  if (m_queued.empty())
+    return;
+  m_uploader->flush();
+  for (auto index : m_queued)
+    m_textures[index].fence = m_uploader->getLastFence();
+  m_queued.clear();
+}
+
+float vdu::TextureStreamer::getMinLod(uint32_t index) {
+  auto &streamed = m_textures[index];
+  if (!streamed.texture)
+    return 0.f;
+  // Nothing has landed yet, the texture must not be sampled at all
+  if (streamed.residentMip >= streamed.texture->getNumMipLevels())
+    return -1.f;
+  return float(streamed.residentMip);
+}
+
+uint32_t vdu::TextureStreamer::getResidentMip(uint32_t index) {
+  return m_textures[index].residentMip;
+}
+
+uint32_t vdu::TextureStreamer::getWantedMip(const StreamedTexture &streamed) {
+  if (streamed.screenSize <= 0.f)
+    return streamed.initialMip;
+  auto largest = std::max(streamed.texture->getWidth(),
+                          streamed.texture->getHeight());
+  uint32_t mip = 0;
+  while (mip < streamed.initialMip &&
+         float(largest >> (mip + 1)) >= streamed.screenSize)
+    ++mip;
+  return mip;
+}
+
+VkDeviceSize vdu::TextureStreamer::getMipSize(Texture *texture,
+                                              uint32_t mipLevel) {
+  return texture->getPackedLayout(mipLevel, 1).size;
+}
+
+bool vdu::TextureStreamer::queueMip(StreamedTexture &streamed,
+                                    uint32_t mipLevel,
+                                    VkImageLayout oldLayout) {
+  auto texture = streamed.texture;
+  auto layout = texture->getPackedLayout(mipLevel, 1);
+  auto staging = m_uploader->allocateStaging(
+      layout.size, m_uploader->getStagingAlignment(texture));
+  if (!staging.data || !streamed.loader(mipLevel, staging.data, layout.size) ||
+      !m_uploader->queueCopy(staging, texture, layout, oldLayout))
+    return false;
+  streamed.pendingMip = mipLevel;
+  m_residentBytes += layout.size;
+  return true;
+}
+
+bool vdu::TextureStreamer::evict(VkDeviceSize bytes) {
+  // Only mips finer than a texture currently needs, least visible first
+  std::vector<uint32_t> candidates;
+  VkDeviceSize evictable = 0;
+  for (uint32_t i = 0; i < m_textures.size(); ++i) {
+    auto &streamed = m_textures[i];
+    if (!streamed.texture || streamed.pendingMip != streamed.residentMip)
+      continue;
+    auto wantedMip = getWantedMip(streamed);
+    for (auto mip = streamed.residentMip; mip < wantedMip; ++mip)
+      evictable += getMipSize(streamed.texture, mip);
+    if (wantedMip > streamed.residentMip)
+      candidates.push_back(i);
+  }
+  // Dropping mips that would not make room only costs a later upload
+  if (evictable < bytes)
+    return false;
+  std::sort(candidates.begin(), candidates.end(), [&](uint32_t a, uint32_t b) {
+    return m_textures[a].screenSize < m_textures[b].screenSize;
+  });
+
+  VkDeviceSize freed = 0;
+  for (auto index : candidates) {
+    auto &streamed = m_textures[index];
+    auto wantedMip = getWantedMip(streamed);
+    while (streamed.residentMip < wantedMip && freed < bytes) {
+      freed += getMipSize(streamed.texture, streamed.residentMip);
+      streamed.pendingMip = ++streamed.residentMip;
+    }
+    writeMinLod(index);
+    if (freed >= bytes)
+      break;
+  }
+  m_residentBytes -= freed;
+  return true;
+}
+
+void vdu::TextureStreamer::writeMinLod(uint32_t index) {
+  if (m_minLodData)
+    m_minLodData[index] = getMinLod(index);
+}
@@ -0,0 +1,148 @@
+#include "TransientRing.hpp"
+#include "HostCopy.hpp"
+#include "LogicalDevice.hpp"
+#include "PhysicalDevice.hpp"
+#include "Synchro.hpp"
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+void vdu::TransientRing::setUsage(VkBufferUsageFlags usage) {
+  m_usageFlags = usage;
+}
+
+void vdu::TransientRing::create(LogicalDevice *logicalDevice,
+                                VkDeviceSize size) {
+  m_logicalDevice = logicalDevice;
+
+  auto limits =
+      m_logicalDevice->getPhysicalDevice()->getDeviceProperties().limits;
+  m_alignment = 1;
+  if (m_usageFlags & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
+    m_alignment = limits.minUniformBufferOffsetAlignment;
+  if ((m_usageFlags & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) &&
+      limits.minStorageBufferOffsetAlignment > m_alignment)
+    m_alignment = limits.minStorageBufferOffsetAlignment;
+  if (m_alignment == 0)
+    m_alignment = 1;
+
+  m_size = alignUp(size, m_alignment);
+  m_head = 0;
+  m_usedSize = 0;
+  m_frameSize = 0;
+
+  m_buffer.setUsage(m_usageFlags);
+  m_buffer.setMemoryProperty(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                             VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+  m_buffer.create(m_logicalDevice, m_size);
+  if (!m_buffer.getMemory())
+    return;
+
+  m_mappedData = static_cast<char *>(m_buffer.getMemory()->map());
+}
+
+void vdu::TransientRing::destroy() {
+  if (!m_logicalDevice)
+    return;
+  if (m_mappedData)
+    m_buffer.getMemory()->unmap();
+  m_buffer.destroy();
+  m_mappedData = nullptr;
+  m_inFlightFrames = std::queue<FrameRegion>();
+}
+
+void vdu::TransientRing::beginFrame() { retireFrames(); }
+
+void vdu::TransientRing::endFrame(const Fence *fence) {
+  m_inFlightFrames.push({fence, m_frameSize});
+  m_frameSize = 0;
+}
+
+vdu::TransientRing::Slice vdu::TransientRing::allocate(VkDeviceSize size,
+                                                       VkDeviceSize alignment) {
+  auto slice = tryAllocate(size, alignment);
+  if (!slice.data && m_mappedData)
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Warning,
+        "Transient ring is full, increase its size or retire frames sooner");
+  return slice;
+}
+
+vdu::TransientRing::Slice
+vdu::TransientRing::tryAllocate(VkDeviceSize size, VkDeviceSize alignment) {
+  Slice slice;
+  if (!m_mappedData)
+    return slice;
+
+  if (alignment > 1 && alignment != m_alignment) {
+    // Smallest common multiple of both alignments
+    auto combined = alignment;
+    while (combined % m_alignment)
+      combined += alignment;
+    alignment = combined;
+  } else {
+    alignment = m_alignment;
+  }
+
+  auto offset = alignUp(m_head, alignment);
+  auto consumed = offset - m_head + size;
+  if (offset + size > m_size) {
+    // Wrap around, the tail end of the ring is wasted until retired
+    offset = 0;
+    consumed = m_size - m_head + size;
+  }
+
+  if (m_usedSize + consumed > m_size) {
+    // Retiring may also move the head, place the slice again if it freed space
+    auto usedSize = m_usedSize;
+    retireFrames();
+    if (m_usedSize == usedSize)
+      return slice;
+    return tryAllocate(size, alignment);
+  }
+
+  m_head = offset + size;
+  m_usedSize += consumed;
+  m_frameSize += consumed;
+
+  slice.data = m_mappedData + offset;
+  slice.offset = offset;
+  slice.size = size;
+  return slice;
+}
+
+vdu::TransientRing::Slice vdu::TransientRing::push(const void *data,
+                                                   VkDeviceSize size) {
+  auto slice = allocate(size);
+  if (slice.data)
+    write(slice, data);
+  return slice;
+}
+
+void vdu::TransientRing::write(const Slice &slice, const void *data) {
+  copyToMapped(slice.data, data, slice.size,
+               m_buffer.getMemory()->getMemoryTypeFlags());
+}
+
+VkDescriptorBufferInfo
+vdu::TransientRing::getDescriptorInfo(VkDeviceSize range) {
+  VkDescriptorBufferInfo info = {};
+  info.buffer = m_buffer.getHandle();
+  info.offset = 0;
+  info.range = range;
+  return info;
+}
+
+void vdu::TransientRing::retireFrames() {
+  while (!m_inFlightFrames.empty() &&
+         m_inFlightFrames.front().fence->isSignalled()) {
+    m_usedSize -= m_inFlightFrames.front().size;
+    m_inFlightFrames.pop();
+  }
+  if (m_inFlightFrames.empty() && m_frameSize == 0) {
+    // Nothing in flight, restart at the front to avoid needless wrapping
+    m_head = 0;
+    m_usedSize = 0;
+  }
+}
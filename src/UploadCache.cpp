@@ -0,0 +1,354 @@
+#include "UploadCache.hpp"
+#include "LogicalDevice.hpp"
+#include "UploadManager.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VDU_HASH_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static const uint64_t prime32_1 = 0x9E3779B1u;
+static const uint64_t prime64_1 = 0x9E3779B185EBCA87ull;
+static const uint64_t prime64_2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t prime64_3 = 0x165667B19E3779F9ull;
+
+// 64 byte stripes, the accumulators are scrambled after each 16 stripes
+static const size_t stripeSize = 64;
+static const size_t stripesPerBlock = 16;
+
+/*
+    Stripe n of a block is keyed by entries n to n + 7, the scramble by
+    entries 24 to 31
+*/
+static const uint64_t *getSecret() {
+  static const struct Secret {
+    uint64_t keys[32];
+    Secret() {
+      uint64_t state = prime64_3;
+      for (auto &key : keys) {
+        // splitmix64
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        key = z ^ (z >> 31);
+      }
+    }
+  } secret;
+  return secret.keys;
+}
+
+static uint64_t read64(const uint8_t *data) {
+  uint64_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static uint64_t multiplyFold(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+  auto product = (unsigned __int128)a * b;
+  return uint64_t(product) ^ uint64_t(product >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  uint64_t high;
+  uint64_t low = _umul128(a, b, &high);
+  return low ^ high;
+#else
+  uint64_t aLow = a & 0xFFFFFFFF, aHigh = a >> 32;
+  uint64_t bLow = b & 0xFFFFFFFF, bHigh = b >> 32;
+  uint64_t lowLow = aLow * bLow, highLow = aHigh * bLow;
+  uint64_t lowHigh = aLow * bHigh, highHigh = aHigh * bHigh;
+  uint64_t cross = (lowLow >> 32) + (highLow & 0xFFFFFFFF) + lowHigh;
+  uint64_t high = highHigh + (highLow >> 32) + (cross >> 32);
+  uint64_t low = (cross << 32) | (lowLow & 0xFFFFFFFF);
+  return low ^ high;
+#endif
+}
+
+static void accumulateScalar(uint64_t *acc, const uint8_t *stripes,
+                             size_t count, const uint64_t *keys) {
+  for (size_t s = 0; s < count; ++s) {
+    for (int i = 0; i < 8; ++i) {
+      uint64_t value = read64(stripes + s * stripeSize + i * 8);
+      uint64_t keyed = value ^ keys[s + i];
+      acc[i ^ 1] += value;
+      acc[i] += (keyed & 0xFFFFFFFF) * (keyed >> 32);
+    }
+  }
+}
+
+static void scrambleScalar(uint64_t *acc, const uint64_t *keys) {
+  for (int i = 0; i < 8; ++i) {
+    acc[i] ^= acc[i] >> 47;
+    acc[i] ^= keys[i];
+    acc[i] *= prime32_1;
+  }
+}
+
+#if defined(VDU_HASH_SIMD) && defined(__AVX2__)
+
+static void accumulate(uint64_t *acc, const uint8_t *stripes, size_t count,
+                       const uint64_t *keys) {
+  auto a0 = _mm256_loadu_si256((const __m256i *)acc);
+  auto a1 = _mm256_loadu_si256((const __m256i *)acc + 1);
+  for (size_t s = 0; s < count; ++s) {
+    auto stripe = (const __m256i *)(stripes + s * stripeSize);
+    auto key = (const __m256i *)(keys + s);
+    auto v0 = _mm256_loadu_si256(stripe);
+    auto v1 = _mm256_loadu_si256(stripe + 1);
+    auto k0 = _mm256_xor_si256(v0, _mm256_loadu_si256(key));
+    auto k1 = _mm256_xor_si256(v1, _mm256_loadu_si256(key + 1));
+    auto p0 = _mm256_mul_epu32(k0, _mm256_shuffle_epi32(k0, 0x31));
+    auto p1 = _mm256_mul_epu32(k1, _mm256_shuffle_epi32(k1, 0x31));
+    a0 = _mm256_add_epi64(
+        a0, _mm256_add_epi64(p0, _mm256_shuffle_epi32(v0, 0x4E)));
+    a1 = _mm256_add_epi64(
+        a1, _mm256_add_epi64(p1, _mm256_shuffle_epi32(v1, 0x4E)));
+  }
+  _mm256_storeu_si256((__m256i *)acc, a0);
+  _mm256_storeu_si256((__m256i *)acc + 1, a1);
+}
+
+static void scramble(uint64_t *acc, const uint64_t *keys) {
+  auto prime = _mm256_set1_epi32(int(prime32_1));
+  for (int i = 0; i < 2; ++i) {
+    auto a = _mm256_loadu_si256((const __m256i *)acc + i);
+    a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+    a = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i *)keys + i));
+    auto low = _mm256_mul_epu32(a, prime);
+    auto high = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), prime);
+    a = _mm256_add_epi64(low, _mm256_slli_epi64(high, 32));
+    _mm256_storeu_si256((__m256i *)acc + i, a);
+  }
+}
+
+#elif defined(VDU_HASH_SIMD)
+
+static void accumulate(uint64_t *acc, const uint8_t *stripes, size_t count,
+                       const uint64_t *keys) {
+  __m128i a[4];
+  for (int i = 0; i < 4; ++i)
+    a[i] = _mm_loadu_si128((const __m128i *)acc + i);
+  for (size_t s = 0; s < count; ++s) {
+    for (int i = 0; i < 4; ++i) {
+      auto value =
+          _mm_loadu_si128((const __m128i *)(stripes + s * stripeSize) + i);
+      auto keyed = _mm_xor_si128(
+          value, _mm_loadu_si128((const __m128i *)(keys + s) + i));
+      // Low times high half of each keyed lane, each lane's value is added
+      // to its neighbour
+      auto product = _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, 0x31));
+      auto swapped = _mm_shuffle_epi32(value, 0x4E);
+      a[i] = _mm_add_epi64(a[i], _mm_add_epi64(product, swapped));
+    }
+  }
+  for (int i = 0; i < 4; ++i)
+    _mm_storeu_si128((__m128i *)acc + i, a[i]);
+}
+
+static void scramble(uint64_t *acc, const uint64_t *keys) {
+  auto prime = _mm_set1_epi32(int(prime32_1));
+  for (int i = 0; i < 4; ++i) {
+    auto a = _mm_loadu_si128((const __m128i *)acc + i);
+    a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+    a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i *)keys + i));
+    // 64 by 32 bit multiply from two 32 by 32 bit ones
+    auto low = _mm_mul_epu32(a, prime);
+    auto high = _mm_mul_epu32(_mm_srli_epi64(a, 32), prime);
+    a = _mm_add_epi64(low, _mm_slli_epi64(high, 32));
+    _mm_storeu_si128((__m128i *)acc + i, a);
+  }
+}
+
+#else
+
+static void accumulate(uint64_t *acc, const uint8_t *stripes, size_t count,
+                       const uint64_t *keys) {
+  accumulateScalar(acc, stripes, count, keys);
+}
+
+static void scramble(uint64_t *acc, const uint64_t *keys) {
+  scrambleScalar(acc, keys);
+}
+
+#endif
+
+uint64_t vdu::UploadCache::hash(const void *data, size_t size,
+                                uint64_t seed) {
+  auto bytes = (const uint8_t *)data;
+  auto secret = getSecret();
+  uint64_t acc[8] = {prime32_1, prime64_1, prime64_2, prime64_3,
+                     ~prime32_1, ~prime64_1, ~prime64_2, ~prime64_3};
+
+  size_t stripeCount = size / stripeSize;
+  size_t blockSize = stripeSize * stripesPerBlock;
+  for (size_t block = 0; block < stripeCount / stripesPerBlock; ++block) {
+    accumulate(acc, bytes + block * blockSize, stripesPerBlock, secret);
+    scramble(acc, secret + 24);
+  }
+  size_t stripesLeft = stripeCount % stripesPerBlock;
+  accumulate(acc, bytes + size / blockSize * blockSize, stripesLeft, secret);
+
+  // The remainder is zero padded, the size below tells the two apart
+  size_t remainder = size % stripeSize;
+  if (remainder) {
+    uint8_t last[stripeSize] = {};
+    memcpy(last, bytes + stripeCount * stripeSize, remainder);
+    accumulate(acc, last, 1, secret + stripesLeft);
+  }
+
+  uint64_t result = (size * prime64_1) ^ seed;
+  for (int i = 0; i < 4; ++i)
+    result += multiplyFold(acc[i * 2] ^ secret[i * 2 + 8],
+                           acc[i * 2 + 1] ^ secret[i * 2 + 9]);
+
+  result ^= result >> 37;
+  result *= prime64_3;
+  return result ^ (result >> 32);
+}
+
+void vdu::UploadCache::create(LogicalDevice *logicalDevice,
+                              UploadManager *uploader) {
+  m_logicalDevice = logicalDevice;
+  m_uploader = uploader;
+}
+
+void vdu::UploadCache::destroy() {
+  for (auto &entry : m_entries) {
+    if (entry.first.texture) {
+      m_uploader->forget(&entry.second.texture);
+      entry.second.texture.destroy();
+    } else {
+      m_uploader->forget(&entry.second.buffer);
+      entry.second.buffer.destroy();
+    }
+  }
+  m_entries.clear();
+  m_keys.clear();
+  m_residentBytes = 0;
+}
+
+vdu::Buffer *vdu::UploadCache::acquireBuffer(const void *data,
+                                             VkDeviceSize size,
+                                             VkBufferUsageFlags usage) {
+  usage |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  Key key = {hash(data, size), uint64_t(usage), size, false};
+  if (auto entry = find(key))
+    return &entry->buffer;
+
+  auto &entry = m_entries[key];
+  auto buffer = &entry.buffer;
+  buffer->setUsage(usage);
+  buffer->setMemoryProperty(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  buffer->create(m_logicalDevice, size);
+  if (!buffer->getMemory() || !m_uploader->uploadBuffer(buffer, data, size)) {
+    if (buffer->getMemory())
+      buffer->destroy();
+    m_entries.erase(key);
+    return nullptr;
+  }
+
+  entry.references = 1;
+  m_keys[buffer] = key;
+  m_residentBytes += size;
+  ++m_missCount;
+  return buffer;
+}
+
+vdu::Texture *vdu::UploadCache::acquireTexture(const TextureCreateInfo &info,
+                                               const void *data,
+                                               VkDeviceSize size) {
+  auto ci = info;
+  ci.usageFlags |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+  uint32_t parameters[] = {ci.width,
+                           ci.height,
+                           ci.depth,
+                           ci.layers,
+                           ci.numMipLevels,
+                           uint32_t(ci.format),
+                           uint32_t(ci.layout),
+                           ci.aspectFlags,
+                           ci.usageFlags,
+                           uint32_t(ci.tiling),
+                           ci.memoryProperties,
+                           uint32_t(ci.memoryUsage)};
+  Key key = {hash(data, size), hash(parameters, sizeof(parameters)), size,
+             true};
+  if (auto entry = find(key))
+    return &entry->texture;
+
+  auto &entry = m_entries[key];
+  auto texture = &entry.texture;
+  texture->setProperties(ci);
+  texture->create(m_logicalDevice);
+  if (!texture->getMemory()) {
+    m_entries.erase(key);
+    return nullptr;
+  }
+
+  auto layout = texture->getPackedLayout();
+  bool uploaded = false;
+  if (layout.size != size)
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Error,
+        "Cached texture data does not match its create info");
+  else
+    uploaded = m_uploader->uploadTexture(texture, data, layout);
+  if (!uploaded) {
+    texture->destroy();
+    m_entries.erase(key);
+    return nullptr;
+  }
+
+  entry.references = 1;
+  m_keys[texture] = key;
+  m_residentBytes += size;
+  ++m_missCount;
+  return texture;
+}
+
+void vdu::UploadCache::release(Buffer *buffer) {
+  release((const void *)buffer);
+}
+
+void vdu::UploadCache::release(Texture *texture) {
+  release((const void *)texture);
+}
+
+vdu::UploadCache::Entry *vdu::UploadCache::find(const Key &key) {
+  auto entry = m_entries.find(key);
+  if (entry == m_entries.end())
+    return nullptr;
+  ++entry->second.references;
+  ++m_hitCount;
+  m_bytesSaved += key.size;
+  return &entry->second;
+}
+
+void vdu::UploadCache::release(const void *resource) {
+  auto key = m_keys.find(resource);
+  if (key == m_keys.end()) {
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Warning,
+        "Releasing a resource that is not in the upload cache");
+    return;
+  }
+
+  auto entry = m_entries.find(key->second);
+  if (--entry->second.references > 0)
+    return;
+  if (entry->first.texture) {
+    m_uploader->forget(&entry->second.texture);
+    entry->second.texture.destroy();
+  } else {
+    m_uploader->forget(&entry->second.buffer);
+    entry->second.buffer.destroy();
+  }
+  m_residentBytes -= entry->first.size;
+  m_entries.erase(entry);
+  m_keys.erase(key);
+}
@@ -0,0 +1,695 @@
+#include "UploadManager.hpp"
+#include "LogicalDevice.hpp"
+#include "PixelConverter.hpp"
+#include "Queue.hpp"
+#include "QueueFamily.hpp"
+
+// Flushes whose ownership releases have not been acquired yet, each keeps
+// its submission (and semaphore) out of reuse
+static const size_t maxUnacquiredFlushes = 16;
+
+// Copies on queues with a coarse granularity must start on a multiple of it and
+// either span a multiple of it or reach the edge of the subresource
+static bool respectsGranularity(int32_t offset, uint32_t extent, uint32_t size,
+                                uint32_t granularity) {
+  if (granularity == 0)
+    return offset == 0 && extent == size;
+  return offset % granularity == 0 &&
+         (extent % granularity == 0 || offset + extent == size);
+}
+
+void vdu::UploadManager::create(LogicalDevice *logicalDevice, Queue *queue,
+                                VkDeviceSize stagingSize) {
+  m_logicalDevice = logicalDevice;
+  m_queue = queue;
+
+  m_staging.setUsage(VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+  m_staging.create(m_logicalDevice, stagingSize);
+
+  m_commandPool.setQueueFamily(m_queue->getFamily());
+  m_commandPool.setFlags(VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+  m_commandPool.create(m_logicalDevice);
+
+  m_transferGranularity = m_queue->getFamily()->getMinImageTransferGranularity();
+}
+
+void vdu::UploadManager::setDestinationQueue(Queue *queue) {
+  m_destinationQueue = queue;
+}
+
+void vdu::UploadManager::cmdAcquire(CommandBuffer *cmd,
+                                    QueueSubmission &submission) {
+  cmdAcquire(cmd->getHandle(), submission);
+}
+
+void vdu::UploadManager::cmdAcquire(const VkCommandBuffer &cmd,
+                                    QueueSubmission &submission) {
+  std::vector<VkBufferMemoryBarrier> bufferBarriers;
+  std::vector<VkImageMemoryBarrier> imageBarriers;
+  for (auto upload : m_unacquired) {
+    bufferBarriers.insert(bufferBarriers.end(),
+                          upload->acquireBufferBarriers.begin(),
+                          upload->acquireBufferBarriers.end());
+    imageBarriers.insert(imageBarriers.end(),
+                         upload->acquireImageBarriers.begin(),
+                         upload->acquireImageBarriers.end());
+    submission.addWait(upload->semaphore, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    upload->awaitingAcquire = false;
+  }
+  m_unacquired.clear();
+
+  if (bufferBarriers.empty() && imageBarriers.empty())
+    return;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr,
+                       bufferBarriers.size(), bufferBarriers.data(),
+                       imageBarriers.size(), imageBarriers.data());
+}
+
+void vdu::UploadManager::cmdRelease(CommandBuffer *cmd,
+                                    QueueSubmission &submission) {
+  cmdRelease(cmd->getHandle(), submission);
+}
+
+void vdu::UploadManager::cmdRelease(const VkCommandBuffer &cmd,
+                                    QueueSubmission &submission) {
+  // One hand back at a time, it shares a single semaphore
+  if (!transfersOwnership() || m_returnPending)
+    return;
+  uint32_t srcFamily = m_destinationQueue->getFamily()->getIndex();
+  uint32_t dstFamily = m_queue->getFamily()->getIndex();
+
+  std::vector<VkBufferMemoryBarrier> bufferBarriers;
+  std::vector<VkImageMemoryBarrier> imageBarriers;
+  bool returned = false;
+  for (auto &copy : m_pendingCopies) {
+    if (copy.buffer) {
+      if (!m_destinationBuffers.erase(copy.buffer))
+        continue;
+      VkBufferMemoryBarrier barrier = {};
+      barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+      barrier.srcQueueFamilyIndex = srcFamily;
+      barrier.dstQueueFamilyIndex = dstFamily;
+      barrier.buffer = copy.buffer->getHandle();
+      barrier.offset = 0;
+      barrier.size = VK_WHOLE_SIZE;
+      barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+      bufferBarriers.push_back(barrier);
+      barrier.srcAccessMask = 0;
+      barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      m_returnBufferBarriers.push_back(barrier);
+      returned = true;
+      continue;
+    }
+
+    auto owned = m_destinationTextures.find(copy.texture);
+    if (owned == m_destinationTextures.end())
+      continue;
+    auto &subresource = copy.imageCopy.imageSubresource;
+    auto mip = subresource.mipLevel;
+    auto endLayer = subresource.baseArrayLayer + subresource.layerCount;
+
+    // Runs of layers still owned, discarded contents need no transfer, only
+    // the semaphore ordering the copy after the destination's last use
+    for (auto layer = subresource.baseArrayLayer; layer < endLayer;) {
+      if (!owned->second.erase({mip, layer})) {
+        ++layer;
+        continue;
+      }
+      auto baseLayer = layer;
+      while (++layer < endLayer && owned->second.erase({mip, layer}))
+        ;
+      returned = true;
+      if (copy.oldLayout == VK_IMAGE_LAYOUT_UNDEFINED)
+        continue;
+
+      VkImageMemoryBarrier barrier = {};
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.srcQueueFamilyIndex = srcFamily;
+      barrier.dstQueueFamilyIndex = dstFamily;
+      barrier.image = copy.texture->getHandle();
+      barrier.subresourceRange.aspectMask = copy.texture->getAspectFlags();
+      barrier.subresourceRange.baseMipLevel = mip;
+      barrier.subresourceRange.levelCount = 1;
+      barrier.subresourceRange.baseArrayLayer = baseLayer;
+      barrier.subresourceRange.layerCount = layer - baseLayer;
+      barrier.oldLayout = copy.oldLayout;
+      barrier.newLayout = copy.oldLayout;
+      barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+      imageBarriers.push_back(barrier);
+      barrier.srcAccessMask = 0;
+      barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      m_returnImageBarriers.push_back(barrier);
+    }
+    if (owned->second.empty())
+      m_destinationTextures.erase(owned);
+  }
+  if (!returned)
+    return;
+
+  if (!bufferBarriers.empty() || !imageBarriers.empty())
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                         bufferBarriers.size(), bufferBarriers.data(),
+                         imageBarriers.size(), imageBarriers.data());
+  if (!m_returnSemaphore.getHandle())
+    m_returnSemaphore.create(m_logicalDevice);
+  submission.addSignal(m_returnSemaphore);
+  m_returnPending = true;
+}
+
+void vdu::UploadManager::forget(Buffer *buffer) {
+  m_destinationBuffers.erase(buffer);
+  auto handle = buffer->getHandle();
+  m_returnBufferBarriers.erase(
+      std::remove_if(m_returnBufferBarriers.begin(),
+                     m_returnBufferBarriers.end(),
+                     [handle](const VkBufferMemoryBarrier &barrier) {
+                       return barrier.buffer == handle;
+                     }),
+      m_returnBufferBarriers.end());
+}
+
+void vdu::UploadManager::forget(Texture *texture) {
+  m_destinationTextures.erase(texture);
+  auto handle = texture->getHandle();
+  m_returnImageBarriers.erase(
+      std::remove_if(m_returnImageBarriers.begin(),
+                     m_returnImageBarriers.end(),
+                     [handle](const VkImageMemoryBarrier &barrier) {
+                       return barrier.image == handle;
+                     }),
+      m_returnImageBarriers.end());
+}
+
+void vdu::UploadManager::destroy() {
+  if (!m_logicalDevice)
+    return;
+  waitIdle();
+  for (auto submission : m_submissions) {
+    submission->commandBuffer.free();
+    submission->fence.destroy();
+    if (submission->semaphore.getHandle())
+      submission->semaphore.destroy();
+    delete submission;
+  }
+  m_submissions.clear();
+  m_unacquired.clear();
+  m_destinationBuffers.clear();
+  m_destinationTextures.clear();
+  m_returnBufferBarriers.clear();
+  m_returnImageBarriers.clear();
+  m_returnPending = false;
+  if (m_returnSemaphore.getHandle())
+    m_returnSemaphore.destroy();
+  m_pendingCopies.clear();
+  m_lastFence = nullptr;
+  m_commandPool.destroy();
+  m_staging.destroy();
+}
+
+bool vdu::UploadManager::uploadBuffer(Buffer *dst, const void *data,
+                                      VkDeviceSize size,
+                                      VkDeviceSize dstOffset) {
+  auto staging = allocateStaging(size);
+  if (!staging.data)
+    return false;
+  m_staging.write(staging, data);
+  return queueCopy(staging, dst, dstOffset);
+}
+
+bool vdu::UploadManager::uploadTexture(Texture *dst, const void *data,
+                                       VkDeviceSize size, uint32_t mipLevel,
+                                       uint32_t baseLayer, uint32_t layerCount,
+                                       VkImageLayout oldLayout,
+                                       VkOffset3D offset, VkExtent3D extent) {
+  if (dst->isHostCopyable()) {
+    auto layout = dst->getPackedLayout(mipLevel, 1, baseLayer, layerCount,
+                                       offset, extent);
+    if (layout.size == size && hostCopy(dst, data, layout, oldLayout))
+      return true;
+  }
+
+  auto staging = allocateStaging(size, getStagingAlignment(dst));
+  if (!staging.data)
+    return false;
+  m_staging.write(staging, data);
+  return queueCopy(staging, dst, mipLevel, baseLayer, layerCount, oldLayout,
+                   offset, extent);
+}
+
+bool vdu::UploadManager::uploadTexture(Texture *dst, const void *pixels,
+                                       PixelConverter *converter,
+                                       uint32_t mipLevel, uint32_t baseLayer,
+                                       uint32_t layerCount,
+                                       VkImageLayout oldLayout,
+                                       VkOffset3D offset, VkExtent3D extent) {
+  if (converter->getDestinationFormat() != dst->getFormat()) {
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Error,
+        "Pixel converter does not convert into the texture's format");
+    return false;
+  }
+  if (extent.width == 0)
+    extent = {std::max(1u, dst->getWidth() >> mipLevel),
+              std::max(1u, dst->getHeight() >> mipLevel),
+              std::max(1u, dst->getDepth() >> mipLevel)};
+
+  size_t pixelCount =
+      size_t(extent.width) * extent.height * extent.depth * layerCount;
+  auto staging = allocateStaging(converter->getDestinationSize(pixelCount),
+                                 getStagingAlignment(dst));
+  if (!staging.data)
+    return false;
+  converter->convert(pixels, staging.data, pixelCount);
+  return queueCopy(staging, dst, mipLevel, baseLayer, layerCount, oldLayout,
+                   offset, extent);
+}
+
+bool vdu::UploadManager::uploadTexture(Texture *dst, const void *data,
+                                       const TextureUploadLayout &layout,
+                                       VkImageLayout oldLayout) {
+  if (layout.size == 0) {
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Error,
+        "Texture upload layout has no size");
+    return false;
+  }
+  if (hostCopy(dst, data, layout, oldLayout))
+    return true;
+  auto staging = allocateStaging(layout.size, getStagingAlignment(dst));
+  if (!staging.data)
+    return false;
+  m_staging.write(staging, data);
+  return queueCopy(staging, dst, layout, oldLayout);
+}
+
+vdu::TransientRing::Slice
+vdu::UploadManager::allocateStaging(VkDeviceSize size, VkDeviceSize alignment) {
+  auto staging = m_staging.tryAllocate(size, alignment);
+  if (!staging.data) {
+    // Flushing would retire slices handed out but not yet queued
+    if (m_unqueuedSlices) {
+      m_logicalDevice->_internalReportVduDebug(
+          vdu::LogicalDevice::VduDebugLevel::Error,
+          "Staging arena is full while earlier slices are not queued, queue "
+          "them before allocating more");
+      return staging;
+    }
+
+    // Arena exhausted, push out what is queued and let the GPU drain it
+    flush();
+    waitIdle();
+    staging = m_staging.tryAllocate(size, alignment);
+    if (!staging.data) {
+      m_logicalDevice->_internalReportVduDebug(
+          vdu::LogicalDevice::VduDebugLevel::Error,
+          "Upload is larger than the upload manager's staging arena");
+      return staging;
+    }
+  }
+  ++m_unqueuedSlices;
+  return staging;
+}
+
+bool vdu::UploadManager::queueCopy(const TransientRing::Slice &staging,
+                                   Buffer *dst, VkDeviceSize dstOffset) {
+  sliceQueued();
+  PendingCopy copy = {};
+  copy.buffer = dst;
+  copy.bufferCopy.srcOffset = staging.offset;
+  copy.bufferCopy.dstOffset = dstOffset;
+  copy.bufferCopy.size = staging.size;
+  m_pendingCopies.push_back(copy);
+  return true;
+}
+
+bool vdu::UploadManager::queueCopy(const TransientRing::Slice &staging,
+                                   Texture *dst, uint32_t mipLevel,
+                                   uint32_t baseLayer, uint32_t layerCount,
+                                   VkImageLayout oldLayout, VkOffset3D offset,
+                                   VkExtent3D extent) {
+  sliceQueued();
+  if (extent.width == 0)
+    extent.width = std::max(1u, dst->getWidth() >> mipLevel);
+  if (extent.height == 0)
+    extent.height = std::max(1u, dst->getHeight() >> mipLevel);
+  if (extent.depth == 0)
+    extent.depth = std::max(1u, dst->getDepth() >> mipLevel);
+
+  // A single region copies one aspect, combined formats take the depth here
+  auto aspect = dst->getAspectFlags();
+  if (aspect & VK_IMAGE_ASPECT_DEPTH_BIT)
+    aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+
+  VkBufferImageCopy region = {};
+  region.bufferOffset = staging.offset;
+  region.imageSubresource.aspectMask = aspect;
+  region.imageSubresource.mipLevel = mipLevel;
+  region.imageSubresource.baseArrayLayer = baseLayer;
+  region.imageSubresource.layerCount = layerCount;
+  region.imageOffset = offset;
+  region.imageExtent = extent;
+  return queueImageCopy(dst, region, oldLayout);
+}
+
+bool vdu::UploadManager::queueCopy(const TransientRing::Slice &staging,
+                                   Texture *dst,
+                                   const TextureUploadLayout &layout,
+                                   VkImageLayout oldLayout) {
+  sliceQueued();
+  std::vector<VkBufferImageCopy> regions;
+  dst->getUploadRegions(layout, regions, staging.offset);
+  auto pendingCount = m_pendingCopies.size();
+  for (auto &region : regions)
+    if (!queueImageCopy(dst, region, oldLayout)) {
+      m_pendingCopies.resize(pendingCount);
+      return false;
+    }
+  return true;
+}
+
+void vdu::UploadManager::queueTransition(Texture *dst, uint32_t baseMipLevel,
+                                         uint32_t mipCount, uint32_t baseLayer,
+                                         uint32_t layerCount,
+                                         VkImageLayout oldLayout) {
+  auto aspect = dst->getAspectFlags();
+  if (aspect & VK_IMAGE_ASPECT_DEPTH_BIT)
+    aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+  for (auto mip = baseMipLevel; mip < baseMipLevel + mipCount; ++mip) {
+    PendingCopy copy = {};
+    copy.texture = dst;
+    copy.oldLayout = oldLayout;
+    copy.transitionOnly = true;
+    copy.imageCopy.imageSubresource = {aspect, mip, baseLayer, layerCount};
+    m_pendingCopies.push_back(copy);
+  }
+}
+
+void vdu::UploadManager::sliceQueued() {
+  if (m_unqueuedSlices)
+    --m_unqueuedSlices;
+}
+
+VkDeviceSize vdu::UploadManager::getStagingAlignment(Texture *texture) {
+  // Buffer offsets of image copies must be a multiple of 4 and of the block
+  // size, formats outside the format table take the largest block size
+  VkDeviceSize blockSize = texture->getFormatInfo().bytesPerBlock;
+  if (blockSize == 0)
+    blockSize = 16;
+  auto alignment = blockSize;
+  while (alignment % 4)
+    alignment += blockSize;
+  return alignment;
+}
+
+bool vdu::UploadManager::hostCopy(Texture *dst, const void *data,
+                                  const TextureUploadLayout &layout,
+                                  VkImageLayout oldLayout) {
+  if (!dst->isHostCopyable())
+    return false;
+
+  // A queued copy to the texture would land after this one
+  for (auto &copy : m_pendingCopies)
+    if (copy.texture == dst)
+      return false;
+
+  // The same final layout as a staged copy
+  auto newLayout = dst->getLayout();
+  if (newLayout == VK_IMAGE_LAYOUT_UNDEFINED)
+    newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  return dst->copyFromMemory(data, layout, oldLayout, newLayout);
+}
+
+bool vdu::UploadManager::queueImageCopy(Texture *dst,
+                                        const VkBufferImageCopy &region,
+                                        VkImageLayout oldLayout) {
+  auto mipLevel = region.imageSubresource.mipLevel;
+  if (!respectsGranularity(region.imageOffset.x, region.imageExtent.width,
+                           std::max(1u, dst->getWidth() >> mipLevel),
+                           m_transferGranularity.width) ||
+      !respectsGranularity(region.imageOffset.y, region.imageExtent.height,
+                           std::max(1u, dst->getHeight() >> mipLevel),
+                           m_transferGranularity.height) ||
+      !respectsGranularity(region.imageOffset.z, region.imageExtent.depth,
+                           std::max(1u, dst->getDepth() >> mipLevel),
+                           m_transferGranularity.depth)) {
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Error,
+        "Image upload region does not respect the upload queue's minimum "
+        "image transfer granularity");
+    return false;
+  }
+
+  PendingCopy copy = {};
+  copy.texture = dst;
+  copy.oldLayout = oldLayout;
+  copy.imageCopy = region;
+  m_pendingCopies.push_back(copy);
+  return true;
+}
+
+bool vdu::UploadManager::isDestinationOwned(const PendingCopy &copy) {
+  if (copy.buffer)
+    return m_destinationBuffers.count(copy.buffer) != 0;
+  auto owned = m_destinationTextures.find(copy.texture);
+  if (owned == m_destinationTextures.end())
+    return false;
+  auto &subresource = copy.imageCopy.imageSubresource;
+  for (uint32_t i = 0; i < subresource.layerCount; ++i)
+    if (owned->second.count(
+            {subresource.mipLevel, subresource.baseArrayLayer + i}))
+      return true;
+  return false;
+}
+
+const vdu::Fence *vdu::UploadManager::flush() {
+  if (m_pendingCopies.empty())
+    return nullptr;
+  if (m_unacquired.size() >= maxUnacquiredFlushes) {
+    m_logicalDevice->_internalReportVduDebug(
+        vdu::LogicalDevice::VduDebugLevel::Error,
+        "Too many upload flushes waiting for cmdAcquire(), copies stay "
+        "queued");
+    return nullptr;
+  }
+  // Waits for the destination queue to hand them back with cmdRelease()
+  for (auto &copy : m_pendingCopies)
+    if (isDestinationOwned(copy))
+      return nullptr;
+
+  // Retire finished uploads before any of their fences is reset
+  m_staging.beginFrame();
+  auto submission = acquireSubmission();
+
+  auto &cmd = submission->commandBuffer;
+  cmd.begin(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  recordCopies(cmd.getHandle(), submission);
+  cmd.end();
+
+  QueueSubmission queueSubmission;
+  queueSubmission.addCommands(&cmd);
+  if (m_returnPending) {
+    queueSubmission.addWait(m_returnSemaphore, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    m_returnPending = false;
+  }
+  if (m_destinationQueue && m_destinationQueue != m_queue) {
+    if (!submission->semaphore.getHandle())
+      submission->semaphore.create(m_logicalDevice);
+    queueSubmission.addSignal(submission->semaphore);
+    submission->awaitingAcquire = true;
+    m_unacquired.push_back(submission);
+  }
+  VDU_VK_CHECK_RESULT(m_queue->submit(queueSubmission, submission->fence),
+                      "submitting uploads");
+
+  // Slices still unqueued were given up on, they retire with this frame
+  m_staging.endFrame(&submission->fence);
+  m_pendingCopies.clear();
+  m_unqueuedSlices = 0;
+  m_lastFence = &submission->fence;
+  return m_lastFence;
+}
+
+void vdu::UploadManager::waitIdle() {
+  for (auto submission : m_submissions)
+    if (submission->inFlight) {
+      submission->fence.wait();
+      submission->inFlight = false;
+    }
+  m_staging.beginFrame();
+}
+
+vdu::UploadManager::Submission *vdu::UploadManager::acquireSubmission() {
+  for (auto submission : m_submissions) {
+    if (submission->awaitingAcquire ||
+        (submission->inFlight && !submission->fence.isSignalled()))
+      continue;
+    submission->fence.reset();
+    submission->commandBuffer.reset();
+    submission->inFlight = true;
+    return submission;
+  }
+
+  auto submission = new Submission();
+  submission->commandBuffer.allocate(m_logicalDevice, &m_commandPool);
+  submission->fence.create(m_logicalDevice);
+  submission->inFlight = true;
+  m_submissions.push_back(submission);
+  return submission;
+}
+
+bool vdu::UploadManager::transfersOwnership() {
+  return m_destinationQueue &&
+         m_destinationQueue->getFamily()->getIndex() !=
+             m_queue->getFamily()->getIndex();
+}
+
+void vdu::UploadManager::recordCopies(const VkCommandBuffer &cmd,
+                                      Submission *submission) {
+  std::vector<VkImageMemoryBarrier> preBarriers;
+  std::vector<VkImageMemoryBarrier> postBarriers;
+  std::vector<VkBufferMemoryBarrier> releaseBarriers;
+
+  // Released to the destination family, which acquires with the same barriers
+  uint32_t srcFamily = VK_QUEUE_FAMILY_IGNORED;
+  uint32_t dstFamily = VK_QUEUE_FAMILY_IGNORED;
+  submission->acquireBufferBarriers.clear();
+  submission->acquireImageBarriers.clear();
+  if (transfersOwnership()) {
+    srcFamily = m_queue->getFamily()->getIndex();
+    dstFamily = m_destinationQueue->getFamily()->getIndex();
+  }
+
+  // Handed back by cmdRelease(), flush() waits on its semaphore
+  if (!m_returnBufferBarriers.empty() || !m_returnImageBarriers.empty())
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr,
+                         m_returnBufferBarriers.size(),
+                         m_returnBufferBarriers.data(),
+                         m_returnImageBarriers.size(),
+                         m_returnImageBarriers.data());
+  m_returnBufferBarriers.clear();
+  m_returnImageBarriers.clear();
+
+  // One transition per touched layer, even if it is written twice, keeping
+  // the layout of the first copy that touches it
+  std::map<std::pair<Texture *, uint32_t>, std::map<uint32_t, VkImageLayout>>
+      transitioned;
+  for (auto &copy : m_pendingCopies) {
+    if (!copy.texture)
+      continue;
+    auto &subresource = copy.imageCopy.imageSubresource;
+    auto &layers = transitioned[{copy.texture, subresource.mipLevel}];
+    for (uint32_t i = 0; i < subresource.layerCount; ++i)
+      layers.insert({subresource.baseArrayLayer + i, copy.oldLayout});
+  }
+
+  for (auto &mip : transitioned) {
+    auto texture = mip.first.first;
+    auto mipLevel = mip.first.second;
+    auto &layers = mip.second;
+
+    // Runs of adjacent layers in the same layout share a barrier
+    for (auto it = layers.begin(); it != layers.end();) {
+      auto baseLayer = it->first;
+      auto oldLayout = it->second;
+      uint32_t layerCount = 0;
+      for (; it != layers.end() && it->first == baseLayer + layerCount &&
+             it->second == oldLayout;
+           ++it)
+        ++layerCount;
+
+      VkImageMemoryBarrier barrier = {};
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.image = texture->getHandle();
+      barrier.subresourceRange.aspectMask = texture->getAspectFlags();
+      barrier.subresourceRange.baseMipLevel = mipLevel;
+      barrier.subresourceRange.levelCount = 1;
+      barrier.subresourceRange.baseArrayLayer = baseLayer;
+      barrier.subresourceRange.layerCount = layerCount;
+
+      barrier.oldLayout = oldLayout;
+      barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      barrier.srcAccessMask = oldLayout == VK_IMAGE_LAYOUT_UNDEFINED
+                                  ? 0
+                                  : VK_ACCESS_MEMORY_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      preBarriers.push_back(barrier);
+
+      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      barrier.newLayout = texture->getLayout();
+      if (barrier.newLayout == VK_IMAGE_LAYOUT_UNDEFINED)
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      if (srcFamily != dstFamily) {
+        auto &owned = m_destinationTextures[texture];
+        for (uint32_t i = 0; i < layerCount; ++i)
+          owned.insert({mipLevel, baseLayer + i});
+        barrier.srcQueueFamilyIndex = srcFamily;
+        barrier.dstQueueFamilyIndex = dstFamily;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = 0;
+        postBarriers.push_back(barrier);
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        submission->acquireImageBarriers.push_back(barrier);
+      } else if (barrier.newLayout != barrier.oldLayout) {
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+        postBarriers.push_back(barrier);
+      }
+    }
+  }
+
+  for (auto &copy : m_pendingCopies) {
+    if (!copy.buffer || srcFamily == dstFamily)
+      continue;
+    m_destinationBuffers.insert(copy.buffer);
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = srcFamily;
+    barrier.dstQueueFamilyIndex = dstFamily;
+    barrier.buffer = copy.buffer->getHandle();
+    barrier.offset = copy.bufferCopy.dstOffset;
+    barrier.size = copy.bufferCopy.size;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    releaseBarriers.push_back(barrier);
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask =
+        VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    submission->acquireBufferBarriers.push_back(barrier);
+  }
+
+  // Earlier reads of the destination buffers must finish before overwriting
+  VkMemoryBarrier memoryBarrier = {};
+  memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  memoryBarrier.srcAccessMask =
+      VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+  memoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &memoryBarrier, 0,
+                       nullptr, preBarriers.size(), preBarriers.data());
+
+  // One copy command per destination, a later upload wins where ranges overlap
+  m_copyBatch.clear();
+  for (auto &copy : m_pendingCopies) {
+    if (copy.transitionOnly)
+      continue;
+    if (copy.buffer)
+      m_copyBatch.addCopy(m_staging.getHandle(), copy.buffer->getHandle(),
+                          copy.bufferCopy);
+    else
+      m_copyBatch.addCopy(m_staging.getHandle(), copy.texture, copy.imageCopy);
+  }
+  m_copyBatch.cmdCopy(cmd);
+
+  memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  memoryBarrier.dstAccessMask =
+      VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &memoryBarrier,
+                       releaseBarriers.size(), releaseBarriers.data(),
+                       postBarriers.size(), postBarriers.data());
+}
@@ -0,0 +1,126 @@
+#include "VDU.hpp"
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+constexpr size_t copySize = 64 * 1024 * 1024;
+constexpr int repetitions = 8;
+
+using CopyFunction = void (*)(void *, const void *, size_t);
+
+static void plainCopy(void *dst, const void *src, size_t size) {
+  memcpy(dst, src, size);
+}
+
+// Best of several runs in GB/s, the range is split evenly between threads
+static double measure(CopyFunction copy, uint8_t *dst, const uint8_t *src,
+                      size_t size, unsigned threadCount) {
+  double best = 0.0;
+  for (int r = 0; r < repetitions; ++r) {
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> threads;
+    size_t part = size / threadCount;
+    for (unsigned t = 0; t < threadCount; ++t) {
+      size_t offset = t * part;
+      size_t length = t + 1 == threadCount ? size - offset : part;
+      threads.emplace_back(copy, dst + offset, src + offset, length);
+    }
+    for (auto &thread : threads)
+      thread.join();
+    std::chrono::duration<double> time =
+        std::chrono::high_resolution_clock::now() - start;
+    best = std::max(best, size / time.count() / 1e9);
+  }
+  return best;
+}
+
+static std::string describe(VkMemoryPropertyFlags flags) {
+  std::string text;
+  if (flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+    text += "DEVICE_LOCAL ";
+  if (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+    text += "HOST_COHERENT ";
+  if (flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT)
+    text += "HOST_CACHED ";
+  return text;
+}
+
+int main() {
+  vdu::Instance instance;
+  instance.setApplicationName("HostCopy");
+  instance.create();
+
+  vdu::PhysicalDevice *physicalDevice =
+      &instance.enumratePhysicalDevices().front();
+  std::cout << "Vulkan device used: "
+            << physicalDevice->getDeviceProperties().deviceName << "\n";
+
+  vdu::Queue queue;
+  queue = physicalDevice->getQueueFamilies().front().createQueue(1.f);
+  vdu::LogicalDevice device;
+  device.addQueue(&queue);
+  device.create(physicalDevice);
+
+  // The source is offset by one byte in the unaligned runs
+  std::vector<uint8_t> source(copySize + 1);
+  for (size_t i = 0; i < source.size(); ++i)
+    source[i] = uint8_t(i * 31);
+
+  unsigned threadCount = std::max(1u, std::thread::hardware_concurrency());
+  std::cout << std::fixed << std::setprecision(2) << "Copying "
+            << copySize / (1024 * 1024) << " MiB, GB/s with 1 and "
+            << threadCount << " threads\n";
+
+  // Raw allocations, so that every host visible memory type can be measured
+  auto &memoryProperties = physicalDevice->getMemoryProperties();
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i) {
+    auto flags = memoryProperties.memoryTypes[i].propertyFlags;
+    if (!(flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+      continue;
+
+    std::cout << "\nMemory type " << i << ": HOST_VISIBLE "
+              << describe(flags) << "\n";
+
+    VkMemoryAllocateInfo allocateInfo = {};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocateInfo.allocationSize = copySize;
+    allocateInfo.memoryTypeIndex = i;
+    VkDeviceMemory memory;
+    void *mapped;
+    if (vkAllocateMemory(device.getHandle(), &allocateInfo, nullptr,
+                         &memory) != VK_SUCCESS) {
+      std::cout << "  Allocation failed, skipped\n";
+      continue;
+    }
+    if (vkMapMemory(device.getHandle(), memory, 0, VK_WHOLE_SIZE, 0,
+                    &mapped) != VK_SUCCESS) {
+      std::cout << "  Mapping failed, skipped\n";
+      vkFreeMemory(device.getHandle(), memory, nullptr);
+      continue;
+    }
+
+    auto dst = (uint8_t *)mapped;
+    auto src = source.data();
+    for (unsigned threads : {1u, threadCount}) {
+      std::cout << "  " << threads << " thread(s)  memcpy "
+                << measure(plainCopy, dst, src, copySize, threads)
+                << "  streamCopy "
+                << measure(vdu::streamCopy, dst, src, copySize, threads)
+                << "  streamCopy unaligned "
+                << measure(vdu::streamCopy, dst, src + 1, copySize - 1,
+                           threads)
+                << "\n";
+    }
+    std::cout << "  copyToMapped uses "
+              << (flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT ? "memcpy"
+                                                             : "streamCopy")
+              << "\n";
+
+    vkUnmapMemory(device.getHandle(), memory);
+    vkFreeMemory(device.getHandle(), memory, nullptr);
+  }
+
+  device.destroy();
+  instance.destroy();
+}
@@ -4,6 +4,7 @@
 #include <cmath>
 #include <iostream>
 #include <string.h>
+#include <thread>
 
 constexpr uint32_t resX = 1920;
 constexpr uint32_t resY = 1080;
@@ -125,17 +126,10 @@ int main() {
   descSet.submitUpdater(updater);
   descSet.destroyUpdater(updater);
 
-  // Create command pool, we may need two if the compute and transfer queues are
-  // not the same
-  vdu::CommandPool cmdPool, cmdPool2;
+  // Create command pool for the compute queue, the readback keeps its own
+  vdu::CommandPool cmdPool;
   cmdPool.setQueueFamily(computeQueue.getFamily());
   cmdPool.create(&device);
-  if (computeQueue.sameFamilyAs(transferQueue)) {
-    cmdPool2 = cmdPool;
-  } else {
-    cmdPool2.setQueueFamily(transferQueue.getFamily());
-    cmdPool2.create(&device);
-  }
 
   // Allocate command buffer for draw commands
   vdu::CommandBuffer drawCommands;
@@ -190,60 +184,32 @@ int main() {
   drawMandelbrot.addCommands(cmd);
   drawMandelbrot.addSignal(sem);
   computeQueue.submit(drawMandelbrot);
-  computeQueue.waitIdle();
-
-  // Create a host visible buffer to retrieve mandelbrot texture
-  vdu::Buffer outputBuffer;
-  outputBuffer.setMemoryProperty(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-                                 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-  outputBuffer.setUsage(VK_BUFFER_USAGE_TRANSFER_DST_BIT);
-  outputBuffer.create(&device, resX * resY * outputTexture.getBytesPerPixel());
-
-  // Allocate and write commands to transfer mandelbrot texture to host visible
-  // buffer
-  vdu::CommandBuffer transferCommands;
-  transferCommands.allocate(&device, &cmdPool2);
-
-  transferCommands.begin();
-  cmd = transferCommands.getHandle();
 
-  VkBufferImageCopy biCopy{};
-  biCopy.imageExtent = VkExtent3D{resX, resY, 1};
-  biCopy.imageSubresource =
-      VkImageSubresourceLayers{VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  // Read the texture back on the transfer queue once the dispatch is done,
+  // neither queue is drained and this thread is free until the copy lands
+  vdu::Readback readback;
+  readback.create(&device, &transferQueue);
+  auto request = readback.requestTexture(
+      &outputTexture, VK_IMAGE_LAYOUT_GENERAL, 0, 0, 1, {0, 0, 0},
+      {resX, resY, 1}, &sem, VK_PIPELINE_STAGE_TRANSFER_BIT);
 
-  vkCmdCopyImageToBuffer(cmd, outputTexture.getHandle(),
-                         VK_IMAGE_LAYOUT_GENERAL, outputBuffer.getHandle(), 1,
-                         &biCopy);
+  while (!readback.isReady(request))
+    std::this_thread::yield();
 
-  transferCommands.end();
-
-  // Submit the transfer commands
-  vdu::QueueSubmission transferMandelbrot;
-  transferMandelbrot.addCommands(cmd);
-  transferMandelbrot.addWait(sem, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
-  transferQueue.submit(transferMandelbrot);
-
-  // Wait until the transfer is done and save the texture to a file
-  transferQueue.waitIdle();
-
-  unsigned char *dat = (unsigned char *)outputBuffer.getMemory()->map();
+  // Rows are tightly packed here, copyRows() would repack them otherwise
+  auto dat = (unsigned char *)readback.getData(request);
   saveBitmapToFile("mandelbrot.bmp", dat, resX, resY);
-  outputBuffer.getMemory()->unmap();
+  readback.release(request);
 
   // Cleanup vulkan objects
   vkDestroySampler(device.getHandle(), texSampler, nullptr);
   sem.destroy();
+  readback.destroy();
   outputTexture.destroy();
-  outputBuffer.destroy();
   pipeline.destroy();
   pipelineLayout.destroy();
   drawCommands.free();
-  transferCommands.free();
   cmdPool.destroy();
-  if (!transferQueue.sameFamilyAs(computeQueue)) {
-    cmdPool2.destroy();
-  }
   descSetLayout.destroy();
   descPool.destroy();
   shader.destroy();
@@ -260,19 +226,13 @@ void saveBitmapToFile(const char *file, unsigned char *bitmap, int width,
   size_t filesize = 54 + imageSize;
 
   unsigned char *out = new unsigned char[imageSize];
-  memset(out, 0, imageSize);
-
-  for (int i = 0; i < width; i++) {
-    for (int j = 0; j < height; j++) {
-      int x = i;
-      int y = (height - 1) - j;
-      out[(x + y * width) * 3 + 2] =
-          (unsigned char)(bitmap[(j * width + i) * 4 + 0]);
-      out[(x + y * width) * 3 + 1] =
-          (unsigned char)(bitmap[(j * width + i) * 4 + 1]);
-      out[(x + y * width) * 3 + 0] =
-          (unsigned char)(bitmap[(j * width + i) * 4 + 2]);
-    }
+
+  // BMP stores BGR rows, drop alpha and swap red and blue a row at a time
+  vdu::PixelConverter converter;
+  converter.create(VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_B8G8R8_UNORM);
+  for (int j = 0; j < height; j++) {
+    int y = (height - 1) - j;
+    converter.convert(bitmap + j * width * 4, out + y * width * 3, width);
   }
 
   unsigned char bmpfileheader[14] = {'B', 'M', 0, 0,  0, 0, 0,